@@ -18,59 +18,488 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#pragma once
+
+#include <stdio.h>
 #include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/sync.h>
 #include <hardware/clocks.h>
 
-// Wrapper class for PIO programs, abstracting common operations out
-// TODO - Make dualcore safe
-// TODO - Add unload/destructor
-class PIOProgram
+/*
+    PIORegistry, one owner of the PIO resources for both cores
+
+    Instruction memory  a program is loaded once per PIO and shared, every load() is a reference,
+                        the last unload() frees the slots. When the free slots are enough but not
+                        in one piece, the relocatable programs are moved together ( compact )
+    State machines      claimed with the program they run and an owner name ( static string ).
+                        A claimed state machine keeps its program in place, so the offset from claim()
+                        stays valid, until the owner calls movable() after the init. Then compact()
+                        stops the state machine, moves the program, moves the wrap and the pc with it,
+                        calls the owner's moved() for offsets it keeps ( jmp targets, configs ) and
+                        starts it again when it was running
+    DMA channels        paired with a state machine, released with it
+
+    All under one hardware spin lock, claimed before main, the SDK claim functions are called inside it.
+    Code that loads programs with pio_add_program() directly still works, its slots are only not moved
+*/
+
+#ifndef PIO_SPINLOCK
+#define PIO_SPINLOCK PICO_SPINLOCK_ID_CLAIM_FREE_LAST /* claimed, so spin_lock_claim_unused() does not give it */
+#endif
+
+#ifndef PIO_PROGRAMS
+#define PIO_PROGRAMS 8 /* loaded programs per PIO */
+#endif
+
+class PIORegistry
 {
 public:
-    PIOProgram(const pio_program_t *pgm) { _pgm = pgm; }
+    // Load PGM on PIO or share the loaded copy, returns the offset or -1
+    // Without a claimed state machine the program may be moved, read offset() after claimSM()
+    static int load(PIO pio, const pio_program_t *pgm, const char *owner = nullptr)
+    {
+        uint32_t save = _lock();
+        int offset = _load(pio, pgm, owner);
+        _unlock(save);
+        return offset;
+    }
 
-    // Possibly load into a PIO and allocate a SM
-    bool prepare(PIO *pio, int *sm, int *offset)
+    // Drop one reference, the last one frees the instruction memory
+    static bool unload(PIO pio, const pio_program_t *pgm)
+    {
+        uint32_t save = _lock();
+        bool result = _unload(pio, pgm);
+        _unlock(save);
+        return result;
+    }
+
+    // Offset of PGM on PIO or -1, compact() moves a program while its claimed state machines are movable()
+    static int offset(PIO pio, const pio_program_t *pgm)
+    {
+        uint32_t save = _lock();
+        _Program *p = _find(pio, pgm);
+        int offset = p ? p->offset : -1;
+        _unlock(save);
+        return offset;
+    }
+
+    // Free state machine of PIO for PGM ( may be null ), -1: none
+    static int claimSM(PIO pio, const pio_program_t *pgm, const char *owner)
+    {
+        uint32_t save = _lock();
+        int sm = pio_claim_unused_sm(pio, false);
+        if (sm >= 0)
+        {
+            _SM &s = _state().sm[pio_get_index(pio)][sm];
+            s = _SM();
+            s.pgm = pgm;
+            s.owner = owner;
+        }
+        _unlock(save);
+        return sm;
+    }
+
+    /*
+        The owner allows compact() to move the program of a claimed and initialized state machine.
+        MOVED ( may be null ) gets the new offset, the state machine is stopped then and is started
+        after it when it was running. It is called in the registry lock with the interrupts off:
+        short, no registry calls
+    */
+    static void movable(PIO pio, uint sm, void (*moved)(void *ctx, PIO pio, uint sm, uint offset) = nullptr, void *ctx = nullptr)
+    {
+        uint32_t save = _lock();
+        _SM &s = _state().sm[pio_get_index(pio)][sm];
+        s.movable = true;
+        s.moved = moved;
+        s.ctx = ctx;
+        _unlock(save);
+    }
+
+    // Stops the state machine, releases its DMA channels
+    static void releaseSM(PIO pio, uint sm)
+    {
+        uint32_t save = _lock();
+        _releaseSM(pio, sm);
+        _unlock(save);
+    }
+
+    // DMA channel paired with the state machine, -1: none
+    static int claimDMA(PIO pio, uint sm)
+    {
+        uint32_t save = _lock();
+        int ch = dma_claim_unused_channel(false);
+        if (ch >= 0)
+            _state().dma[ch] = 1 + pio_get_index(pio) * NUM_PIO_STATE_MACHINES + sm;
+        _unlock(save);
+        return ch;
+    }
+
+    static void releaseDMA(uint ch)
+    {
+        uint32_t save = _lock();
+        _releaseDMA(ch);
+        _unlock(save);
+    }
+
+    /*
+        Program and state machine together. *pio null: the PIO which runs PGM already, else pio0, pio1,
+        else the given PIO only. False: no state machine or no room, nothing is claimed
+    */
+    static bool claim(const pio_program_t *pgm, PIO *pio, int *sm, int *offset, const char *owner)
+    {
+        PIO order[NUM_PIOS] = {pio0, pio1};
+        int count = NUM_PIOS;
+        bool result = false;
+        uint32_t save = _lock();
+        if (*pio)
+        {
+            order[0] = *pio;
+            count = 1;
+        }
+        else if (!_find(pio0, pgm) && _find(pio1, pgm))
+        {
+            order[0] = pio1;
+            order[1] = pio0;
+        }
+        for (int i = 0; i < count && !result; i++)
+        {
+            int s = pio_claim_unused_sm(order[i], false);
+            if (s < 0)
+                continue;
+            int off = _load(order[i], pgm, owner);
+            if (off < 0)
+            {
+                pio_sm_unclaim(order[i], s);
+                continue;
+            }
+            _SM &st = _state().sm[pio_get_index(order[i])][s];
+            st = _SM();
+            st.pgm = pgm;
+            st.owner = owner;
+            *pio = order[i];
+            *sm = s;
+            *offset = off;
+            result = true;
+        }
+        _unlock(save);
+        return result;
+    }
+
+    static void release(PIO pio, uint sm, const pio_program_t *pgm)
+    {
+        uint32_t save = _lock();
+        _releaseSM(pio, sm);
+        _unload(pio, pgm);
+        _unlock(save);
+    }
+
+    // Move the relocatable programs with movable() or no state machines to the top, returns the largest free piece
+    static int compact(PIO pio)
+    {
+        uint32_t save = _lock();
+        int result = _compact(pio);
+        _unlock(save);
+        return result;
+    }
+
+    // Used instruction slots, bit N: slot N
+    static uint32_t memory(PIO pio)
+    {
+        uint32_t save = _lock();
+        uint32_t used = _used(pio);
+        _unlock(save);
+        return used;
+    }
+
+    static void report()
+    {
+        const char *dash = "-";
+        for (int i = 0; i < NUM_PIOS; i++)
+        {
+            PIO pio = i ? pio1 : pio0;
+            uint32_t save = _lock();
+            uint32_t used = _used(pio);
+            _State st = _state(); // print a copy, out of the lock
+            _unlock(save);
+            char map[PIO_INSTRUCTION_COUNT + 1];
+            for (int n = 0; n < PIO_INSTRUCTION_COUNT; n++)
+                map[n] = used & (1u << n) ? '#' : '.';
+            map[PIO_INSTRUCTION_COUNT] = 0;
+            printf("pio%d %s\n", i, map);
+            for (int n = 0; n < PIO_PROGRAMS; n++)
+            {
+                _Program &p = st.prog[i][n];
+                if (p.pgm)
+                    printf("  program %08X offset %2u length %2u refs %u %s\n", (unsigned)p.pgm, p.offset,
+                           p.pgm->length, p.refs, p.owner ? p.owner : dash);
+            }
+            for (int n = 0; n < NUM_PIO_STATE_MACHINES; n++)
+            {
+                if (!pio_sm_is_claimed(pio, n))
+                    continue;
+                printf("  sm %d %-7s %-7s %s", n, pio->ctrl & (1u << n) ? "running" : "stopped",
+                       st.sm[i][n].movable ? "movable" : "fixed", st.sm[i][n].owner ? st.sm[i][n].owner : dash);
+                for (int ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+                    if (st.dma[ch] == 1 + i * NUM_PIO_STATE_MACHINES + n)
+                        printf(" dma %d", ch);
+                printf("\n");
+            }
+        }
+    }
+
+private:
+    struct _Program
+    {
+        const pio_program_t *pgm;
+        const char *owner;
+        uint8_t offset;
+        uint8_t refs;
+    };
+
+    struct _SM
+    {
+        const pio_program_t *pgm;
+        const char *owner;
+        bool movable;
+        void (*moved)(void *ctx, PIO pio, uint sm, uint offset);
+        void *ctx;
+    };
+
+    struct _State
+    {
+        _Program prog[NUM_PIOS][PIO_PROGRAMS];
+        _SM sm[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+        uint8_t dma[NUM_DMA_CHANNELS]; // 1 + pio * 4 + sm, 0: not paired
+    };
+
+    static _State &_state()
     {
-        // Is there an open slot to run in, first?
-        if (!_findFreeSM(pio, sm))
+        static _State stat_state;
+        return stat_state;
+    }
+
+    // Before main on core 0, the first use can not race. Every includer has a copy, the first one claims
+    static void __attribute__((constructor)) _claim_lock()
+    {
+        if (!spin_lock_is_claimed(PIO_SPINLOCK))
+            spin_lock_claim(PIO_SPINLOCK);
+    }
+
+    static uint32_t _lock() { return spin_lock_blocking(spin_lock_instance(PIO_SPINLOCK)); }
+    static void _unlock(uint32_t save) { spin_unlock(spin_lock_instance(PIO_SPINLOCK), save); }
+
+    static _Program *_find(PIO pio, const pio_program_t *pgm)
+    {
+        _Program *p = _state().prog[pio_get_index(pio)];
+        for (int i = 0; i < PIO_PROGRAMS; i++)
+            if (p[i].pgm == pgm)
+                return &p[i];
+        return nullptr;
+    }
+
+    static int _load(PIO pio, const pio_program_t *pgm, const char *owner)
+    {
+        _Program *p = _find(pio, pgm);
+        if (!p)
+        {
+            if (!(p = _find(pio, nullptr)))
+                return -1;
+            if (!pio_can_add_program(pio, pgm) && (_compact(pio) < pgm->length || !pio_can_add_program(pio, pgm)))
+                return -1;
+            p->offset = pio_add_program(pio, pgm);
+            p->pgm = pgm;
+            p->owner = owner;
+            p->refs = 0;
+        }
+        if (!p->owner)
+            p->owner = owner;
+        p->refs++;
+        return p->offset;
+    }
+
+    static bool _unload(PIO pio, const pio_program_t *pgm)
+    {
+        _Program *p = _find(pio, pgm);
+        if (!p)
             return false;
-        // Is it loaded on that PIO?
-        if (_offset[pio_get_index(*pio)] < 0)
+        if (0 == --p->refs)
         {
-            // Nope, need to load it
-            if (!pio_can_add_program(*pio, _pgm))
-                return false;
-            _offset[pio_get_index(*pio)] = pio_add_program(*pio, _pgm);
+            pio_remove_program(pio, pgm, p->offset);
+            p->pgm = nullptr;
+            p->owner = nullptr;
         }
-        // Here it's guaranteed loaded, return values
-        // PIO and SM already set
-        *offset = _offset[pio_get_index(*pio)];
         return true;
     }
 
-private:
-    // Find an unused PIO state machine to grab, returns false when none available
-    static bool _findFreeSM(PIO *pio, int *sm)
+    static void _releaseSM(PIO pio, uint sm)
+    {
+        uint8_t tag = 1 + pio_get_index(pio) * NUM_PIO_STATE_MACHINES + sm;
+        for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+            if (_state().dma[ch] == tag)
+                _releaseDMA(ch);
+        pio_sm_set_enabled(pio, sm, false);
+        if (pio_sm_is_claimed(pio, sm))
+            pio_sm_unclaim(pio, sm);
+        _state().sm[pio_get_index(pio)][sm] = _SM();
+    }
+
+    static void _releaseDMA(uint ch)
+    {
+        dma_channel_abort(ch);
+        if (dma_channel_is_claimed(ch))
+            dma_channel_unclaim(ch);
+        _state().dma[ch] = 0;
+    }
+
+    // The SDK keeps the map, a one instruction program asks slot by slot
+    static uint32_t _used(PIO pio)
+    {
+        static const uint16_t nop = 0xA042; // mov y, y
+        const pio_program_t probe = {&nop, 1, -1};
+        uint32_t used = 0;
+        for (uint i = 0; i < PIO_INSTRUCTION_COUNT; i++)
+            if (!pio_can_add_program_at_offset(pio, &probe, i))
+                used |= 1u << i;
+        return used;
+    }
+
+    static int _place(uint32_t used, uint length)
+    {
+        uint32_t mask = (1u << length) - 1;
+        for (int i = PIO_INSTRUCTION_COUNT - length; i >= 0; i--) // top down as the SDK
+            if (!(used & (mask << i)))
+                return i;
+        return -1;
+    }
+
+    static int _largest(uint32_t used)
     {
-        int idx = pio_claim_unused_sm(pio0, false);
-        if (idx >= 0)
+        int largest = 0;
+        for (int run = 0, i = 0; i < PIO_INSTRUCTION_COUNT; i++)
         {
-            *pio = pio0;
-            *sm = idx;
-            return true;
+            run = used & (1u << i) ? 0 : run + 1;
+            if (run > largest)
+                largest = run;
         }
-        idx = pio_claim_unused_sm(pio1, false);
-        if (idx >= 0)
+        return largest;
+    }
+
+    // The owner of a claimed state machine keeps the offset ( jmp to the start ), even while stopped, until movable()
+    static bool _movable(PIO pio, const _Program &p)
+    {
+        if (!p.pgm || p.pgm->origin >= 0)
+            return false;
+        _SM *s = _state().sm[pio_get_index(pio)];
+        for (int i = 0; i < NUM_PIO_STATE_MACHINES; i++)
+            if (s[i].pgm == p.pgm && pio_sm_is_claimed(pio, i) && !s[i].movable)
+                return false;
+        return true;
+    }
+
+    // Stopped state machine: wrap and pc follow the program from FROM to TO
+    static void _rebase(PIO pio, uint sm, uint from, uint to, uint length)
+    {
+        uint32_t exec = pio->sm[sm].execctrl;
+        uint bottom = (exec & PIO_SM0_EXECCTRL_WRAP_BOTTOM_BITS) >> PIO_SM0_EXECCTRL_WRAP_BOTTOM_LSB;
+        uint top = (exec & PIO_SM0_EXECCTRL_WRAP_TOP_BITS) >> PIO_SM0_EXECCTRL_WRAP_TOP_LSB;
+        uint pc = pio_sm_get_pc(pio, sm);
+        pio_sm_set_wrap(pio, sm, bottom - from + to, top - from + to);
+        pio_sm_exec(pio, sm, pio_encode_jmp(pc >= from && pc < from + length ? pc - from + to : to));
+    }
+
+    // Plan on a copy of the map, change nothing when a program does not fit
+    static int _compact(PIO pio)
+    {
+        _Program *prog = _state().prog[pio_get_index(pio)];
+        uint32_t used = _used(pio), fixed = used;
+        int order[PIO_PROGRAMS], place[PIO_PROGRAMS], count = 0;
+        for (int i = 0; i < PIO_PROGRAMS; i++)
+        {
+            if (!_movable(pio, prog[i]))
+                continue;
+            fixed &= ~(((1u << prog[i].pgm->length) - 1) << prog[i].offset);
+            int k = count++;
+            for (; k && prog[order[k - 1]].pgm->length < prog[i].pgm->length; k--) // longest first
+                order[k] = order[k - 1];
+            order[k] = i;
+        }
+        uint32_t plan = fixed;
+        for (int k = 0; k < count; k++)
+        {
+            uint length = prog[order[k]].pgm->length;
+            if ((place[k] = _place(plan, length)) < 0)
+                return _largest(used);
+            plan |= ((1u << length) - 1) << place[k];
+        }
+        // Stop the state machines of the moved programs, all at once to keep them in step
+        _SM *s = _state().sm[pio_get_index(pio)];
+        uint32_t stop = 0;
+        for (int k = 0; k < count; k++)
+            for (int i = 0; i < NUM_PIO_STATE_MACHINES; i++)
+                if (s[i].pgm == prog[order[k]].pgm && pio_sm_is_claimed(pio, i) && place[k] != prog[order[k]].offset)
+                    stop |= 1u << i;
+        uint32_t running = pio->ctrl & stop;
+        pio_set_sm_mask_enabled(pio, stop, false);
+        for (int k = 0; k < count; k++)
+            if (place[k] != prog[order[k]].offset)
+                pio_remove_program(pio, prog[order[k]].pgm, prog[order[k]].offset);
+        for (int k = 0; k < count; k++)
         {
-            *pio = pio1;
-            *sm = idx;
-            return true;
+            _Program &p = prog[order[k]];
+            if (place[k] == p.offset)
+                continue;
+            pio_add_program_at_offset(pio, p.pgm, place[k]);
+            for (int i = 0; i < NUM_PIO_STATE_MACHINES; i++)
+            {
+                if (!(stop & (1u << i)) || s[i].pgm != p.pgm)
+                    continue;
+                _rebase(pio, i, p.offset, place[k], p.pgm->length);
+                if (s[i].moved)
+                    s[i].moved(s[i].ctx, pio, i, place[k]);
+            }
+            p.offset = place[k];
         }
-        return false;
+        pio_set_sm_mask_enabled(pio, running, true);
+        return _largest(plan);
+    }
+};
+
+// Wrapper class for PIO programs, abstracting common operations out
+class PIOProgram
+{
+public:
+    PIOProgram(const pio_program_t *pgm) { _pgm = pgm; }
+
+    // Releases the state machines taken by prepare(), the last one unloads the program
+    ~PIOProgram()
+    {
+        for (uint i = 0; i < NUM_PIOS * NUM_PIO_STATE_MACHINES; i++)
+            if (_claimed & (1u << i))
+                release(i < NUM_PIO_STATE_MACHINES ? pio0 : pio1, i % NUM_PIO_STATE_MACHINES);
+    }
+
+    // Possibly load into a PIO and allocate a SM
+    bool prepare(PIO *pio, int *sm, int *offset, const char *owner = "PIOProgram")
+    {
+        *pio = nullptr; // any PIO, the one which has it loaded first
+        if (!PIORegistry::claim(_pgm, pio, sm, offset, owner))
+            return false;
+        _claimed |= 1u << (pio_get_index(*pio) * NUM_PIO_STATE_MACHINES + *sm);
+        return true;
+    }
+
+    // Stop and free the SM, unload the program with the last one
+    void release(PIO pio, int sm)
+    {
+        uint32_t bit = 1u << (pio_get_index(pio) * NUM_PIO_STATE_MACHINES + sm);
+        if (!(_claimed & bit))
+            return;
+        _claimed &= ~bit;
+        PIORegistry::release(pio, sm, _pgm);
     }
 
 private:
-    int _offset[2] = {-1, -1};
+    uint32_t _claimed = 0; // bit pio * 4 + sm
     const pio_program_t *_pgm;
 };
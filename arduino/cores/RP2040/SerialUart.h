@@ -23,31 +23,168 @@
 
 #include "HardwareSerial.h"
 #include <RingBuffer.h>
+#include <malloc.h>
 #include "hardware/uart.h"
 #include "hardware/irq.h"
+#include "hardware/dma.h"
+#include "pico/time.h"
 #include "arduino_debug.h"
 
+/*
+    RX  DMA writes the UART data register to a circular buffer, the reader takes the bytes
+        from the DMA write position, no interrupt per byte. The DMA keeps the FIFO empty, so the
+        receive timeout interrupt never fires: a repeating alarm reports an idle line ( end of frame )
+        to onReceive() when the DMA position stopped after data. A quiet line is polled every
+        UART_RX_IDLE_POLL_US, after new bytes every UART_RX_IDLE_BITS bit times until the idle is reported.
+        The end of a frame is seen one to two UART_RX_IDLE_BITS periods after the last byte,
+        a frame shorter than UART_RX_IDLE_POLL_US up to one poll period later
+        Without a free DMA channel the FIFO is drained by the RX / RX timeout interrupt
+
+    TX  write() copies to the TX ring and returns, DMA sends the ring, the DMA interrupt
+        starts the next piece and calls onTransmit() when the ring is empty
+*/
+
+#ifndef UART_RX_DMA_SIZE
+#define UART_RX_DMA_SIZE 1024 /* power of 2, 0: FIFO and interrupt */
+#endif
+
+#ifndef UART_RX_IDLE_BITS
+#define UART_RX_IDLE_BITS 32 /* RX DMA: idle check period in bit times after data, as the PL011 receive timeout */
+#endif
+
+#ifndef UART_RX_IDLE_POLL_US
+#define UART_RX_IDLE_POLL_US 1000 /* RX DMA: idle check period while no data comes */
+#endif
+
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 256 /* power of 2, 0: blocking write */
+#endif
+
+#ifndef UART_DMA_IRQ
+#define UART_DMA_IRQ DMA_IRQ_1
+#endif
+
+#if UART_RX_DMA_SIZE & (UART_RX_DMA_SIZE - 1)
+#error "UART_RX_DMA_SIZE must be a power of 2"
+#endif
+
+#define UART_RX_IRQ_ERRORS (UART_UARTIMSC_OEIM_BITS | UART_UARTIMSC_BEIM_BITS | UART_UARTIMSC_PEIM_BITS | UART_UARTIMSC_FEIM_BITS)
+
+typedef struct
+{
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t rx_overruns;   /* bytes lost, reader too slow */
+    uint32_t fifo_overruns; /* UART FIFO full */
+    uint32_t rx_errors;     /* framing, parity, break */
+    uint32_t rx_idle;       /* idle line after data, receive timeouts */
+} uart_stats_t;
+
 typedef struct tag_UART_CONTEXT
 {
     void *cUart;
     void (*rx_handler)(void);
+    void (*tx_handler)(void);
 } UART_CONTEXT, *pUART_CONTEXT;
 
 extern UART_CONTEXT UARTINFO[2]; // variant.cpp
 
 static void u0_rx_handler(void);
 static void u1_rx_handler(void);
+static void u0_tx_handler(void);
+static void u1_tx_handler(void);
 
 class Uart : public HardwareSerial
 {
 private:
     uart_inst_t *u;
     pUART_CONTEXT ctx;
-    RingBuffer rx_ring; // SERIAL_BUFFER_SIZE = 256
+    RingBuffer rx_ring; // SERIAL_BUFFER_SIZE = 256, without RX DMA
     uint32_t _brg;
     int UART_IRQ;
     int TX_PIN, RX_PIN;
 
+    int rx_dma;
+    uint8_t *rx_buf;
+    volatile uint32_t rx_base; // bytes before the current DMA run
+    uint32_t rx_tail;
+    uint32_t rx_mark; // rx_bytes at resetStats()
+    uint32_t rx_seen; // DMA position at the last idle check
+    bool rx_moved;    // data since the last idle
+    bool rx_timer_on;
+    int64_t rx_idle_us; // UART_RX_IDLE_BITS at the baudrate
+    repeating_timer_t rx_timer;
+
+#if UART_TX_BUFFER_SIZE
+    RingBufferN<UART_TX_BUFFER_SIZE> tx_ring;
+#endif
+    int tx_dma;
+    volatile uint32_t tx_len; // bytes in flight
+    bool tx_wait;
+
+    uart_stats_t _stats;
+    void (*_onReceive)(void);
+    void (*_onTransmit)(void);
+
+    inline uint32_t rx_head() { return rx_base + ~dma_channel_hw_addr(rx_dma)->transfer_count; }
+
+    /* the DMA passed the reader: the oldest bytes are gone */
+    uint32_t rx_pending()
+    {
+        uint32_t n = rx_head() - rx_tail;
+        if (n > UART_RX_DMA_SIZE)
+        {
+            _stats.rx_overruns += n - UART_RX_DMA_SIZE;
+            rx_tail += n - UART_RX_DMA_SIZE;
+            n = UART_RX_DMA_SIZE;
+        }
+        return n;
+    }
+
+#if UART_RX_DMA_SIZE
+    void rx_dma_start()
+    {
+        dma_channel_config c = dma_channel_get_default_config(rx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, __builtin_ctz(UART_RX_DMA_SIZE));
+        channel_config_set_dreq(&c, uart_get_dreq(u, false));
+        rx_base = rx_tail = rx_mark = rx_seen = 0;
+        rx_moved = false;
+        dma_channel_configure(rx_dma, &c, rx_buf, &uart_get_hw(u)->dr, 0xFFFFFFFF, true);
+    }
+
+    static bool rx_idle_alarm(repeating_timer_t *rt)
+    {
+        Uart *uart = (Uart *)rt->user_data;
+        rt->delay_us = uart->isr_idle() ? -uart->rx_idle_us : uart->rx_idle_poll();
+        return true;
+    }
+
+    /* quiet line, not faster than UART_RX_IDLE_BITS */
+    int64_t rx_idle_poll() { return -(rx_idle_us > UART_RX_IDLE_POLL_US ? rx_idle_us : UART_RX_IDLE_POLL_US); }
+
+    /* at begin() and on baudrate change */
+    void rx_idle_start()
+    {
+        if (rx_timer_on)
+            cancel_repeating_timer(&rx_timer);
+        rx_idle_us = ((uint64_t)UART_RX_IDLE_BITS * 1000000 + _brg - 1) / _brg;
+        rx_timer_on = add_repeating_timer_us(rx_idle_poll(), rx_idle_alarm, this, &rx_timer);
+    }
+#endif
+
+#if UART_TX_BUFFER_SIZE
+    /* with the interrupts off or from the DMA interrupt */
+    void tx_kick()
+    {
+        const uint8_t *p;
+        if ((tx_len = tx_ring.peek_contiguous(&p)))
+            dma_channel_transfer_from_buffer_now(tx_dma, p, tx_len);
+    }
+#endif
+
 public:
     Uart(uart_inst_t *uart)
     {
@@ -56,11 +193,20 @@ public:
         TX_PIN = 0;
         RX_PIN = 1;
         UART_IRQ = UART0_IRQ;
+        rx_dma = tx_dma = -1;
+        rx_buf = NULL;
+        rx_mark = 0;
+        rx_timer_on = false;
+        tx_len = 0;
+        tx_wait = true;
+        _onReceive = _onTransmit = NULL;
+        memset(&_stats, 0, sizeof(_stats));
         if (u == uart0)
         {
             ctx = &UARTINFO[0];
             memset(ctx, 0, sizeof(UART_CONTEXT));
             ctx->rx_handler = u0_rx_handler;
+            ctx->tx_handler = u0_tx_handler;
         }
         else
         {
@@ -68,6 +214,7 @@ public:
             ctx = &UARTINFO[1];
             memset(ctx, 0, sizeof(UART_CONTEXT));
             ctx->rx_handler = u1_rx_handler;
+            ctx->tx_handler = u1_tx_handler;
             TX_PIN = 4;
             RX_PIN = 5;
         }
@@ -89,14 +236,47 @@ public:
     {
         end();
         pins(TX_PIN, RX_PIN);
-        uart_init(u, baud);
+        uart_init(u, baud); // FIFO and DREQ enabled
         _brg = uart_set_baudrate(u, baud);
         uart_set_hw_flow(u, false, false);
         uart_set_format(u, data_bits, stop_bits, (uart_parity_t)parity);
-        uart_set_fifo_enabled(u, false);
+        memset(&_stats, 0, sizeof(_stats));
+
+#if UART_RX_DMA_SIZE
+        if ((rx_dma = dma_claim_unused_channel(false)) > -1)
+        {
+            if ((rx_buf = (uint8_t *)memalign(UART_RX_DMA_SIZE, UART_RX_DMA_SIZE)))
+            {
+                rx_dma_start();
+                rx_idle_start();
+            }
+            else
+            {
+                dma_channel_unclaim(rx_dma);
+                rx_dma = -1;
+            }
+        }
+#endif
+#if UART_TX_BUFFER_SIZE
+        if ((tx_dma = dma_claim_unused_channel(false)) > -1)
+        {
+            dma_channel_config c = dma_channel_get_default_config(tx_dma);
+            channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+            channel_config_set_read_increment(&c, true);
+            channel_config_set_write_increment(&c, false);
+            channel_config_set_dreq(&c, uart_get_dreq(u, true));
+            dma_channel_configure(tx_dma, &c, &uart_get_hw(u)->dr, NULL, 0, false);
+            irq_add_shared_handler(UART_DMA_IRQ, ctx->tx_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+            dma_irqn_set_channel_enabled(UART_DMA_IRQ - DMA_IRQ_0, tx_dma, true);
+            irq_set_enabled(UART_DMA_IRQ, true);
+        }
+#endif
+
+        // RX: half FIFO, RX timeout is the idle line. With RX DMA only the errors, the alarm finds the idle line
+        hw_write_masked(&uart_get_hw(u)->ifls, 2 << UART_UARTIFLS_RXIFLSEL_LSB, UART_UARTIFLS_RXIFLSEL_BITS);
         irq_set_exclusive_handler(UART_IRQ, ctx->rx_handler);
         irq_set_enabled(UART_IRQ, true);
-        uart_set_irq_enables(u, true, false);
+        uart_get_hw(u)->imsc = (rx_dma < 0 ? UART_UARTIMSC_RXIM_BITS | UART_UARTIMSC_RTIM_BITS : 0) | UART_RX_IRQ_ERRORS;
         if (retarget)
         {
             stdio_drv.write_r = u_write_r;
@@ -119,68 +299,232 @@ public:
     void end(void)
     {
         irq_set_enabled(UART_IRQ, false);
+#if UART_RX_DMA_SIZE
+        if (rx_timer_on)
+            cancel_repeating_timer(&rx_timer);
+        rx_timer_on = false;
+#endif
+        if (tx_dma > -1)
+        {
+            dma_irqn_set_channel_enabled(UART_DMA_IRQ - DMA_IRQ_0, tx_dma, false);
+            dma_channel_abort(tx_dma);
+            dma_irqn_acknowledge_channel(UART_DMA_IRQ - DMA_IRQ_0, tx_dma);
+            irq_remove_handler(UART_DMA_IRQ, ctx->tx_handler);
+            dma_channel_unclaim(tx_dma);
+            tx_dma = -1;
+        }
+        if (rx_dma > -1)
+        {
+            dma_channel_abort(rx_dma);
+            dma_channel_unclaim(rx_dma);
+            rx_dma = -1;
+        }
         uart_deinit(u);
+        free(rx_buf);
+        rx_buf = NULL;
         rx_ring.clear();
+#if UART_TX_BUFFER_SIZE
+        tx_ring.clear();
+#endif
+        tx_len = 0;
     }
 
-    inline size_t write(uint8_t c)
-    {
-        uart_write_blocking(u, (const uint8_t *)&c, 1);
-        return 1;
-    }
+    inline size_t write(uint8_t c) { return write(&c, 1); }
+
+    /* returns when the data is in the TX ring, waits only for ring space ( see setWriteWait ) */
     size_t write(const uint8_t *buf, size_t size)
     {
-        size_t c = size;
-        while (c--)
-            uart_putc_raw(u, *buf++);
+#if UART_TX_BUFFER_SIZE
+        if (tx_dma > -1)
+        {
+            size_t done = 0;
+            for (;;)
+            {
+                done += tx_ring.write(buf + done, size - done);
+                ENTER_CRITICAL();
+                if (0 == tx_len)
+                    tx_kick();
+                EXIT_CRITICAL();
+                if (done == size || !tx_wait || __get_current_exception())
+                    return done;
+                tight_loop_contents();
+            }
+        }
+#endif
+        uart_write_blocking(u, buf, size);
+        _stats.tx_bytes += size;
         return size;
     }
 
+    int availableForWrite()
+    {
+#if UART_TX_BUFFER_SIZE
+        if (tx_dma > -1)
+            return tx_ring.availableForStore();
+#endif
+        return uart_is_writable(u) ? 1 : 0;
+    }
+
+    /* false: write() returns the count that fits in the TX ring */
+    void setWriteWait(bool wait) { tx_wait = wait; }
+
     int read()
     {
-        if (!rx_ring.available())
+        if (rx_dma < 0)
+            return rx_ring.read_char();
+        if (0 == rx_pending())
             return -1;
-        ENTER_CRITICAL();
-        uint8_t byte = rx_ring.read_char();
-        EXIT_CRITICAL();
-        return byte;
+        return rx_buf[rx_tail++ & (UART_RX_DMA_SIZE - 1)];
     }
     int read(uint8_t *buf, size_t size)
     {
-        int cnt = 0;
-        while (available() > 0 && size)
+        int cnt;
+        if (rx_dma < 0)
         {
-            *buf++ = read();
-            size--;
-            cnt++;
+            cnt = rx_ring.read(buf, size);
+        }
+        else
+        {
+            uint32_t n = rx_pending();
+            if (n > size)
+                n = size;
+            for (cnt = 0; cnt < (int)n;) // two pieces at the buffer end
+            {
+                uint32_t at = rx_tail & (UART_RX_DMA_SIZE - 1);
+                uint32_t len = UART_RX_DMA_SIZE - at;
+                if (len > n - cnt)
+                    len = n - cnt;
+                memcpy(buf + cnt, rx_buf + at, len);
+                rx_tail += len;
+                cnt += len;
+            }
         }
         return cnt ? cnt : -1;
     }
     int read(char *buf, size_t size) { return read((uint8_t *)buf, size); }
 
-    int available(void) { return rx_ring.available(); }
-    int peek(void) { return rx_ring.peek(); }
-    void flush(void) { uart_tx_wait_blocking(u); }
-    int setSpeed(int brg) { return _brg = uart_set_baudrate(u, brg); }
+    int available(void) { return rx_dma < 0 ? rx_ring.available() : rx_pending(); }
+    int peek(void)
+    {
+        if (rx_dma < 0)
+            return rx_ring.peek();
+        return rx_pending() ? rx_buf[rx_tail & (UART_RX_DMA_SIZE - 1)] : -1;
+    }
+    void flush(void)
+    {
+        while (tx_len)
+            tight_loop_contents();
+        uart_tx_wait_blocking(u);
+    }
+    int setSpeed(int brg)
+    {
+        _brg = uart_set_baudrate(u, brg);
+#if UART_RX_DMA_SIZE
+        if (rx_timer_on)
+            rx_idle_start();
+#endif
+        return _brg;
+    }
     int getSpeed() { return _brg; }
     operator bool() { return true; }
     using Print::write;
 
-    // PRIVATE HANDLER
+    /* from the interrupt: the line is idle after data ( RX timeout, or the idle alarm with RX DMA ) */
+    void onReceive(void (*cb)(void)) { _onReceive = cb; }
+
+    /* from the interrupt: the TX ring is sent */
+    void onTransmit(void (*cb)(void)) { _onTransmit = cb; }
+
+    void getStats(uart_stats_t *st)
+    {
+        *st = _stats;
+        if (rx_dma > -1)
+            st->rx_bytes = rx_head() - rx_mark;
+    }
+
+    void resetStats()
+    {
+        memset(&_stats, 0, sizeof(_stats));
+        if (rx_dma > -1)
+            rx_mark = rx_head();
+    }
+
+    // PRIVATE HANDLER, the only producer of rx_ring
     void isr_save()
     {
-        while (uart_is_readable(u))
+        uart_hw_t *hw = uart_get_hw(u);
+        uint32_t mis = hw->mis;
+        hw->icr = mis & (UART_UARTICR_RXIC_BITS | UART_UARTICR_RTIC_BITS | UART_RX_IRQ_ERRORS);
+        if (mis & UART_UARTMIS_OEMIS_BITS)
+            _stats.fifo_overruns++;
+        if (mis & (UART_UARTMIS_BEMIS_BITS | UART_UARTMIS_PEMIS_BITS | UART_UARTMIS_FEMIS_BITS))
+            _stats.rx_errors++;
+        if (rx_dma < 0)
         {
-            if (rx_ring.availableForStore())
+            uint8_t *p;
+            size_t len, n;
+            while (uart_is_readable(u))
             {
-                char c = uart_getc(u);
-                ENTER_CRITICAL();
-                rx_ring.store_char(c);
-                EXIT_CRITICAL();
+                if (0 == (len = rx_ring.reserve_contiguous(&p)))
+                {
+                    (void)hw->dr; // ring full, drop
+                    _stats.rx_overruns++;
+                    continue;
+                }
+                for (n = 0; n < len && uart_is_readable(u); n++)
+                    p[n] = hw->dr;
+                rx_ring.publish(n);
+                _stats.rx_bytes += n;
             }
-            else
-                break;
         }
+        if (mis & UART_UARTMIS_RTMIS_BITS)
+        {
+            _stats.rx_idle++;
+            if (_onReceive)
+                _onReceive();
+        }
+    }
+
+#if UART_RX_DMA_SIZE
+    // PRIVATE HANDLER, RX DMA idle alarm: the line is idle when the DMA position did not move for a period
+    // returns true while an idle is pending ( data since the last idle )
+    bool isr_idle()
+    {
+        if (!dma_channel_is_busy(rx_dma))
+        {
+            rx_base += 0xFFFFFFFF; // 4G bytes done, the ring position continues
+            dma_channel_set_trans_count(rx_dma, 0xFFFFFFFF, true);
+        }
+        uint32_t head = rx_head();
+        if (head != rx_seen)
+        {
+            rx_seen = head;
+            rx_moved = true;
+        }
+        else if (rx_moved)
+        {
+            rx_moved = false;
+            _stats.rx_idle++;
+            if (_onReceive)
+                _onReceive();
+        }
+        return rx_moved;
+    }
+#endif
+
+    // PRIVATE HANDLER, the DMA interrupt is shared
+    void isr_sent()
+    {
+#if UART_TX_BUFFER_SIZE
+        if (tx_dma < 0 || !dma_irqn_get_channel_status(UART_DMA_IRQ - DMA_IRQ_0, tx_dma))
+            return;
+        dma_irqn_acknowledge_channel(UART_DMA_IRQ - DMA_IRQ_0, tx_dma);
+        tx_ring.commit(tx_len);
+        _stats.tx_bytes += tx_len;
+        tx_kick();
+        if (0 == tx_len && _onTransmit)
+            _onTransmit();
+#endif
     }
 
     // STDIO
@@ -202,6 +546,8 @@ public:
 static void u_rx_handler(Uart *ctx) { ctx->isr_save(); }
 static void u0_rx_handler(void) { u_rx_handler((Uart *)UARTINFO[0].cUart); }
 static void u1_rx_handler(void) { u_rx_handler((Uart *)UARTINFO[1].cUart); }
+static void u0_tx_handler(void) { ((Uart *)UARTINFO[0].cUart)->isr_sent(); }
+static void u1_tx_handler(void) { ((Uart *)UARTINFO[1].cUart)->isr_sent(); }
 
 extern Uart Serial;
 extern Uart Serial1;
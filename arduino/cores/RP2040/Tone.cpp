@@ -65,13 +65,14 @@ void tone(uint8_t pin, unsigned int frequency, unsigned long duration)
     newTone->pin = pin;
     pinMode(pin, OUTPUT);
     int off;
-    if (!toneProgram.prepare(&newTone->pio, &newTone->sm, &off))
+    if (!toneProgram.prepare(&newTone->pio, &newTone->sm, &off, "tone"))
     {
         TONE_DBG("TONE: Unable to start, out of PIO resources\n");
         delete newTone; // ERROR, no free slots
         return;
     }
     tone_program_init(newTone->pio, newTone->sm, off, pin);
+    PIORegistry::movable(newTone->pio, newTone->sm); // the offset is not kept
     pio_sm_set_enabled(newTone->pio, newTone->sm, false);
     pio_sm_put_blocking(newTone->pio, newTone->sm, us * (clock_get_hz(clk_sys) / 1000000));
     pio_sm_exec(newTone->pio, newTone->sm, pio_encode_pull(false, false));
@@ -89,8 +90,8 @@ void noTone(uint8_t pin)
     if (entry != toneMap.end())
     {
         TONE_DBG("NOTONE: Disabling PIO tone generator pio=%p, sm=%d\n", entry->second->pio, entry->second->sm);
-        pio_sm_set_enabled(entry->second->pio, entry->second->sm, false);
-        pio_sm_unclaim(entry->second->pio, entry->second->sm);
+        toneProgram.release(entry->second->pio, entry->second->sm);
+        delete entry->second;
         toneMap.erase(entry);
         pinMode(pin, OUTPUT);
         digitalWrite(pin, LOW);
@@ -75,15 +75,30 @@ extern uint8_t ucHeap[configTOTAL_HEAP_SIZE];
 /* 
 	follow the pico-sdk 
 	HEAP SIZE = MAX
+
+	heap_5 style: the free list runs over the striped SRAM0..3 and over the
+	free part of the scratch banks SRAM4 ( core 1 stack ) and SRAM5 ( core 0
+	stack ), in address order.  Every region ends with a zero size marker.
 */
 
 extern int __end__;
-extern int __HeapLimit;
-extern int __StackOneTop;
+extern int __StackLimit;	   /* end of striped RAM */
+extern int __scratch_x_end__;
+extern int __StackOneBottom; /* core 1 stack */
+extern int __scratch_y_end__;
+extern int __StackBottom;	   /* core 0 stack */
+
+#define heapREGIONS (3)
+
+typedef struct HEAP_REGION
+{
+	size_t xStart; /*<< First block, 0 when the region is not used. */
+	size_t xEnd;   /*<< End marker. */
+} HeapRegion_t;
+
+static HeapRegion_t xHeapRegions[heapREGIONS];
 
-const uint8_t *ucHeap = (uint8_t *)&__end__;
-const uint8_t *ucHeapEnd = (uint8_t *)&__StackOneTop - 16; 
-const uint32_t ucHeapSize(void) { return (uint32_t)ucHeapEnd - (uint32_t)ucHeap; }
+static const char *const pcHeapRegionName[heapREGIONS] = {"SRAM0-3", "SRAM4", "SRAM5"};
 
 #endif /* configAPPLICATION_ALLOCATED_HEAP */
 
@@ -135,7 +150,10 @@ static size_t xBlockAllocatedBit = 0;
 
 /*-----------------------------------------------------------*/
 
-void *pvPortMalloc(size_t xWantedSize)
+/*
+ * First fit, limited to the free blocks between uxLow and uxHigh.
+ */
+static void *prvMallocFrom(size_t xWantedSize, size_t uxLow, size_t uxHigh)
 {
 	BlockLink_t *pxBlock, *pxPreviousBlock, *pxNewBlockLink;
 	void *pvReturn = NULL;
@@ -189,7 +207,7 @@ void *pvPortMalloc(size_t xWantedSize)
 				one	of adequate size is found. */
 				pxPreviousBlock = &xStart;
 				pxBlock = xStart.pxNextFreeBlock;
-				while ((pxBlock->xBlockSize < xWantedSize) && (pxBlock->pxNextFreeBlock != NULL))
+				while (((pxBlock->xBlockSize < xWantedSize) || ((size_t)pxBlock < uxLow) || ((size_t)pxBlock >= uxHigh)) && (pxBlock->pxNextFreeBlock != NULL))
 				{
 					pxPreviousBlock = pxBlock;
 					pxBlock = pxBlock->pxNextFreeBlock;
@@ -337,6 +355,253 @@ void vPortFree(void *pv)
 }
 /*-----------------------------------------------------------*/
 
+void *pvPortMalloc(size_t xWantedSize)
+{
+	return prvMallocFrom(xWantedSize, 0, ~(size_t)0);
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Placement hints: the block goes to the preferred bank if it fits there,
+ * else anywhere.  SRAM4 holds the core 1 stack and SRAM5 the core 0 stack,
+ * so "core local" is the bank of the calling core and "DMA" the bank of the
+ * other one, away from the striped RAM and from the stack of the caller.
+ */
+void *pvPortMallocHint(size_t xWantedSize, int xHint)
+{
+	int xRegion = -1;
+	void *pvReturn = NULL;
+
+	if (pxEnd == NULL)
+	{
+		vTaskSuspendAll();
+		if (pxEnd == NULL)
+		{
+			prvHeapInit();
+		}
+		xTaskResumeAll();
+	}
+
+	switch (xHint)
+	{
+	case MALLOC_HINT_STRIPED:
+		xRegion = 0;
+		break;
+	case MALLOC_HINT_CORE_LOCAL:
+		xRegion = get_core_num() ? 1 : 2;
+		break;
+	case MALLOC_HINT_DMA:
+		xRegion = get_core_num() ? 2 : 1;
+		break;
+	}
+
+	if ((xRegion >= 0) && (xHeapRegions[xRegion].xStart != 0))
+	{
+		pvReturn = prvMallocFrom(xWantedSize, xHeapRegions[xRegion].xStart, xHeapRegions[xRegion].xEnd);
+	}
+
+	if (pvReturn == NULL)
+	{
+		pvReturn = pvPortMalloc(xWantedSize);
+	}
+
+	return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Usage report of one region, -1 when xRegion is past the last one.
+ */
+int xPortGetHeapRegionStats(int xRegion, heap_region_stats_t *pxStats)
+{
+	BlockLink_t *pxBlock;
+
+	if ((xRegion < 0) || (xRegion >= heapREGIONS) || (pxStats == NULL))
+	{
+		return -1;
+	}
+
+	memset(pxStats, 0, sizeof(heap_region_stats_t));
+	pxStats->name = pcHeapRegionName[xRegion];
+
+	vTaskSuspendAll();
+	{
+		if (pxEnd == NULL)
+		{
+			prvHeapInit();
+		}
+
+		if (xHeapRegions[xRegion].xStart != 0)
+		{
+			pxStats->start = xHeapRegions[xRegion].xStart;
+			pxStats->size = xHeapRegions[xRegion].xEnd - xHeapRegions[xRegion].xStart;
+
+			for (pxBlock = xStart.pxNextFreeBlock; pxBlock != NULL; pxBlock = pxBlock->pxNextFreeBlock)
+			{
+				if (((size_t)pxBlock >= xHeapRegions[xRegion].xStart) && ((size_t)pxBlock < xHeapRegions[xRegion].xEnd) && (pxBlock->xBlockSize != 0))
+				{
+					pxStats->free += pxBlock->xBlockSize;
+					pxStats->free_blocks++;
+					if (pxBlock->xBlockSize > pxStats->largest)
+					{
+						pxStats->largest = pxBlock->xBlockSize;
+					}
+				}
+			}
+		}
+	}
+	//( void )
+	xTaskResumeAll();
+
+	return 0;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Resizes an allocated block without moving it.  A smaller block gives its
+ * tail back to the free list, a larger block takes the free block that
+ * directly follows it.  Returns pv on success or NULL if the block has to
+ * move, in which case it is left untouched.
+ */
+void *pvPortResize(void *pv, size_t xWantedSize)
+{
+	BlockLink_t *pxLink, *pxIterator, *pxNext, *pxNewBlockLink;
+	size_t xBlockSize;
+	void *pvReturn = NULL;
+
+	if ((pv == NULL) || (xWantedSize == 0) || ((xWantedSize & xBlockAllocatedBit) != 0))
+	{
+		return NULL;
+	}
+
+	/* Same rounding as pvPortMalloc(). */
+	xWantedSize += xHeapStructSize;
+	if ((xWantedSize & portBYTE_ALIGNMENT_MASK) != 0x00)
+	{
+		xWantedSize += (portBYTE_ALIGNMENT - (xWantedSize & portBYTE_ALIGNMENT_MASK));
+	}
+
+	pxLink = (void *)(((uint8_t *)pv) - xHeapStructSize);
+	configASSERT((pxLink->xBlockSize & xBlockAllocatedBit) != 0);
+
+	vTaskSuspendAll();
+	{
+		xBlockSize = pxLink->xBlockSize & ~xBlockAllocatedBit;
+
+		if (xWantedSize > xBlockSize)
+		{
+			/* Look for a free block starting right at the end of this one. */
+			pxNext = (void *)(((uint8_t *)pxLink) + xBlockSize);
+			for (pxIterator = &xStart; pxIterator->pxNextFreeBlock < pxNext; pxIterator = pxIterator->pxNextFreeBlock)
+			{
+				/* Nothing to do here, just iterate to the right position. */
+			}
+
+			if ((pxIterator->pxNextFreeBlock == pxNext) && (pxNext != pxEnd) && ((xBlockSize + pxNext->xBlockSize) >= xWantedSize))
+			{
+				/* Take the whole neighbour, the surplus is split off below. */
+				pxIterator->pxNextFreeBlock = pxNext->pxNextFreeBlock;
+				xFreeBytesRemaining -= pxNext->xBlockSize;
+				xBlockSize += pxNext->xBlockSize;
+				pvReturn = pv;
+			}
+		}
+		else
+		{
+			pvReturn = pv;
+		}
+
+		if (pvReturn != NULL)
+		{
+			if ((xBlockSize - xWantedSize) > heapMINIMUM_BLOCK_SIZE)
+			{
+				pxNewBlockLink = (void *)(((uint8_t *)pxLink) + xWantedSize);
+				pxNewBlockLink->xBlockSize = xBlockSize - xWantedSize;
+				xBlockSize = xWantedSize;
+				xFreeBytesRemaining += pxNewBlockLink->xBlockSize;
+				prvInsertBlockIntoFreeList(pxNewBlockLink);
+			}
+
+			pxLink->xBlockSize = xBlockSize | xBlockAllocatedBit;
+
+			if (xFreeBytesRemaining < xMinimumEverFreeBytesRemaining)
+			{
+				xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+			}
+		}
+	}
+	//( void )
+	xTaskResumeAll();
+
+	return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Allocates a block whose address is a multiple of xAlignment (a power of
+ * two).  The block is taken with enough slack, the unused head is given back
+ * as a free block of its own and the unused tail by pvPortResize().
+ */
+void *pvPortMallocAligned(size_t xAlignment, size_t xWantedSize)
+{
+	BlockLink_t *pxLink, *pxNewBlockLink;
+	size_t xOffset;
+	uint8_t *puc;
+
+	if (xAlignment <= portBYTE_ALIGNMENT)
+	{
+		return pvPortMalloc(xWantedSize);
+	}
+
+	if ((xAlignment & (xAlignment - 1)) != 0)
+	{
+		return NULL;
+	}
+
+	puc = pvPortMalloc(xWantedSize + xAlignment + heapMINIMUM_BLOCK_SIZE);
+	if (puc == NULL)
+	{
+		return NULL;
+	}
+
+	xOffset = (xAlignment - ((size_t)puc & (xAlignment - 1))) & (xAlignment - 1);
+	if (xOffset != 0)
+	{
+		/* The head has to be big enough to live as a free block. */
+		while (xOffset < heapMINIMUM_BLOCK_SIZE)
+		{
+			xOffset += xAlignment;
+		}
+
+		vTaskSuspendAll();
+		{
+			pxLink = (void *)(puc - xHeapStructSize);
+			pxNewBlockLink = (void *)(puc + xOffset - xHeapStructSize);
+			pxNewBlockLink->xBlockSize = ((pxLink->xBlockSize & ~xBlockAllocatedBit) - xOffset) | xBlockAllocatedBit;
+			pxNewBlockLink->pxNextFreeBlock = NULL;
+			pxLink->xBlockSize = xOffset;
+			xFreeBytesRemaining += xOffset;
+			prvInsertBlockIntoFreeList(pxLink);
+		}
+		//( void )
+		xTaskResumeAll();
+
+		puc += xOffset;
+	}
+
+	pvPortResize(puc, xWantedSize);
+	return puc;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetBlockSize(void *pv)
+{
+	BlockLink_t *pxLink = (void *)(((uint8_t *)pv) - xHeapStructSize);
+
+	return (pxLink->xBlockSize & ~xBlockAllocatedBit) - xHeapStructSize;
+}
+/*-----------------------------------------------------------*/
+
 size_t xPortGetFreeHeapSize(void)
 {
 	return xFreeBytesRemaining;
@@ -357,46 +622,48 @@ void vPortInitialiseBlocks(void)
 
 static void prvHeapInit(void)
 {
-	BlockLink_t *pxFirstFreeBlock;
-	uint8_t *pucAlignedHeap;
-	size_t uxAddress;
-	size_t xTotalHeapSize = ucHeapSize(); // configTOTAL_HEAP_SIZE;
+	const size_t uxBounds[heapREGIONS][2] = {
+		{(size_t)&__end__, (size_t)&__StackLimit},
+		{(size_t)&__scratch_x_end__, (size_t)&__StackOneBottom},
+		{(size_t)&__scratch_y_end__, (size_t)&__StackBottom},
+	};
+	BlockLink_t *pxFirstFreeBlock, *pxPreviousEnd = &xStart;
+	size_t uxAddress, uxEnd;
+
+	for (int i = 0; i < heapREGIONS; i++)
+	{
+		/* Ensure the region starts on a correctly aligned boundary. */
+		uxAddress = (uxBounds[i][0] + (portBYTE_ALIGNMENT - 1)) & ~((size_t)portBYTE_ALIGNMENT_MASK);
 
-	/* Ensure the heap starts on a correctly aligned boundary. */
-	uxAddress = (size_t)ucHeap;
+		/* The end marker is inserted at the end of the region space. */
+		uxEnd = (uxBounds[i][1] - xHeapStructSize) & ~((size_t)portBYTE_ALIGNMENT_MASK);
 
-	if ((uxAddress & portBYTE_ALIGNMENT_MASK) != 0)
-	{
-		uxAddress += (portBYTE_ALIGNMENT - 1);
-		uxAddress &= ~((size_t)portBYTE_ALIGNMENT_MASK);
-		xTotalHeapSize -= uxAddress - (size_t)ucHeap;
-	}
+		if ((uxBounds[i][1] < uxBounds[i][0] + xHeapStructSize) || (uxEnd < uxAddress + heapMINIMUM_BLOCK_SIZE))
+		{
+			continue; /* nothing left in the bank */
+		}
 
-	pucAlignedHeap = (uint8_t *)uxAddress;
+		/* To start with there is a single free block that is sized to take up
+		the entire region space, minus the space taken by the marker. */
+		pxFirstFreeBlock = (void *)uxAddress;
+		pxFirstFreeBlock->xBlockSize = uxEnd - uxAddress;
+		pxFirstFreeBlock->pxNextFreeBlock = (void *)uxEnd;
+		pxPreviousEnd->pxNextFreeBlock = pxFirstFreeBlock;
+
+		pxEnd = (void *)uxEnd;
+		pxEnd->xBlockSize = 0;
+		pxEnd->pxNextFreeBlock = NULL;
+		pxPreviousEnd = pxEnd;
+
+		xHeapRegions[i].xStart = uxAddress;
+		xHeapRegions[i].xEnd = uxEnd;
+		xFreeBytesRemaining += pxFirstFreeBlock->xBlockSize;
+	}
 
 	/* xStart is used to hold a pointer to the first item in the list of free
-	blocks.  The void cast is used to prevent compiler warnings. */
-	xStart.pxNextFreeBlock = (void *)pucAlignedHeap;
+	blocks. */
 	xStart.xBlockSize = (size_t)0;
-
-	/* pxEnd is used to mark the end of the list of free blocks and is inserted
-	at the end of the heap space. */
-	uxAddress = ((size_t)pucAlignedHeap) + xTotalHeapSize;
-	uxAddress -= xHeapStructSize;
-	uxAddress &= ~((size_t)portBYTE_ALIGNMENT_MASK);
-	pxEnd = (void *)uxAddress;
-	pxEnd->xBlockSize = 0;
-	pxEnd->pxNextFreeBlock = NULL;
-
-	/* To start with there is a single free block that is sized to take up the
-	entire heap space, minus the space taken by pxEnd. */
-	pxFirstFreeBlock = (void *)pucAlignedHeap;
-	pxFirstFreeBlock->xBlockSize = uxAddress - (size_t)pxFirstFreeBlock;
-	pxFirstFreeBlock->pxNextFreeBlock = pxEnd;
-
-	/* Only one block exists - and it covers the entire usable heap space. */
-	xMinimumEverFreeBytesRemaining = pxFirstFreeBlock->xBlockSize;
-	xFreeBytesRemaining = pxFirstFreeBlock->xBlockSize;
+	xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
 
 	/* Work out the position of the top bit in a size_t variable. */
 	xBlockAllocatedBit = ((size_t)1) << ((sizeof(size_t) * heapBITS_PER_BYTE) - 1);
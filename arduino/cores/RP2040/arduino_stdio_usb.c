@@ -29,11 +29,13 @@ static void usb_irq(void)
     irq_set_pending(low_priority_irq_num);
 }
 
+/* the only place of tud_task(), the writers fill the TX FIFO and leave */
 static void low_priority_worker_irq(void)
 {
     if (mutex_try_enter(&stdio_usb_mutex, NULL))
     {
         tud_task();
+        tud_cdc_write_flush(); // the tail of a packet
         mutex_exit(&stdio_usb_mutex);
     }
 }
@@ -44,49 +46,40 @@ static int64_t timer_task(__unused alarm_id_t id, __unused void *user_data)
     return PICO_STDIO_USB_TASK_INTERVAL_US;
 }
 
+/*
+    Full packets leave from tud_cdc_write(), the rest from the worker.
+    A full FIFO waits for the worker with the mutex free, not inside an interrupt
+*/
 static int dbg_usb_out_chars(struct _reent *r, _PTR p, const char *buf, int length)
 {
     static uint64_t last_avail_time;
     uint32_t owner;
-    if (!mutex_try_enter(&stdio_usb_mutex, &owner))
-    {
-        if (owner == get_core_num())
-            return -1; // would deadlock otherwise
-        mutex_enter_blocking(&stdio_usb_mutex);
-    }
-    if (tud_cdc_connected())
+    for (int i = 0; i < length;)
     {
-        for (int i = 0; i < length;)
+        if (!mutex_try_enter(&stdio_usb_mutex, &owner))
         {
-            int n = length - i;
-            int avail = tud_cdc_write_available();
-            if (n > avail)
-                n = avail;
-            if (n)
-            {
-                int n2 = tud_cdc_write(buf + i, n);
-                tud_task();
-                tud_cdc_write_flush();
-                i += n2;
-                last_avail_time = time_us_64();
-            }
-            else
-            {
-                tud_task();
-                tud_cdc_write_flush();
-                if (!tud_cdc_connected() ||
-                    (!tud_cdc_write_available() && time_us_64() > last_avail_time + PICO_STDIO_USB_STDOUT_TIMEOUT_US))
-                {
-                    break;
-                }
-            }
+            if (owner == get_core_num())
+                return -1; // would deadlock otherwise
+            mutex_enter_blocking(&stdio_usb_mutex);
+        }
+        bool connected = tud_cdc_connected();
+        int n = connected ? tud_cdc_write(buf + i, length - i) : 0;
+        mutex_exit(&stdio_usb_mutex);
+        if (!connected)
+        {
+            last_avail_time = 0; // reset our timeout
+            break;
+        }
+        if (n)
+        {
+            i += n;
+            last_avail_time = time_us_64();
+        }
+        else if (__get_current_exception() || time_us_64() > last_avail_time + PICO_STDIO_USB_STDOUT_TIMEOUT_US)
+        {
+            break; // discard, the host is away
         }
     }
-    else
-    {
-        last_avail_time = 0; // reset our timeout
-    }
-    mutex_exit(&stdio_usb_mutex);
     return length;
 }
 
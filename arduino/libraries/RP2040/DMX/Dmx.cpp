@@ -8,31 +8,37 @@
 #include "Dmx.pio.h"
 #include "hardware/clocks.h"
 #include "hardware/irq.h"
+#include <PIO.h>
 
 Dmx::Result Dmx::begin(uint pin, PIO pio)
 {
     /* 
     Attempt to load the DMX PIO assembly program 
-    into the PIO program memory
+    into the PIO program memory, or share the one loaded
+    by another DMX instance
     */
 
-    if (!pio_can_add_program(pio, &dmx_program))
+    int prgm_offset = PIORegistry::load(pio, &dmx_program, "dmx");
+    if (prgm_offset < 0)
     {
         return ERR_INSUFFICIENT_PRGM_MEM;
     }
-    uint prgm_offset = pio_add_program(pio, &dmx_program);
 
     /* 
     Attempt to claim an unused State Machine 
     into the PIO program memory
     */
 
-    uint sm = pio_claim_unused_sm(pio, false);
-    if ((int)sm == -1)
+    int sm = PIORegistry::claimSM(pio, &dmx_program, "dmx");
+    if (sm < 0)
     {
+        PIORegistry::unload(pio, &dmx_program);
         return ERR_NO_SM_AVAILABLE;
     }
 
+    // The claimed state machine keeps the program in place until movable(), it may have moved before
+    prgm_offset = PIORegistry::offset(pio, &dmx_program);
+
     // Set this pin's GPIO function (connect PIO to the pad)
     pio_sm_set_pins_with_mask(pio, sm, 1u << pin, 1u << pin);
     pio_sm_set_pindirs_with_mask(pio, sm, 1u << pin, 1u << pin);
@@ -55,10 +61,13 @@ Dmx::Result Dmx::begin(uint pin, PIO pio)
 
     // Claim an unused DMA channel.
     // The channel is kept througout the lifetime of the DMX source
-    int dma = dma_claim_unused_channel(false);
+    int dma = PIORegistry::claimDMA(pio, sm);
 
     if (dma == -1)
+    {
+        PIORegistry::release(pio, sm, &dmx_program);
         return ERR_NO_DMA_AVAILABLE;
+    }
 
     // Get the default DMA config for our claimed channel
     dma_channel_config dma_conf = dma_channel_get_default_config(dma);
@@ -83,9 +92,17 @@ Dmx::Result Dmx::begin(uint pin, PIO pio)
     _pin = pin;
     _dma = dma;
 
+    // The registry may move the program now, write() jumps to the new offset
+    PIORegistry::movable(pio, sm, moved, this);
+
     return SUCCESS;
 }
 
+void Dmx::moved(void *ctx, PIO pio, uint sm, uint offset)
+{
+    ((Dmx *)ctx)->_prgm_offset = offset;
+}
+
 void Dmx::write(uint8_t *universe, uint length)
 {
 
@@ -124,15 +141,7 @@ void Dmx::await()
 
 void Dmx::end()
 {
-    // Stop the PIO state machine
-    pio_sm_set_enabled(_pio, _sm, false);
-
-    // Remove the PIO DMX program from the PIO program memory
-    pio_remove_program(_pio, &dmx_program, _prgm_offset);
-
-    // Unclaim the DMA channel
-    dma_channel_unclaim(_dma);
-
-    // Unclaim the sm
-    pio_sm_unclaim(_pio, _sm);
+    // Stop the PIO state machine, unclaim it and the DMA channel,
+    // the last DMX instance removes the program from the PIO program memory
+    PIORegistry::release(_pio, _sm, &dmx_program);
 }
\ No newline at end of file
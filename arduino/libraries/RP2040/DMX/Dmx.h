@@ -17,7 +17,7 @@
 
 class Dmx
 {
-    uint _prgm_offset;
+    volatile uint _prgm_offset; // PIORegistry moves the program
     uint _pin;
     uint _sm;
     PIO _pio;
@@ -60,6 +60,9 @@ public:
 
     Result begin(uint pin, PIO pio = pio0);
 
+    // PIORegistry moved the program
+    static void moved(void *ctx, PIO pio, uint sm, uint offset);
+
     /*
         write a DMX universe to the DMX transmitter instance.
         Returns imediatly after function call and does not block. 
@@ -0,0 +1,360 @@
+/*
+    2021 Georgi Angelov
+
+    Task executor for both cores, see PicoThread.h and PicoMulticoreFifo.h
+*/
+
+#pragma once
+
+#include <new>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+#ifndef EXECUTOR_DEPTH
+#define EXECUTOR_DEPTH 32 /* tasks per core, power of 2 */
+#endif
+
+#define EXECUTOR_DOORBELL 0xE8EC0000 /* SIO FIFO word, the only use of the FIFO */
+
+/**
+ * @brief A task is a function and its argument, the queue keeps them by value
+ *
+ */
+struct ExecutorTask
+{
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+/**
+ * @brief Per core deque: the owner core pushes and pops at the bottom ( newest, warm cache ),
+ * the other core steals from the top ( oldest ). The M0+ has no compare and swap,
+ * every deque has its own hardware spin lock, held for a few instructions
+ *
+ */
+class ExecutorDeque
+{
+public:
+    void init()
+    {
+        lock = spin_lock_instance(spin_lock_claim_unused(true));
+        top = bottom = 0;
+    }
+
+    bool push(const ExecutorTask &t)
+    {
+        bool result = false;
+        uint32_t save = spin_lock_blocking(lock);
+        if (bottom - top < EXECUTOR_DEPTH)
+        {
+            slot[bottom++ & (EXECUTOR_DEPTH - 1)] = t;
+            result = true;
+        }
+        spin_unlock(lock, save);
+        return result;
+    }
+
+    bool pop(ExecutorTask &t)
+    {
+        bool result = false;
+        uint32_t save = spin_lock_blocking(lock);
+        if (bottom != top)
+        {
+            t = slot[--bottom & (EXECUTOR_DEPTH - 1)];
+            result = true;
+        }
+        spin_unlock(lock, save);
+        return result;
+    }
+
+    bool steal(ExecutorTask &t)
+    {
+        bool result = false;
+        uint32_t save = spin_lock_blocking(lock);
+        if (bottom != top)
+        {
+            t = slot[top++ & (EXECUTOR_DEPTH - 1)];
+            result = true;
+        }
+        spin_unlock(lock, save);
+        return result;
+    }
+
+    uint32_t size() { return bottom - top; }
+
+    spin_lock_t *lockOf() { return lock; }
+
+protected:
+    static_assert((EXECUTOR_DEPTH & (EXECUTOR_DEPTH - 1)) == 0, "EXECUTOR_DEPTH must be a power of 2");
+    spin_lock_t *lock;
+    volatile uint32_t top, bottom;
+    ExecutorTask slot[EXECUTOR_DEPTH];
+};
+
+/**
+ * @brief Completion of a task. The result lives in the caller ( stack is fine ),
+ * get() runs other tasks while it waits
+ *
+ */
+class FutureBase
+{
+public:
+    FutureBase() { ready = false; }
+    bool isReady() { return ready; }
+
+protected:
+    volatile bool ready;
+    void done()
+    {
+        __dmb();
+        ready = true;
+        __sev(); // a waiting core
+    }
+    friend class Executor;
+};
+
+template <class T>
+class Future : public FutureBase
+{
+public:
+    T get();
+    void set(const T &v)
+    {
+        value = v;
+        done();
+    }
+
+protected:
+    T value;
+};
+
+template <>
+class Future<void> : public FutureBase
+{
+public:
+    void get();
+    void set() { done(); }
+};
+
+/**
+ * @brief Runs tasks on both cores. Core 1 is given to the executor ( begin ), it sleeps on the SIO FIFO
+ * when both deques are empty, core 0 pushes one word to wake it. Core 0 runs tasks only when it waits
+ * ( Future::get, parallel_for, wait ) or calls runOne() from loop()
+ *
+ *      Executor exec;
+ *      exec.begin();
+ *      Future<int> f;
+ *      exec.async(f, [] { return crc32(block, size); });
+ *      exec.parallel_for(0, 64, [](int i) { fft(channel[i]); });
+ *      int crc = f.get();
+ */
+class Executor
+{
+public:
+    /* launch the worker on core 1, once */
+    bool begin()
+    {
+        if (self())
+            return false;
+        deque[0].init();
+        deque[1].init();
+        pending = 0;
+        self() = this;
+        multicore_fifo_drain();
+        multicore_launch_core1(worker);
+        return true;
+    }
+
+    static Executor *instance() { return self(); }
+
+    /* to the deque of the current core, false: full */
+    bool submit(void (*fn)(void *), void *arg)
+    {
+        ExecutorTask t = {fn, arg};
+        if (!deque[get_core_num()].push(t))
+            return false;
+        count(1);
+        doorbell();
+        return true;
+    }
+
+    /* closure, copied to the heap until it runs */
+    template <class Fn>
+    bool submit(Fn f)
+    {
+        Fn *p = new (std::nothrow) Fn(f);
+        if (!p)
+            return false;
+        if (submit(invoke<Fn>, p))
+            return true;
+        delete p;
+        return false;
+    }
+
+    template <class T, class Fn>
+    bool async(Future<T> &future, Fn f)
+    {
+        future.ready = false;
+        Future<T> *fut = &future;
+        return submit([fut, f]() { fut->set(f()); });
+    }
+
+    template <class Fn>
+    bool async(Future<void> &future, Fn f)
+    {
+        future.ready = false;
+        Future<void> *fut = &future;
+        return submit([fut, f]() { f(); fut->set(); });
+    }
+
+    /* one task: own deque first, then steal from the other core */
+    bool runOne()
+    {
+        ExecutorTask t;
+        uint core = get_core_num();
+        if (!deque[core].pop(t) && !deque[core ^ 1].steal(t))
+            return false;
+        t.fn(t.arg);
+        count(-1);
+        return true;
+    }
+
+    /* run tasks here until all are done */
+    void wait()
+    {
+        while (pending)
+            if (!runOne())
+                tight_loop_contents();
+    }
+
+    void wait(FutureBase &f)
+    {
+        while (!f.isReady())
+            if (!runOne())
+                __wfe(); // the future sets SEV
+    }
+
+    /*
+        body(i) for begin <= i < end, chunks of grain indexes are taken from one counter
+        by this core and by a helper task on the other core, the faster core takes more
+    */
+    template <class Fn>
+    void parallel_for(int begin, int end, Fn body, int grain = 1)
+    {
+        if (begin >= end)
+            return;
+        ForContext<Fn> ctx;
+        ctx.next = begin;
+        ctx.end = end;
+        ctx.grain = grain < 1 ? 1 : grain;
+        ctx.body = &body;
+        ctx.lock = deque[0].lockOf();
+        ctx.helpers = 0;
+        if (end - begin > ctx.grain && submit(forHelper<Fn>, &ctx))
+            ctx.helpers = 1;
+        forRun(&ctx);
+        while (ctx.helpers)
+            if (!runOne())
+                tight_loop_contents();
+    }
+
+    uint32_t queued() { return deque[0].size() + deque[1].size(); }
+
+protected:
+    ExecutorDeque deque[2];
+    volatile int32_t pending; // submitted, not finished
+
+    template <class Fn>
+    struct ForContext
+    {
+        volatile int next;
+        int end, grain;
+        Fn *body;
+        spin_lock_t *lock;
+        volatile int helpers;
+    };
+
+    static Executor *&self()
+    {
+        static Executor *stat_ptr = nullptr;
+        return stat_ptr;
+    }
+
+    void count(int32_t n)
+    {
+        uint32_t save = spin_lock_blocking(deque[0].lockOf());
+        pending += n;
+        spin_unlock(deque[0].lockOf(), save);
+    }
+
+    /* wake core 1, a full FIFO has words already */
+    void doorbell()
+    {
+        if (get_core_num() == 0 && multicore_fifo_wready())
+            sio_hw->fifo_wr = EXECUTOR_DOORBELL;
+        __sev();
+    }
+
+    static void worker()
+    {
+        Executor *e = self();
+        for (;;)
+        {
+            if (!e->runOne())
+                (void)multicore_fifo_pop_blocking(); // doorbell
+        }
+    }
+
+    template <class Fn>
+    static void invoke(void *arg)
+    {
+        Fn *f = (Fn *)arg;
+        (*f)();
+        delete f;
+    }
+
+    template <class Fn>
+    static void forRun(ForContext<Fn> *ctx)
+    {
+        for (;;)
+        {
+            uint32_t save = spin_lock_blocking(ctx->lock);
+            int i = ctx->next;
+            ctx->next = i + ctx->grain;
+            spin_unlock(ctx->lock, save);
+            if (i >= ctx->end)
+                return;
+            int e = i + ctx->grain < ctx->end ? i + ctx->grain : ctx->end;
+            for (; i < e; i++)
+                (*ctx->body)(i);
+        }
+    }
+
+    template <class Fn>
+    static void forHelper(void *arg)
+    {
+        ForContext<Fn> *ctx = (ForContext<Fn> *)arg;
+        forRun(ctx);
+        __dmb();
+        ctx->helpers = 0;
+    }
+};
+
+template <class T>
+T Future<T>::get()
+{
+    if (Executor::instance())
+        Executor::instance()->wait(*this);
+    while (!ready)
+        tight_loop_contents();
+    return value;
+}
+
+inline void Future<void>::get()
+{
+    if (Executor::instance())
+        Executor::instance()->wait(*this);
+    while (!ready)
+        tight_loop_contents();
+}
@@ -10,6 +10,7 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
+#include "PIO.h"
 
 /**
  * @brief The PIO subsystem on RP2040 allows you to write small, simple programs for what are called PIO state machines, of
@@ -22,96 +23,140 @@ class PIOManager
 {
 public:
     PIOManager() {}
-    ~PIOManager() { stop(); }
+    ~PIOManager() { end(); }
 
-    PIOManager pin(int pin)
+    PIOManager &pin(int pin)
     {
-        this->pin = pin;
+        this->_pin = pin;
         return *this;
     }
 
-    PIOManager program(pio_program_t program)
+    /* the program is shared by the managers which run it, keep it static */
+    PIOManager &program(const pio_program_t *program)
     {
-        this->program = program;
+        this->_program = program;
         return *this;
     }
 
-    PIOManager config(pio_sm_config config)
+    PIOManager &config(pio_sm_config config)
     {
-        this->config = config;
+        this->_config = config;
         return *this;
     }
-    
-    PIOManager pio(PIO pio)
+
+    /* null: the PIO which runs the program already, else the one with room */
+    PIOManager &pio(PIO pio)
+    {
+        this->_pio = pio;
+        return *this;
+    }
+
+    PIOManager &name(const char *owner)
     {
-        this->pio = pio;
+        this->_owner = owner;
         return *this;
     }
 
-    PIOManager &begin()
+    /* false: no state machine or no instruction memory left */
+    bool begin()
     {
-        // to remember this location!
-        uint offset = pio_add_program(pio, &program);
+        end();
 
-        // Find a free state machine on our chosen PIO (erroring if there are
-        // none). Configure it to run our program, and start it, using the
-        // helper function we included in our .pio file.
-        state_machine = pio_claim_unused_sm(pio, true);
+        // Find a free state machine, load the program or share the loaded copy
+        // and remember this location!
+        PIO pio = _pio;
+        if (!PIORegistry::claim(_program, &pio, &_state_machine, &_offset, _owner))
+            return false;
+        _pio = pio;
 
         // Map the state machine's OUT pin group to one pin, namely the `pin`
         // parameter to this function.
-        sm_config_set_out_pins(&config, pin, 1);
+        sm_config_set_out_pins(&_config, _pin, 1);
 
         // Set this pin's GPIO function (connect PIO to the pad)
-        pio_gpio_init(pio, pin);
+        pio_gpio_init(_pio, _pin);
 
         // Set the pin direction to output at the PIO
-        sm_config_set_sideset_pins(&config, pin);
+        sm_config_set_sideset_pins(&_config, _pin);
 
         // Load our configuration, and jump to the start of the program
-        pio_sm_init(pio, state_machine, offset, &config);
-        return *this;
+        pio_sm_init(_pio, _state_machine, _offset, &_config);
+
+        // The registry may move the program, the offset and the wrap of the config follow it
+        PIORegistry::movable(_pio, _state_machine, moved, this);
+        return true;
     }
 
-    PIOManager &setup(uint64_t hz, int pin, pio_program_t program, pio_sm_config config, PIO pio = pio0)
+    bool setup(uint64_t hz, int pin, const pio_program_t *program, pio_sm_config config, PIO pio = nullptr)
     {
-        setup(pin, program, config, pio);
+        this->pin(pin).program(program).config(config).pio(pio);
+        if (!begin())
+            return false;
         // defines the speed
         setFrequency(hz);
-        return *this;
+        return true;
     }
 
-    PIOManager setFrequency(uint64_t hz)
+    PIOManager &setFrequency(uint64_t hz)
     {
+        if (_state_machine < 0)
+            return *this;
         if (hz > 0)
         {
-                float div = clock_get_hz(clk_sys) / hz);
-                sm_config_set_clkdiv(&config, div);
-                pio_sm_set_enabled(pio, state_machine, true);
+            float div = (float)clock_get_hz(clk_sys) / hz;
+            sm_config_set_clkdiv(&_config, div);
+            pio_sm_set_clkdiv(_pio, _state_machine, div);
+            pio_sm_set_enabled(_pio, _state_machine, true);
         }
         else
         {
-            pio_sm_set_enabled(pio, state_machine, false);
+            pio_sm_set_enabled(_pio, _state_machine, false);
         }
         return *this;
     }
 
     PIOManager &start()
     {
-        pio_sm_set_enabled(pio, state_machine, true);
+        if (_state_machine >= 0)
+            pio_sm_set_enabled(_pio, _state_machine, true);
         return *this;
     }
 
     PIOManager &stop()
     {
-        pio_sm_set_enabled(pio, state_machine, false);
+        if (_state_machine >= 0)
+            pio_sm_set_enabled(_pio, _state_machine, false);
         return *this;
     }
 
+    /* stop, free the state machine, the last user unloads the program */
+    void end()
+    {
+        if (_state_machine < 0)
+            return;
+        PIORegistry::release(_pio, _state_machine, _program);
+        _state_machine = -1;
+    }
+
+    PIO getPIO() { return _pio; }
+    int getStateMachine() { return _state_machine; }
+    int getOffset() { return _offset; }
+
 protected:
-    PIO pio = pio0;
-    pio_sm_config config;
-    pio_program_t program;
-    uint state_machine;
-    int pin;
+    static void moved(void *ctx, PIO pio, uint sm, uint offset)
+    {
+        PIOManager *m = (PIOManager *)ctx;
+        uint bottom = (m->_config.execctrl & PIO_SM0_EXECCTRL_WRAP_BOTTOM_BITS) >> PIO_SM0_EXECCTRL_WRAP_BOTTOM_LSB;
+        uint top = (m->_config.execctrl & PIO_SM0_EXECCTRL_WRAP_TOP_BITS) >> PIO_SM0_EXECCTRL_WRAP_TOP_LSB;
+        sm_config_set_wrap(&m->_config, bottom - m->_offset + offset, top - m->_offset + offset);
+        m->_offset = offset;
+    }
+
+    PIO _pio = nullptr;
+    pio_sm_config _config;
+    const pio_program_t *_program = nullptr;
+    const char *_owner = "PIOManager";
+    int _state_machine = -1;
+    int _offset = -1;
+    int _pin;
 };
@@ -0,0 +1,197 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "SPI.h"
+#include "hardware/irq.h"
+
+/*
+    DMA engine
+
+    Two channels per bus: TX feeds the data register, RX drains it. RX ends last, its
+    interrupt raises CS, ends the transaction and starts the next one from the queue,
+    so the drivers on one bus take turns without a CPU loop
+*/
+
+#define SPI_DMA_IRQ_INDEX (SPI_DMA_IRQ - DMA_IRQ_0)
+
+static SPIClass *spi_bus[2];
+static void spi0_dma_irq(void) { spi_bus[0]->isr(); }
+static void spi1_dma_irq(void) { spi_bus[1]->isr(); }
+
+static const uint16_t spi_dummy_tx = 0xFFFF;
+static uint16_t spi_dummy_rx;
+
+bool SPIClass::dma_init()
+{
+    if (_rx_dma > -1)
+        return true;
+    int n = spi_get_index(spi);
+    if ((_tx_dma = dma_claim_unused_channel(false)) < 0)
+        return false;
+    if ((_rx_dma = dma_claim_unused_channel(false)) < 0)
+    {
+        dma_channel_unclaim(_tx_dma);
+        _tx_dma = -1;
+        return false;
+    }
+    spi_bus[n] = this;
+    irq_add_shared_handler(SPI_DMA_IRQ, n ? spi1_dma_irq : spi0_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    dma_irqn_set_channel_enabled(SPI_DMA_IRQ_INDEX, _rx_dma, true);
+    irq_set_enabled(SPI_DMA_IRQ, true);
+    return true;
+}
+
+void SPIClass::dma_deinit()
+{
+    if (_rx_dma < 0)
+        return;
+    while (_head)
+        abort(_head);
+    if (_active)
+        abort(_active);
+    dma_irqn_set_channel_enabled(SPI_DMA_IRQ_INDEX, _rx_dma, false);
+    irq_remove_handler(SPI_DMA_IRQ, spi_get_index(spi) ? spi1_dma_irq : spi0_dma_irq);
+    dma_channel_unclaim(_tx_dma);
+    dma_channel_unclaim(_rx_dma);
+    _tx_dma = _rx_dma = -1;
+}
+
+/* start the head of the queue, interrupts off */
+void SPIClass::next()
+{
+    if (_active || !_head)
+        return;
+    SPITransfer *t = _head;
+    if (!(_head = t->next))
+        _tail = NULL;
+    _active = t;
+
+    if (t->settings)
+    {
+        setFrequency(t->settings->clock);
+        setDataMode(t->settings->mode);
+    }
+    frame(t->bits);
+
+    enum dma_channel_transfer_size size = t->bits > 8 ? DMA_SIZE_16 : DMA_SIZE_8;
+    io_rw_32 *dr = &spi_get_hw(spi)->dr;
+
+    dma_channel_config c = dma_channel_get_default_config(_tx_dma);
+    channel_config_set_transfer_data_size(&c, size);
+    channel_config_set_read_increment(&c, t->tx != NULL);
+    channel_config_set_dreq(&c, spi_get_dreq(spi, true));
+    dma_channel_configure(_tx_dma, &c, dr, t->tx ? t->tx : &spi_dummy_tx, t->count, false);
+
+    c = dma_channel_get_default_config(_rx_dma);
+    channel_config_set_transfer_data_size(&c, size);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, t->rx != NULL);
+    channel_config_set_dreq(&c, spi_get_dreq(spi, false));
+    dma_channel_configure(_rx_dma, &c, t->rx ? t->rx : &spi_dummy_rx, dr, t->count, false);
+
+    if (t->cs > -1)
+        gpio_put(t->cs, 0);
+    dma_start_channel_mask(1u << _tx_dma | 1u << _rx_dma);
+}
+
+void SPIClass::isr()
+{
+    if (_rx_dma < 0 || !dma_irqn_get_channel_status(SPI_DMA_IRQ_INDEX, _rx_dma))
+        return;
+    dma_irqn_acknowledge_channel(SPI_DMA_IRQ_INDEX, _rx_dma);
+    SPITransfer *t = _active;
+    if (NULL == t)
+        return;
+    if (t->cs > -1)
+        gpio_put(t->cs, 1);
+    _active = NULL;
+    t->status = 0;
+    if (t->callback)
+        t->callback(t);
+    next();
+}
+
+bool SPIClass::submit(SPITransfer *t)
+{
+    if (NULL == t || _rx_dma < 0)
+        return false;
+    t->status = SPI_PENDING;
+    t->next = NULL;
+    if (0 == t->count)
+    {
+        t->status = 0;
+        return true;
+    }
+    uint32_t _prim = save_and_disable_interrupts();
+    if (_tail)
+        _tail->next = t;
+    else
+        _head = t;
+    _tail = t;
+    next();
+    restore_interrupts(_prim);
+    return true;
+}
+
+int SPIClass::wait(SPITransfer *t)
+{
+    while (!t->done())
+        tight_loop_contents();
+    return t->status;
+}
+
+/* queued: removed, active: DMA stopped, the frames on the wire are lost */
+void SPIClass::abort(SPITransfer *t)
+{
+    uint32_t _prim = save_and_disable_interrupts();
+    if (t == _active)
+    {
+        dma_irqn_set_channel_enabled(SPI_DMA_IRQ_INDEX, _rx_dma, false);
+        dma_channel_abort(_tx_dma);
+        dma_channel_abort(_rx_dma);
+        dma_irqn_acknowledge_channel(SPI_DMA_IRQ_INDEX, _rx_dma);
+        dma_irqn_set_channel_enabled(SPI_DMA_IRQ_INDEX, _rx_dma, true);
+        while (spi_is_busy(spi))
+            tight_loop_contents();
+        while (spi_is_readable(spi))
+            (void)spi_get_hw(spi)->dr;
+        if (t->cs > -1)
+            gpio_put(t->cs, 1);
+        _active = NULL;
+        t->status = -1;
+        next();
+    }
+    else if (!t->done())
+    {
+        SPITransfer **pp = &_head, *prev = NULL;
+        while (*pp && *pp != t)
+        {
+            prev = *pp;
+            pp = &(*pp)->next;
+        }
+        if (*pp)
+        {
+            *pp = t->next;
+            if (_tail == t)
+                _tail = prev;
+            t->status = -1;
+        }
+    }
+    restore_interrupts(_prim);
+}
@@ -26,6 +26,17 @@
 #include "RingBuffer.h"
 #include <hardware/spi.h>
 #include <hardware/gpio.h>
+#include <hardware/dma.h>
+
+#ifndef SPI_DMA_IRQ
+#define SPI_DMA_IRQ DMA_IRQ_1 /* shared */
+#endif
+
+#ifndef SPI_DMA_MIN
+#define SPI_DMA_MIN 16 /* transfer(buf, count) below this is done by the CPU */
+#endif
+
+#define SPI_PENDING (-1)
 
 typedef enum
 {
@@ -59,6 +70,45 @@ private:
     friend class SPIClass;
 };
 
+/*
+    One chip select transaction: CS low, count frames full duplex, CS high.
+    tx NULL sends 0xFF, rx NULL drops the input. bits 8: uint8_t buffers, 16: uint16_t
+    settings NULL keeps the bus settings. Queued with SPIClass::submit(), the DMA interrupt
+    of one transaction starts the next, the buffers must live until done()
+
+    status is SPI_PENDING, then 0 ( or -1 if aborted )
+    callback runs in the DMA interrupt, it may submit() but not wait()
+*/
+struct SPITransfer
+{
+    const void *tx;
+    void *rx;
+    size_t count;
+    uint8_t bits;
+    int cs;
+    const SPISettings *settings;
+    void (*callback)(SPITransfer *t);
+    void *user;
+    volatile int status;
+    SPITransfer *next;
+
+    SPITransfer(const void *wr = NULL, void *rd = NULL, size_t frames = 0, int cs_pin = -1, uint8_t frame_bits = 8)
+    {
+        tx = wr;
+        rx = rd;
+        count = frames;
+        bits = frame_bits;
+        cs = cs_pin;
+        settings = NULL;
+        callback = NULL;
+        user = NULL;
+        status = 0;
+        next = NULL;
+    }
+
+    bool done() const { return SPI_PENDING != status; }
+};
+
 class SPIClass
 {
 private:
@@ -71,6 +121,32 @@ private:
     uint32_t _bit_order;
     uint32_t _data_bits;
     uint32_t _mode;
+    uint32_t _frame; // programmed format: bits | mode << 8
+
+    // DMA engine, SPI.cpp
+    int _tx_dma, _rx_dma;
+    SPITransfer *_head, *_tail;
+    SPITransfer *volatile _active;
+    void next();
+    bool dma_init();
+    void dma_deinit();
+
+    /* spi_set_format() only when the frame size or the mode changes */
+    inline void frame(uint32_t bits)
+    {
+        uint32_t f = bits | _mode << 8;
+        if (_frame != f)
+        {
+            _frame = f;
+            spi_set_format(spi, bits, (spi_cpol_t)_clk_polarity, (spi_cpha_t)_clk_format, SPI_MSB_FIRST);
+        }
+    }
+
+    inline void idle()
+    {
+        while (_active || _head)
+            tight_loop_contents();
+    }
 
     void init_default()
     {
@@ -81,6 +157,10 @@ private:
         _data_bits = 8;        // 4..16
         _brg_hz = 1000000;     // max 31 250 000
         _cs = -1;
+        _frame = 0;
+        _tx_dma = _rx_dma = -1;
+        _head = _tail = NULL;
+        _active = NULL;
     }
 
     inline uint8_t reverseByte(uint8_t b)
@@ -91,6 +171,11 @@ private:
         return b;
     }
 
+    inline uint16_t reverseWord(uint16_t w)
+    {
+        return reverseByte(w) << 8 | reverseByte(w >> 8);
+    }
+
 public:
     SPIClass(uint8_t num)
     {
@@ -125,10 +210,14 @@ public:
     {
         setPins(sck, miso, mosi, ss);
         spi_init(spi, _brg_hz);
+        _frame = 0;
+        frame(_data_bits);
+        dma_init();
     }
 
     void end()
     {
+        dma_deinit();
         spi_deinit(spi);
     }
 
@@ -144,6 +233,8 @@ public:
         if (_bit_order == LSBFIRST)
             tx = reverseByte(tx);
 
+        idle();
+        frame(8);
         spi_write_read_blocking(spi, &tx, &rx, 1);
 
         if (_cs > -1)
@@ -152,46 +243,72 @@ public:
         return (_bit_order == LSBFIRST) ? reverseByte(rx) : rx;
     }
 
+    /* one 16 bit frame */
     uint16_t transfer(uint16_t data)
     {
-        union
-        {
-            uint16_t val;
-            struct
-            {
-                uint8_t lsb;
-                uint8_t msb;
-            };
-        } t;
-        t.val = data;
+        uint16_t rx = 0;
         if (_bit_order == LSBFIRST)
-        {
-            t.lsb = transfer(t.lsb);
-            t.msb = transfer(t.msb);
-        }
-        else
-        {
-            t.msb = transfer(t.msb);
-            t.lsb = transfer(t.lsb);
-        }
-        return t.val;
+            data = reverseWord(data);
+        idle();
+        if (_cs > -1)
+            gpio_put(_cs, 0);
+        frame(16);
+        spi_write16_read16_blocking(spi, &data, &rx, 1);
+        if (_cs > -1)
+            gpio_put(_cs, 1);
+        return (_bit_order == LSBFIRST) ? reverseWord(rx) : rx;
     }
 
-    int transfer(uint8_t *buf, size_t count)
+    uint16_t transfer16(uint16_t data) { return transfer(data); }
+
+    int transfer(uint8_t *buf, size_t count) // MSB
     {
-        return spi_write_read_blocking(spi, buf, buf, count); // MSB
+        if (count >= SPI_DMA_MIN && _rx_dma > -1)
+        {
+            SPITransfer t(buf, buf, count);
+            if (submit(&t))
+                return wait(&t) ? 0 : count;
+        }
+        idle();
+        frame(8);
+        return spi_write_read_blocking(spi, buf, buf, count);
     }
 
     void write(uint8_t *buf, size_t count) { transfer(buf, count); }
 
+    /* 16 bit frames, MSB */
     void write(uint16_t *buf, size_t count)
     {
-        //LSBFIRST
-        spi_set_format(spi, 16, (spi_cpol_t)_clk_polarity, (spi_cpha_t)_clk_format, (spi_order_t)_bit_order);
+        if (count >= SPI_DMA_MIN && _rx_dma > -1)
+        {
+            SPITransfer t(buf, NULL, count, -1, 16);
+            if (submit(&t))
+            {
+                wait(&t);
+                return;
+            }
+        }
+        idle();
+        frame(16);
         spi_write16_blocking(spi, buf, count);
-        spi_set_format(spi, _data_bits, (spi_cpol_t)_clk_polarity, (spi_cpha_t)_clk_format, (spi_order_t)_bit_order);
     }
 
+    /* queued DMA transactions, see SPITransfer */
+    bool submit(SPITransfer *t);
+    int wait(SPITransfer *t);
+    void abort(SPITransfer *t);
+    bool busy() { return _active || _head; }
+
+    /* full duplex by DMA, callback from the interrupt, t must live until done */
+    bool transferAsync(SPITransfer *t, const void *tx, void *rx, size_t count, void (*callback)(SPITransfer *) = NULL)
+    {
+        *t = SPITransfer(tx, rx, count, _cs);
+        t->callback = callback;
+        return submit(t);
+    }
+
+    void isr(); // PRIVATE HANDLER
+
     void setFrequency(uint32_t Hz)
     {
         if (_brg_hz != Hz)
@@ -221,10 +338,11 @@ public:
 
     void beginTransaction(SPISettings settings)
     {
+        idle();
         setFrequency(settings.clock);
         setDataMode(settings.mode);
         setBitOrder(settings.order);
-        spi_set_format(spi, _data_bits, (spi_cpol_t)_clk_polarity, (spi_cpha_t)_clk_format, (spi_order_t)_bit_order);
+        frame(_data_bits);
     }
 
     void endTransaction(void) {}
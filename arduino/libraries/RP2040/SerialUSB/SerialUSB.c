@@ -30,19 +30,27 @@
 #if !defined(TINYUSB_HOST_LINKED) && !defined(TINYUSB_DEVICE_LINKED)
 
 #include "tusb.h"
+#include "pico/mutex.h"
+#include "pico/time.h"
+#include "hardware/irq.h"
+
+#if CFG_TUD_CDC < 1 || CFG_TUD_CDC > 3
+#error "CFG_TUD_CDC: 1..3 interfaces"
+#endif
 
 #define USBD_VID (0x2E8A) // Raspberry Pi
 #define USBD_PID (0x000a) // Raspberry Pi Pico SDK CDC
 
-#define USBD_DESC_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+#define USBD_DESC_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN * CFG_TUD_CDC)
 #define USBD_MAX_POWER_MA (250)
 
 #define USBD_ITF_CDC (0) // needs 2 interfaces
-#define USBD_ITF_MAX (2)
+#define USBD_ITF_MAX (2 * CFG_TUD_CDC)
 
-#define USBD_CDC_EP_CMD (0x81)
-#define USBD_CDC_EP_OUT (0x02)
-#define USBD_CDC_EP_IN (0x82)
+/* CDC n: interfaces 2n, 2n + 1 and endpoints n * 2 + 1, n * 2 + 2 */
+#define USBD_CDC_EP_CMD(n) (0x81 + 2 * (n))
+#define USBD_CDC_EP_OUT(n) (0x02 + 2 * (n))
+#define USBD_CDC_EP_IN(n) (0x82 + 2 * (n))
 #define USBD_CDC_CMD_MAX_SIZE (8)
 #define USBD_CDC_IN_OUT_MAX_SIZE (64)
 
@@ -69,9 +77,18 @@ static const tusb_desc_device_t usbd_desc_device = {
     .bNumConfigurations = 1,
 };
 
+#define USBD_CDC(n) TUD_CDC_DESCRIPTOR(USBD_ITF_CDC + 2 * (n), USBD_STR_CDC, USBD_CDC_EP_CMD(n), USBD_CDC_CMD_MAX_SIZE, \
+                                    USBD_CDC_EP_OUT(n), USBD_CDC_EP_IN(n), USBD_CDC_IN_OUT_MAX_SIZE)
+
 static const uint8_t usbd_desc_cfg[USBD_DESC_LEN] = {
     TUD_CONFIG_DESCRIPTOR(1, USBD_ITF_MAX, USBD_STR_0, USBD_DESC_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, USBD_MAX_POWER_MA),
-    TUD_CDC_DESCRIPTOR(USBD_ITF_CDC, USBD_STR_CDC, USBD_CDC_EP_CMD, USBD_CDC_CMD_MAX_SIZE, USBD_CDC_EP_OUT, USBD_CDC_EP_IN, USBD_CDC_IN_OUT_MAX_SIZE),
+    USBD_CDC(0),
+#if CFG_TUD_CDC > 1
+    USBD_CDC(1),
+#endif
+#if CFG_TUD_CDC > 2
+    USBD_CDC(2),
+#endif
 };
 
 static const char *const usbd_desc_str[] = {
@@ -122,5 +139,79 @@ const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
     return desc_str;
 }
 
+/*
+    The device stack runs only in a low priority interrupt, woken by the USB interrupt
+    or by a timer. The writers fill the CDC TX FIFO, TinyUSB sends every full packet,
+    the worker sends the rest. Nobody calls tud_task() from the write path
+*/
+
+static mutex_t usb_mutex;
+static uint8_t usb_worker_irq_num;
+static bool usb_running;
+
+static void usb_worker_irq(void)
+{
+    if (mutex_try_enter(&usb_mutex, NULL))
+    {
+        tud_task();
+        for (uint8_t itf = 0; itf < CFG_TUD_CDC; itf++)
+            tud_cdc_n_write_flush(itf); // the tail of a packet
+        mutex_exit(&usb_mutex);
+    }
+}
+
+static void usb_irq(void)
+{
+    irq_set_pending(usb_worker_irq_num);
+}
+
+static int64_t usb_timer_task(__unused alarm_id_t id, __unused void *user_data)
+{
+    irq_set_pending(usb_worker_irq_num);
+    return PICO_STDIO_USB_TASK_INTERVAL_US;
+}
+
+bool usb_cdc_init(void)
+{
+    if (usb_running)
+        return true;
+    tusb_init(); // initialize TinyUSB
+    mutex_init(&usb_mutex);
+    usb_worker_irq_num = (uint8_t)user_irq_claim_unused(true);
+    irq_set_exclusive_handler(usb_worker_irq_num, usb_worker_irq);
+    irq_set_enabled(usb_worker_irq_num, true);
+    if (irq_has_shared_handler(USBCTRL_IRQ))
+        irq_add_shared_handler(USBCTRL_IRQ, usb_irq, PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
+    else
+        add_alarm_in_us(PICO_STDIO_USB_TASK_INTERVAL_US, usb_timer_task, NULL, true);
+    return usb_running = true;
+}
+
+/* false: the owner is this core ( interrupted ), waiting would deadlock */
+bool usb_cdc_lock(void)
+{
+    uint32_t owner;
+    if (!usb_running)
+        return false;
+    if (!mutex_try_enter(&usb_mutex, &owner))
+    {
+        if (owner == get_core_num())
+            return false;
+        mutex_enter_blocking(&usb_mutex);
+    }
+    return true;
+}
+
+void usb_cdc_unlock(void)
+{
+    mutex_exit(&usb_mutex);
+}
+
+/* the worker can not run: inside an interrupt of the same or higher priority */
+bool usb_cdc_can_wait(void)
+{
+    return 0 == __get_current_exception();
+}
+
 #endif
 #endif // PICO_STDIO_USB
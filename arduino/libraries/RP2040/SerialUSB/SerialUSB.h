@@ -27,17 +27,39 @@
 #include "pico/time.h"
 #include "tusb.h"
 
+extern "C"
+{
+    // SerialUSB.c, one device stack for all CDC interfaces
+    bool usb_cdc_init(void);
+    bool usb_cdc_lock(void);
+    void usb_cdc_unlock(void);
+    bool usb_cdc_can_wait(void);
+}
+
+/*
+    SerialUSB USB;      // CDC 0
+    SerialUSB LOG(1);   // CDC 1, build_flags = -D CFG_TUD_CDC=2
+
+    write() puts the data in the CDC TX FIFO ( CFG_TUD_CDC_TX_BUFSIZE ) and returns,
+    when the FIFO is full it waits for the host up to PICO_STDIO_USB_STDOUT_TIMEOUT_US,
+    setWriteWait(false): never waits, returns the accepted count
+*/
+
 class SerialUSB : public HardwareSerial
 {
 private:
+    uint8_t _itf;
     bool _running;
-    mutex_t _usb_mutex;
+    bool _wait;
+    uint32_t _dropped;
 
 public:
-    SerialUSB()
+    SerialUSB(uint8_t itf = 0)
     {
-        mutex_exit(&_usb_mutex);
+        _itf = itf < CFG_TUD_CDC ? itf : 0;
         _running = false;
+        _wait = true;
+        _dropped = 0;
     }
 
     ~SerialUSB() { end(); }
@@ -49,17 +71,7 @@ public:
 
     void begin(unsigned long baud, int config, bool retarget = false)
     {
-        end();
-        tusb_init(); // initialize TinyUSB
-
-#ifndef PICO_STDIO_USB_LOW_PRIORITY_IRQ
-#define PICO_STDIO_USB_LOW_PRIORITY_IRQ 31 // SDK 140
-#endif
-
-        irq_set_exclusive_handler(PICO_STDIO_USB_LOW_PRIORITY_IRQ, SerialUSB_irq);
-        irq_set_enabled(PICO_STDIO_USB_LOW_PRIORITY_IRQ, true);
-        mutex_init(&_usb_mutex);
-        _running = add_alarm_in_us(PICO_STDIO_USB_TASK_INTERVAL_US, SerialUSB_timer_task, NULL, true);
+        _running = usb_cdc_init();
     }
 
     void end(void) {}
@@ -70,149 +82,108 @@ public:
     {
         if (!_running)
             return 0;
-
-        static uint64_t last_avail_time;
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
+        size_t done = 0;
+        uint64_t last_avail_time = time_us_64();
+        while (done < size)
         {
-            if (owner == get_core_num())
-                return 0; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
+            if (!usb_cdc_lock())
+                break; // would deadlock otherwise
+            bool connected = tud_cdc_n_connected(_itf);
+            uint32_t n = connected ? tud_cdc_n_write(_itf, buf + done, size - done) : 0; // full packets go now
+            usb_cdc_unlock();
+            done += n;
+            if (done == size || !connected || !_wait || !usb_cdc_can_wait())
+                break;
+            if (n)
+                last_avail_time = time_us_64();
+            else if (time_us_64() > last_avail_time + PICO_STDIO_USB_STDOUT_TIMEOUT_US)
+                break; // the host does not read
+            tight_loop_contents();
         }
-        int i = 0;
-        if (tud_cdc_connected())
-        {
-            for (int i = 0; i < size;)
-            {
-                int n = size - i;
-                int avail = tud_cdc_write_available();
-                if (n > avail)
-                    n = avail;
-                if (n)
-                {
-                    int n2 = tud_cdc_write(buf + i, n);
-                    tud_task();
-                    tud_cdc_write_flush();
-                    i += n2;
-                    last_avail_time = time_us_64();
-                }
-                else
-                {
-                    tud_task();
-                    tud_cdc_write_flush();
-                    if (!tud_cdc_connected() || (!tud_cdc_write_available() && time_us_64() > last_avail_time + 1000000 /* 1 second */))
-                        break;
-                }
-            }
-        }
-        else
-        {
-            last_avail_time = 0; // reset our timeout
-        }
-        mutex_exit(&_usb_mutex);
-        return i;
+        _dropped += size - done;
+        return done;
+    }
+
+    /* false: write() does not wait for FIFO space */
+    void setWriteWait(bool wait) { _wait = wait; }
+
+    /* bytes write() did not take: not connected, host too slow or no wait */
+    uint32_t dropped(void) { return _dropped; }
+
+    int availableForWrite()
+    {
+        if (!_running || !usb_cdc_lock())
+            return 0;
+        int ret = tud_cdc_n_connected(_itf) ? tud_cdc_n_write_available(_itf) : 0;
+        usb_cdc_unlock();
+        return ret;
     }
 
     int read()
     {
-        if (!_running)
+        if (!_running || !usb_cdc_lock())
             return -1;
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
-        {
-            if (owner == get_core_num())
-                return -1; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
-        }
-        if (tud_cdc_connected() && tud_cdc_available())
-        {
-            int ch = tud_cdc_read_char();
-            mutex_exit(&_usb_mutex);
-            return ch;
-        }
-        mutex_exit(&_usb_mutex);
-        return -1;
+        int ch = -1;
+        if (tud_cdc_n_connected(_itf) && tud_cdc_n_available(_itf))
+            ch = tud_cdc_n_read_char(_itf);
+        usb_cdc_unlock();
+        return ch;
+    }
+
+    int read(uint8_t *buf, size_t size)
+    {
+        if (!_running || !usb_cdc_lock())
+            return -1;
+        int cnt = 0;
+        if (tud_cdc_n_connected(_itf))
+            cnt = tud_cdc_n_read(_itf, buf, size);
+        usb_cdc_unlock();
+        return cnt ? cnt : -1;
     }
+    int read(char *buf, size_t size) { return read((uint8_t *)buf, size); }
 
     int available(void)
     {
-        if (!_running)
+        if (!_running || !usb_cdc_lock())
             return 0;
-
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
-        {
-            if (owner == get_core_num())
-                return 0; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
-        }
-        auto ret = tud_cdc_available();
-        mutex_exit(&_usb_mutex);
+        int ret = tud_cdc_n_available(_itf);
+        usb_cdc_unlock();
         return ret;
     }
 
     int peek(void)
     {
-        if (!_running)
-            return 0;
+        if (!_running || !usb_cdc_lock())
+            return -1;
         uint8_t c;
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
-        {
-            if (owner == get_core_num())
-                return -1; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
-        }
-
-        // auto ret = tud_cdc_peek(0, &c) ? (int)c : -1;
-        // auto ret = tud_cdc_peek(&c) ? (int)c : -1;
-        auto ret = tud_cdc_n_peek(0, &c) ? (int)c : -1; // SDK 140
-        
-        mutex_exit(&_usb_mutex);
+        int ret = tud_cdc_n_peek(_itf, &c) ? (int)c : -1; // SDK 140
+        usb_cdc_unlock();
         return ret;
     }
 
+    /* send the tail and wait for the host to take the FIFO */
     void flush(void)
     {
-        if (!_running)
+        if (!_running || !usb_cdc_lock())
             return;
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
-        {
-            if (owner == get_core_num())
-                return; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
-        }
-        tud_cdc_write_flush();
-        mutex_exit(&_usb_mutex);
+        tud_cdc_n_write_flush(_itf);
+        usb_cdc_unlock();
+        if (!usb_cdc_can_wait())
+            return;
+        uint64_t end = time_us_64() + PICO_STDIO_USB_STDOUT_TIMEOUT_US;
+        while (availableForWrite() < CFG_TUD_CDC_TX_BUFSIZE && tud_cdc_n_connected(_itf) && time_us_64() < end)
+            tight_loop_contents();
     }
 
     operator bool()
     {
-        if (!_running)
+        if (!_running || !usb_cdc_lock())
             return false;
-
-        uint32_t owner;
-        if (!mutex_try_enter(&_usb_mutex, &owner))
-        {
-            if (owner == get_core_num())
-                return -1; // would deadlock otherwise
-            mutex_enter_blocking(&_usb_mutex);
-        }
-        tud_task();
-        auto ret = tud_cdc_connected();
-        mutex_exit(&_usb_mutex);
+        bool ret = tud_cdc_n_connected(_itf);
+        usb_cdc_unlock();
         return ret;
     }
 
-    static void SerialUSB_irq() { tud_task(); }
-
-    static int64_t SerialUSB_timer_task(__unused alarm_id_t id, __unused void *user_data)
-    {
-        irq_set_pending(PICO_STDIO_USB_LOW_PRIORITY_IRQ);
-        return PICO_STDIO_USB_TASK_INTERVAL_US;
-    }
-
     using Print::write;
 };
 
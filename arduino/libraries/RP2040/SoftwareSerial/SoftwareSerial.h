@@ -19,91 +19,284 @@ void loop() {
 
 */
 
+#pragma once
+
+#include <RingBuffer.h>
+#include <malloc.h>
 #include "hardware/clocks.h"
 #include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "pio_uart_tx.h"
 #include "pio_uart_rx.h"
+#include "PIO.h"
+
+/*
+    RX  DMA reads the top byte of the RX FIFO to a circular buffer ( size per instance ), the reader
+        takes the bytes from the DMA write position, no interrupt per byte
+    TX  write() copies to the TX ring and returns, DMA feeds the TX FIFO, the DMA interrupt starts the
+        next piece of the ring
+
+    One shared DMA interrupt for all instances, up to one per state machine.
+    Without a free DMA channel RX is the 8 byte FIFO and write() blocks
+*/
+
+#ifndef SOFTSERIAL_RX_BUFFER_SIZE
+#define SOFTSERIAL_RX_BUFFER_SIZE 256 /* power of 2, default of the instances, 0: the FIFO only */
+#endif
+
+#ifndef SOFTSERIAL_TX_BUFFER_SIZE
+#define SOFTSERIAL_TX_BUFFER_SIZE 128 /* power of 2, 0: blocking write */
+#endif
+
+#ifndef SOFTSERIAL_DMA_IRQ
+#define SOFTSERIAL_DMA_IRQ DMA_IRQ_1
+#endif
+
+#define SOFTSERIAL_MAX (NUM_PIOS * NUM_PIO_STATE_MACHINES)
 
 /**
  * @brief Software Serial Arduino Stream which uses the Pico PIO.
  * 
  * Based on https://github.com/raspberrypi/pico-examples/tree/master/pio
+ * 
+ * The state machines come from the PIORegistry, the instances share the loaded programs
  */
 
 class SoftwareSerial : public Stream
 {
 public:
-    SoftwareSerial(PIO pio = pio1, uint stateMachineRxIndex = 0, uint stateMachineTxIndex = 1)
+    /* pio null: the PIO which runs the UART programs already, else the one with room */
+    SoftwareSerial(PIO pio = nullptr, uint rxBufferSize = SOFTSERIAL_RX_BUFFER_SIZE)
     {
         this->pio = pio;
-        this->sm_rx = stateMachineRxIndex;
-        this->sm_tx = stateMachineTxIndex;
+        // the DMA ring is 4 .. 32K bytes, else the FIFO
+        bool ring = rxBufferSize >= 4 && rxBufferSize <= 32768 && !(rxBufferSize & (rxBufferSize - 1));
+        this->rx_size = ring ? rxBufferSize : 0;
     }
 
-    void begin(uint baud = 115200, int txPin = -1, int rxPin = -1)
+    ~SoftwareSerial() { end(); }
+
+    /* false: out of state machines or instruction memory */
+    bool begin(uint baud = 115200, int txPin = -1, int rxPin = -1)
     {
+        end();
         this->baud = baud;
 
-        if (rxPin >= 0)
+        if (rxPin >= 0 && !setupRx(rxPin))
         {
-            setupRx(rxPin);
+            return false;
         }
 
-        if (txPin >= 0)
+        if (txPin >= 0 && !setupTx(txPin))
         {
-            setupTx(txPin);
+            end();
+            return false;
         }
+
+        if (rx_dma >= 0 || tx_dma >= 0)
+            attach();
+        return true;
+    }
+
+    void end()
+    {
+        detach();
+        if (sm_rx >= 0)
+        {
+            PIORegistry::release(pio_rx, sm_rx, &pio_uart_rx_program); // and the paired DMA
+            sm_rx = -1;
+        }
+        if (sm_tx >= 0)
+        {
+            PIORegistry::release(pio_tx, sm_tx, &pio_uart_tx_program);
+            sm_tx = -1;
+        }
+        rx_dma = tx_dma = -1;
+        free(rx_buf);
+        rx_buf = nullptr;
+        peekValue = -1;
+#if SOFTSERIAL_TX_BUFFER_SIZE
+        tx_ring.clear();
+#endif
+        tx_len = 0;
     }
 
     virtual int peek()
     {
-        peekValue = read();
+        if (rx_dma >= 0)
+            return rx_pending() ? rx_buf[rx_tail & (rx_size - 1)] : -1;
+        if (peekValue == -1)
+            peekValue = read();
         return peekValue;
     }
 
     virtual int available()
     {
-        return pio_sm_get_rx_fifo_level(pio, sm_rx);
+        if (rx_dma >= 0)
+            return rx_pending();
+        if (sm_rx < 0)
+            return 0;
+        return pio_sm_get_rx_fifo_level(pio_rx, sm_rx) + (peekValue != -1);
     }
 
     virtual int read()
     {
+        if (rx_dma >= 0)
+            return rx_pending() ? rx_buf[rx_tail++ & (rx_size - 1)] : -1;
         if (peekValue != -1)
         {
             int result = peekValue;
             peekValue = -1;
             return result;
         }
+        if (sm_rx < 0)
+            return -1;
         // 8-bit read from the uppermost byte of the FIFO, as data is left-justified
-        io_rw_8 *rxfifo_shift = (io_rw_8 *)&pio->rxf[sm_rx] + 3;
-        if (pio_sm_is_rx_fifo_empty(pio, sm_rx))
+        io_rw_8 *rxfifo_shift = (io_rw_8 *)&pio_rx->rxf[sm_rx] + 3;
+        if (pio_sm_is_rx_fifo_empty(pio_rx, sm_rx))
             return -1;
 
         tight_loop_contents();
         return (char)*rxfifo_shift;
     }
 
-    virtual size_t write(uint8_t c)
+    /* what is there, up to size, -1: nothing */
+    int read(uint8_t *buf, size_t size)
     {
-        pio_sm_put_blocking(pio, sm_tx, (uint32_t)c);
-        return 1;
+        int cnt = 0;
+        if (rx_dma < 0)
+        {
+            int c;
+            while (cnt < (int)size && (c = read()) != -1)
+                buf[cnt++] = c;
+            return cnt ? cnt : -1;
+        }
+        uint32_t n = rx_pending();
+        if (n > size)
+            n = size;
+        while (cnt < (int)n) // two pieces at the buffer end
+        {
+            uint32_t at = rx_tail & (rx_size - 1);
+            uint32_t len = rx_size - at;
+            if (len > n - cnt)
+                len = n - cnt;
+            memcpy(buf + cnt, rx_buf + at, len);
+            rx_tail += len;
+            cnt += len;
+        }
+        return cnt ? cnt : -1;
+    }
+
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+
+    /* returns when the data is in the TX ring, waits only for ring space ( see setWriteWait ) */
+    virtual size_t write(const uint8_t *buf, size_t size)
+    {
+        if (sm_tx < 0)
+            return 0;
+#if SOFTSERIAL_TX_BUFFER_SIZE
+        if (tx_dma >= 0)
+        {
+            size_t done = 0;
+            for (;;)
+            {
+                done += tx_ring.write(buf + done, size - done);
+                uint32_t save = save_and_disable_interrupts();
+                if (0 == tx_len)
+                    tx_kick();
+                restore_interrupts(save);
+                if (done == size || !tx_wait || __get_current_exception())
+                    return done;
+                tight_loop_contents();
+            }
+        }
+#endif
+        for (size_t i = 0; i < size; i++)
+            pio_sm_put_blocking(pio_tx, sm_tx, (uint32_t)buf[i]);
+        return size;
+    }
+    using Print::write;
+
+    virtual int availableForWrite()
+    {
+        if (sm_tx < 0)
+            return 0;
+#if SOFTSERIAL_TX_BUFFER_SIZE
+        if (tx_dma >= 0)
+            return tx_ring.availableForStore();
+#endif
+        return pio_sm_is_tx_fifo_full(pio_tx, sm_tx) ? 0 : 1;
     }
 
+    /* false: write() returns the count that fits in the TX ring */
+    void setWriteWait(bool wait) { tx_wait = wait; }
+
+    /* the ring and the FIFO are sent, the last byte may be on the line */
+    virtual void flush()
+    {
+        if (sm_tx < 0)
+            return;
+        while (tx_len)
+            tight_loop_contents();
+        while (!pio_sm_is_tx_fifo_empty(pio_tx, sm_tx))
+            tight_loop_contents();
+    }
+
+    /* bytes lost, the reader was slower than the line for a whole RX buffer */
+    uint32_t overruns() { return rx_overruns; }
+
+    operator bool() { return sm_rx >= 0 || sm_tx >= 0; }
+
 protected:
     PIO pio;
-    uint sm_rx;
-    uint sm_tx;
+    PIO pio_rx;
+    PIO pio_tx;
+    int sm_rx = -1;
+    int sm_tx = -1;
     uint baud;
-    int offset;
     int peekValue = -1;
 
-    void setupRx(uint pin)
+    uint rx_size;
+    uint8_t *rx_buf = nullptr;
+    int rx_dma = -1;
+    volatile uint32_t rx_base; // bytes before the current DMA run
+    uint32_t rx_tail;
+    uint32_t rx_overruns = 0;
+
+#if SOFTSERIAL_TX_BUFFER_SIZE
+    RingBufferN<SOFTSERIAL_TX_BUFFER_SIZE> tx_ring;
+#endif
+    int tx_dma = -1;
+    volatile uint32_t tx_len = 0; // bytes in flight
+    bool tx_wait = true;
+
+    inline uint32_t rx_head() { return rx_base + ~dma_channel_hw_addr(rx_dma)->transfer_count; }
+
+    /* the DMA passed the reader: the oldest bytes are gone */
+    uint32_t rx_pending()
+    {
+        uint32_t n = rx_head() - rx_tail;
+        if (n > rx_size)
+        {
+            rx_overruns += n - rx_size;
+            rx_tail += n - rx_size;
+            n = rx_size;
+        }
+        return n;
+    }
+
+    bool setupRx(uint pin)
     {
-        pio_sm_set_consecutive_pindirs(pio, sm_rx, pin, 1, false);
-        pio_gpio_init(pio, pin);
+        int offset;
+        pio_rx = pio;
+        if (!PIORegistry::claim(&pio_uart_rx_program, &pio_rx, &sm_rx, &offset, "SoftwareSerial rx"))
+            return false;
+
+        pio_sm_set_consecutive_pindirs(pio_rx, sm_rx, pin, 1, false);
+        pio_gpio_init(pio_rx, pin);
         gpio_pull_up(pin);
 
-        int offset = pio_add_program(pio, &pio_uart_rx_program);
         pio_sm_config c = pio_uart_rx_program_get_default_config(offset);
         sm_config_set_in_pins(&c, pin); // for WAIT, IN
         sm_config_set_jmp_pin(&c, pin); // for JMP
@@ -115,19 +308,47 @@ protected:
         float div = (float)clock_get_hz(clk_sys) / (8 * baud);
         sm_config_set_clkdiv(&c, div);
 
-        pio_sm_init(pio, sm_rx, offset, &c);
-        pio_sm_set_enabled(pio, sm_rx, true);
+        pio_sm_init(pio_rx, sm_rx, offset, &c);
+        PIORegistry::movable(pio_rx, sm_rx); // the offset is not kept
+
+        // The DMA ring is aligned to its size, without a channel or memory: the FIFO
+        if (rx_size && (rx_dma = PIORegistry::claimDMA(pio_rx, sm_rx)) >= 0)
+        {
+            if ((rx_buf = (uint8_t *)memalign(rx_size, rx_size)))
+            {
+                dma_channel_config d = dma_channel_get_default_config(rx_dma);
+                channel_config_set_transfer_data_size(&d, DMA_SIZE_8);
+                channel_config_set_read_increment(&d, false);
+                channel_config_set_write_increment(&d, true);
+                channel_config_set_ring(&d, true, __builtin_ctz(rx_size));
+                channel_config_set_dreq(&d, pio_get_dreq(pio_rx, sm_rx, false));
+                rx_base = rx_tail = 0;
+                dma_channel_configure(rx_dma, &d, rx_buf, (io_rw_8 *)&pio_rx->rxf[sm_rx] + 3, 0xFFFFFFFF, true);
+            }
+            else
+            {
+                PIORegistry::releaseDMA(rx_dma);
+                rx_dma = -1;
+            }
+        }
+
+        pio_sm_set_enabled(pio_rx, sm_rx, true);
+        return true;
     }
 
-    void setupTx(uint pin_tx)
+    bool setupTx(uint pin_tx)
     {
+        int offset;
+        pio_tx = pio;
+        if (!PIORegistry::claim(&pio_uart_tx_program, &pio_tx, &sm_tx, &offset, "SoftwareSerial tx"))
+            return false;
+
         // Tell PIO to initially drive output-high on the selected pin, then map PIO
         // onto that pin with the IO muxes.
-        pio_sm_set_pins_with_mask(pio, sm_tx, 1u << pin_tx, 1u << pin_tx);
-        pio_sm_set_pindirs_with_mask(pio, sm_tx, 1u << pin_tx, 1u << pin_tx);
-        pio_gpio_init(pio, pin_tx);
+        pio_sm_set_pins_with_mask(pio_tx, sm_tx, 1u << pin_tx, 1u << pin_tx);
+        pio_sm_set_pindirs_with_mask(pio_tx, sm_tx, 1u << pin_tx, 1u << pin_tx);
+        pio_gpio_init(pio_tx, pin_tx);
 
-        int offset = pio_add_program(pio, &pio_uart_tx_program);
         pio_sm_config c = pio_uart_tx_program_get_default_config(offset);
 
         // OUT shifts to right, no autopull
@@ -146,7 +367,129 @@ protected:
         float div = (float)clock_get_hz(clk_sys) / (8 * baud);
         sm_config_set_clkdiv(&c, div);
 
-        pio_sm_init(pio, sm_tx, offset, &c);
-        pio_sm_set_enabled(pio, sm_tx, true);
+        pio_sm_init(pio_tx, sm_tx, offset, &c);
+        PIORegistry::movable(pio_tx, sm_tx);
+        pio_sm_set_enabled(pio_tx, sm_tx, true);
+
+#if SOFTSERIAL_TX_BUFFER_SIZE
+        // A byte write reaches all lanes of the FIFO, the program shifts out the low byte
+        if ((tx_dma = PIORegistry::claimDMA(pio_tx, sm_tx)) >= 0)
+        {
+            dma_channel_config d = dma_channel_get_default_config(tx_dma);
+            channel_config_set_transfer_data_size(&d, DMA_SIZE_8);
+            channel_config_set_read_increment(&d, true);
+            channel_config_set_write_increment(&d, false);
+            channel_config_set_dreq(&d, pio_get_dreq(pio_tx, sm_tx, true));
+            dma_channel_configure(tx_dma, &d, &pio_tx->txf[sm_tx], NULL, 0, false);
+        }
+#endif
+        return true;
+    }
+
+#if SOFTSERIAL_TX_BUFFER_SIZE
+    /* with the interrupts off or from the DMA interrupt */
+    void tx_kick()
+    {
+        const uint8_t *p;
+        if ((tx_len = tx_ring.peek_contiguous(&p)))
+            dma_channel_transfer_from_buffer_now(tx_dma, p, tx_len);
+    }
+#endif
+
+    // The DMA interrupt: TX piece sent, RX run of 4G bytes done
+    void isr()
+    {
+        const uint irq = SOFTSERIAL_DMA_IRQ - DMA_IRQ_0;
+        if (rx_dma >= 0 && dma_irqn_get_channel_status(irq, rx_dma))
+        {
+            dma_irqn_acknowledge_channel(irq, rx_dma);
+            rx_base += 0xFFFFFFFF; // the ring position continues
+            dma_channel_set_trans_count(rx_dma, 0xFFFFFFFF, true);
+        }
+#if SOFTSERIAL_TX_BUFFER_SIZE
+        if (tx_dma >= 0 && dma_irqn_get_channel_status(irq, tx_dma))
+        {
+            dma_irqn_acknowledge_channel(irq, tx_dma);
+            tx_ring.commit(tx_len);
+            tx_kick();
+        }
+#endif
+    }
+
+    static SoftwareSerial **instances()
+    {
+        static SoftwareSerial *stat_instances[SOFTSERIAL_MAX];
+        return stat_instances;
+    }
+
+    static void irq_handler()
+    {
+        SoftwareSerial **list = instances();
+        for (int i = 0; i < SOFTSERIAL_MAX; i++)
+            if (list[i])
+                list[i]->isr();
+    }
+
+    /* the handler is added with the first instance, on the core which calls begin() */
+    void attach()
+    {
+        const uint irq = SOFTSERIAL_DMA_IRQ - DMA_IRQ_0;
+        SoftwareSerial **list = instances();
+        bool first = true;
+        int slot = -1;
+        uint32_t save = save_and_disable_interrupts();
+        for (int i = 0; i < SOFTSERIAL_MAX; i++)
+        {
+            if (list[i])
+                first = false;
+            else if (slot < 0)
+                slot = i;
+        }
+        list[slot] = this; // one state machine each, never full
+        restore_interrupts(save);
+        if (first)
+            irq_add_shared_handler(SOFTSERIAL_DMA_IRQ, irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        if (rx_dma >= 0)
+            dma_irqn_set_channel_enabled(irq, rx_dma, true);
+        if (tx_dma >= 0)
+            dma_irqn_set_channel_enabled(irq, tx_dma, true);
+        irq_set_enabled(SOFTSERIAL_DMA_IRQ, true);
+    }
+
+    void detach()
+    {
+        const uint irq = SOFTSERIAL_DMA_IRQ - DMA_IRQ_0;
+        SoftwareSerial **list = instances();
+        bool found = false, last = true;
+        uint32_t save = save_and_disable_interrupts();
+        for (int i = 0; i < SOFTSERIAL_MAX; i++)
+        {
+            if (list[i] == this)
+            {
+                list[i] = nullptr;
+                found = true;
+            }
+            else if (list[i])
+            {
+                last = false;
+            }
+        }
+        restore_interrupts(save);
+        if (!found)
+            return;
+        if (rx_dma >= 0)
+        {
+            dma_irqn_set_channel_enabled(irq, rx_dma, false);
+            dma_channel_abort(rx_dma);
+            dma_irqn_acknowledge_channel(irq, rx_dma);
+        }
+        if (tx_dma >= 0)
+        {
+            dma_irqn_set_channel_enabled(irq, tx_dma, false);
+            dma_channel_abort(tx_dma);
+            dma_irqn_acknowledge_channel(irq, tx_dma);
+        }
+        if (last)
+            irq_remove_handler(SOFTSERIAL_DMA_IRQ, irq_handler);
     }
-};
\ No newline at end of file
+};
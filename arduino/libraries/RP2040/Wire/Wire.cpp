@@ -18,20 +18,334 @@
 
 #include <Arduino.h>
 #include "Wire.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+/*
+    Transaction engine
+
+    Every byte is one IC_DATA_CMD word ( data or read command + RESTART / STOP ), the words
+    go to the TX FIFO from the TX_EMPTY interrupt, 8 at a time. Read data comes by DMA to
+    the caller buffer ( RX_FULL interrupt without a free channel )
+
+    FILL    TX FIFO at half, more words
+    DRAIN   all words queued, TX_EMPTY at empty FIFO + last byte on the bus
+    STOP    wait STOP_DET
+    TX_ABRT ends the transaction with the NACK / abort code
+*/
+
+#define WIRE_TX_TL 8
+
+enum
+{
+    WIRE_FILL,
+    WIRE_DRAIN,
+    WIRE_STOP,
+};
+
+static TwoWire *wire_bus[2];
+static void wire0_irq(void) { wire_bus[0]->isr(); }
+static void wire1_irq(void) { wire_bus[1]->isr(); }
+
+void TwoWire::start()
+{
+    int n = i2c_hw_index(ctx);
+    i2c_hw_t *hw = i2c_get_hw(ctx);
+    wire_bus[n] = this;
+    if (_rx_dma < 0)
+        _rx_dma = dma_claim_unused_channel(false);
+    hw->intr_mask = 0;
+    hw->enable = 0;
+    hw->con |= I2C_IC_CON_RX_FIFO_FULL_HLD_CTRL_BITS; // a late interrupt holds SCL, no overflow
+    hw->enable = 1;
+    irq_set_exclusive_handler(I2C0_IRQ + n, n ? wire1_irq : wire0_irq);
+    irq_set_enabled(I2C0_IRQ + n, true);
+}
+
+void TwoWire::stop()
+{
+    int n = i2c_hw_index(ctx);
+    irq_set_enabled(I2C0_IRQ + n, false);
+    i2c_get_hw(ctx)->intr_mask = 0;
+    while (_head) // drop the queue
+        abort(_head);
+    if (_active)
+        finish(5);
+    if (_rx_dma > -1)
+    {
+        dma_channel_abort(_rx_dma);
+        dma_channel_unclaim(_rx_dma);
+        _rx_dma = -1;
+    }
+    free(_tx_buf);
+    free(_rx_buf);
+    _tx_buf = _rx_buf = NULL;
+    _tx_len = _tx_size = 0;
+    _rx_len = _rx_pos = _rx_size = 0;
+}
+
+/* start the head of the queue, interrupts off */
+void TwoWire::next()
+{
+    if (_active || !_head)
+        return;
+    WireTransfer *t = _head;
+    if (!(_head = t->next))
+        _tail = NULL;
+    _active = t;
+    _cmd = 0;
+    _phase = WIRE_FILL;
+
+    i2c_hw_t *hw = i2c_get_hw(ctx);
+    hw->enable = 0;
+    hw->tar = t->address;
+    hw->enable = 1;
+    (void)hw->clr_intr;
+
+    uint32_t mask = I2C_IC_INTR_MASK_M_TX_EMPTY_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+    uint8_t *rx = t->rx;
+    size_t rx_len = t->rx_len;
+    if (0 == t->tx_len && 0 == rx_len) // probe: one byte read
+    {
+        rx = &_probe;
+        rx_len = 1;
+    }
+    _rd = rx;
+    _rd_len = rx_len;
+    if (_rx_dma > -1)
+    {
+        dma_channel_config c = dma_channel_get_default_config(_rx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, i2c_get_dreq(ctx, false));
+        dma_channel_configure(_rx_dma, &c, rx, &hw->data_cmd, rx_len, rx_len > 0);
+    }
+    else
+    {
+        hw->rx_tl = 0;
+        mask |= I2C_IC_INTR_MASK_M_RX_FULL_BITS;
+    }
+    hw->tx_tl = WIRE_TX_TL;
+    hw->intr_mask = mask;
+}
+
+/* the active transaction is over, interrupts off */
+void TwoWire::finish(int status)
+{
+    WireTransfer *t = _active;
+    i2c_hw_t *hw = i2c_get_hw(ctx);
+    hw->intr_mask = 0;
+    if (_rx_dma > -1 && dma_channel_is_busy(_rx_dma))
+    {
+        while (hw->rxflr && dma_channel_is_busy(_rx_dma)) // the last bytes
+            tight_loop_contents();
+        if (dma_channel_is_busy(_rx_dma))
+        {
+            dma_channel_abort(_rx_dma);
+            if (0 == status)
+                status = 4;
+        }
+    }
+    while (hw->rxflr) // leftovers of an abort
+        (void)hw->data_cmd;
+    ctx->restart_on_next = 0 == status && !t->stop;
+    _active = NULL;
+    t->status = status;
+    if (t->callback)
+        t->callback(t);
+    next();
+}
+
+void TwoWire::isr()
+{
+    i2c_hw_t *hw = i2c_get_hw(ctx);
+    WireTransfer *t = _active;
+    uint32_t stat = hw->intr_stat;
+    if (NULL == t)
+    {
+        hw->intr_mask = 0;
+        return;
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS)
+    {
+        uint32_t src = hw->tx_abrt_source;
+        (void)hw->clr_tx_abrt;
+        if (src & I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS)
+            finish(2);
+        else if (src & I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS)
+            finish(3);
+        else if (src & I2C_IC_TX_ABRT_SOURCE_ABRT_USER_ABRT_BITS)
+            finish(5);
+        else
+            finish(4);
+        return;
+    }
+
+    if (_rx_dma < 0) // no DMA: read the FIFO
+    {
+        while (hw->rxflr && _rd_len)
+        {
+            *_rd++ = (uint8_t)hw->data_cmd;
+            _rd_len--;
+        }
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS)
+    {
+        (void)hw->clr_stop_det;
+        if (WIRE_STOP == _phase)
+            finish(0);
+        return;
+    }
+
+    if (0 == (stat & I2C_IC_INTR_STAT_R_TX_EMPTY_BITS))
+        return;
+
+    size_t rx_len = t->rx_len;
+    if (0 == t->tx_len && 0 == rx_len)
+        rx_len = 1; // probe
+    size_t total = t->tx_len + rx_len;
+
+    if (WIRE_FILL == _phase)
+    {
+        while (_cmd < total && hw->txflr < 16)
+        {
+            uint32_t word;
+            if (_cmd < t->tx_len)
+                word = t->tx[_cmd];
+            else
+                word = I2C_IC_DATA_CMD_CMD_BITS; // read
+            if (0 == _cmd && ctx->restart_on_next)
+                word |= I2C_IC_DATA_CMD_RESTART_BITS;
+            else if (_cmd == t->tx_len && t->tx_len) // write then read
+                word |= I2C_IC_DATA_CMD_RESTART_BITS;
+            if (_cmd == total - 1 && t->stop)
+                word |= I2C_IC_DATA_CMD_STOP_BITS;
+            hw->data_cmd = word;
+            _cmd++;
+        }
+        if (_cmd == total)
+        {
+            _phase = WIRE_DRAIN;
+            hw->tx_tl = 0;
+        }
+        return;
+    }
+
+    // DRAIN: the FIFO is empty and the last byte is on the bus
+    if (!t->stop)
+    {
+        finish(0);
+        return;
+    }
+    _phase = WIRE_STOP;
+    if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS)
+    {
+        (void)hw->clr_stop_det;
+        finish(0);
+        return;
+    }
+    hw->intr_mask = (hw->intr_mask & ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS) | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+}
+
+bool TwoWire::submit(WireTransfer *t)
+{
+    if (NULL == t || NULL == wire_bus[i2c_hw_index(ctx)])
+        return false;
+    t->status = WIRE_PENDING;
+    t->next = NULL;
+    uint32_t _prim = save_and_disable_interrupts();
+    if (_tail)
+        _tail->next = t;
+    else
+        _head = t;
+    _tail = t;
+    next();
+    restore_interrupts(_prim);
+    return true;
+}
+
+int TwoWire::wait(WireTransfer *t)
+{
+    bool aborted = false;
+    uint64_t end = time_us_64() + _timeout_us;
+    while (!t->done())
+    {
+        if (time_us_64() > end)
+        {
+            if (aborted) // the controller did not end it ( SCL held low )
+            {
+                uint32_t _prim = save_and_disable_interrupts();
+                if (t == _active)
+                    finish(5);
+                restore_interrupts(_prim);
+                break;
+            }
+            abort(t);
+            aborted = true;
+            end = time_us_64() + _timeout_us;
+        }
+        tight_loop_contents();
+    }
+    return t->status;
+}
+
+/* queued: removed, active: the controller ends it with STOP ( status 5 ) */
+void TwoWire::abort(WireTransfer *t)
+{
+    uint32_t _prim = save_and_disable_interrupts();
+    if (t == _active)
+    {
+        i2c_get_hw(ctx)->enable |= I2C_IC_ENABLE_ABORT_BITS;
+    }
+    else if (!t->done())
+    {
+        WireTransfer **pp = &_head, *prev = NULL;
+        while (*pp && *pp != t)
+        {
+            prev = *pp;
+            pp = &(*pp)->next;
+        }
+        if (*pp)
+        {
+            *pp = t->next;
+            if (_tail == t)
+                _tail = prev;
+            t->status = 5;
+        }
+    }
+    restore_interrupts(_prim);
+}
+
+bool TwoWire::grow(uint8_t **buf, size_t *size, size_t need)
+{
+    if (need <= *size)
+        return true;
+    size_t n = *size ? *size : WIRE_BUFFER_MIN;
+    while (n < need)
+        n *= 2;
+    uint8_t *p = (uint8_t *)realloc(*buf, n);
+    if (NULL == p)
+        return false;
+    *buf = p;
+    *size = n;
+    return true;
+}
 
 uint8_t TwoWire::requestFrom(uint8_t address, size_t size, bool stopBit)
 {
     _slave_address = address;
-    if (size == 0)
+    _rx_len = _rx_pos = 0;
+    if (size == 0 || !grow(&_rx_buf, &_rx_size, size))
         return 0;
-    if (!stopBit)
+    WireTransfer t(address, NULL, 0, _rx_buf, size, stopBit);
+    if (transfer(&t))
         return 0;
-    rx.clear();
-    rx._numElems = i2c_read_timeout_us(ctx, _slave_address, rx._aucBuffer, size, 0, _timeout_us);
-    if (rx._numElems < 0)
-        size = 0;
-    rx._iHead = size;
-    return rx.available();
+    _rx_len = size;
+    _rx_pos = 0;
+    return _rx_len;
 }
 
 uint8_t TwoWire::requestFrom(uint8_t address, size_t size)
@@ -42,25 +356,22 @@ uint8_t TwoWire::requestFrom(uint8_t address, size_t size)
 void TwoWire::beginTransmission(uint8_t address)
 {
     _slave_address = address;
-    tx.clear();
+    _tx_len = 0;
     transmissionBegun = true;
 }
 
+/* stopBit false: the bus is held, the next transaction starts with repeated start */
 uint8_t TwoWire::endTransmission(bool stopBit)
 {
-    if (!stopBit)
-        return 1;
-    int res;
     transmissionBegun = false;
-    int size = tx.available();
-    res = i2c_write_timeout_us(ctx, _slave_address, tx._aucBuffer, size, 1, _timeout_us);
-    //res = i2c_write_blocking(ctx, _slave_address, tx._aucBuffer, size, 1);
-    return res == size ? 0 : 4;
+    WireTransfer t(_slave_address, _tx_buf, _tx_len, NULL, 0, stopBit);
+    return transfer(&t);
     // 0:success
     // 1:data too long to fit in transmit buffer
     // 2:received NACK on transmit of address
     // 3:received NACK on transmit of data
     // 4:other error
+    // 5:timeout
 }
 
 uint8_t TwoWire::endTransmission()
@@ -70,19 +381,15 @@ uint8_t TwoWire::endTransmission()
 
 size_t TwoWire::write(uint8_t ucData)
 {
-    if (!transmissionBegun || tx.isFull())
-        return 0;
-    tx.store_char(ucData);
-    return 1;
+    return write(&ucData, 1);
 }
 
 size_t TwoWire::write(const uint8_t *data, size_t size)
 {
-    for (size_t i = 0; i < size; ++i)
-    {
-        if (!write(data[i]))
-            return i;
-    }
+    if (!transmissionBegun || !grow(&_tx_buf, &_tx_size, _tx_len + size))
+        return 0;
+    memcpy(_tx_buf + _tx_len, data, size);
+    _tx_len += size;
     return size;
 }
 
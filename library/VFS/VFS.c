@@ -21,177 +21,404 @@
 
 static vfs_file_t vfs_open_files[MAX_OPEN_FILES] = {0};
 
-typedef struct vfs_node
+/*
+    fd = FILES_FD_BASE + slot, slot is chunk[ slot / MAX_OPEN_FILES ][ slot % MAX_OPEN_FILES ]
+    Chunks are never moved, so a vfs_file_t * stays valid while the table grows
+*/
+static vfs_file_t *vfs_files_chunk[MAX_OPEN_FILES_CHUNKS] = {vfs_open_files};
+static int vfs_files_count = MAX_OPEN_FILES;
+static int vfs_free_slot;                     // slot + 1, 0: empty
+static int vfs_path_bucket[VFS_PATH_BUCKETS]; // slot + 1, 0: empty
+
+/*
+    Mount table, sorted by mount point length, longest first
+    The first prefix match is the longest one, nested mount points resolve to the inner file system
+*/
+static vfs_t *vfs_mounts[VFS_MAX_MOUNTS];
+static int vfs_mount_count;
+
+/*
+    Metadata cache, per mount
+    stat() results and the listing of the last fully read directory, valid while Fs->gen is the same
+*/
+
+struct vfs_dir_s
 {
     vfs_t *fs;
-    struct vfs_node *prev;
-    struct vfs_node *next;
-} vfs_node;
+    void *dir; // file system handle, NULL when listed from cache
+    struct vfs_listing_s *list;
+    uint32_t gen;
+    int index;
+    char *path;
+    struct dirent ent;
+};
 
-typedef struct vfs_list_s
-{
-    vfs_node *head;
-    vfs_node *tail;
-    void (*add)(struct vfs_list_s *_this, const vfs_t *fs);
-    vfs_t *(*get)(struct vfs_list_s *_this, const char *name);
-    void (*remove)(struct vfs_list_s *_this, const vfs_t *fs);
-    vfs_node *(*create_node)(const vfs_t *);
-} vfs_list_t;
+#if VFS_STAT_CACHE
 
-static vfs_list_t vfs_list;
+typedef struct vfs_meta_stat_s
+{
+    uint32_t gen; // 0: free
+    unsigned int hash;
+    mode_t mode;
+    off_t size;
+    time_t mtime;
+    char path[VFS_STAT_PATH_MAX];
+} vfs_meta_stat_t;
+
+typedef struct vfs_meta_entry_s
+{
+    mode_t mode;
+    off_t size;
+    time_t mtime;
+    char *name;
+} vfs_meta_entry_t;
 
-static inline bool is_valid_dev(const char *name)
+typedef struct vfs_listing_s
 {
-    return (name && strlen(name) >= 2 && name[1] == ':');
-}
+    int refs; // cache and open directories
+    uint32_t gen;
+    int count;
+    vfs_meta_entry_t entry[VFS_DIR_CACHE];
+    char path[];
+} vfs_listing_t;
+
+typedef struct vfs_meta_s
+{
+    vfs_meta_stat_t stat[VFS_STAT_CACHE];
+    int next; // round robin
+    vfs_listing_t *dir;
+} vfs_meta_t;
 
-static vfs_node *create_node(const vfs_t *fs)
+static vfs_listing_t *vfs_listing_new(const char *path)
 {
-    vfs_node *node = (vfs_node *)malloc(sizeof(vfs_node));
-    node->fs = (vfs_t *)fs;
-    node->prev = NULL;
-    node->next = NULL;
-    return node;
+    vfs_listing_t *list = (vfs_listing_t *)calloc(1, sizeof(vfs_listing_t) + strlen(path) + 1);
+    if (list)
+    {
+        list->refs = 1;
+        strcpy(list->path, path);
+    }
+    return list;
 }
 
-static void list_add(vfs_list_t *_this, const vfs_t *fs)
+static void vfs_listing_put(vfs_listing_t *list)
 {
-    vfs_node *newNode = _this->create_node(fs);
-    vfs_node *head = _this->head;
-    vfs_node *tail = _this->tail;
-    if (head == NULL)
-        _this->head = newNode;
-    else
+    if (list && 0 == --list->refs)
     {
-        vfs_node *lastNode = tail;
-        if (tail == NULL)
-            lastNode = head;
-        lastNode->next = newNode;
-        newNode->prev = lastNode;
-        _this->tail = newNode;
+        for (int i = 0; i < list->count; i++)
+            free(list->entry[i].name);
+        free(list);
     }
 }
 
-static vfs_t *list_get(vfs_list_t *_this, const char *name)
+static vfs_meta_t *vfs_meta(vfs_t *Fs)
+{
+    if (NULL == Fs->meta)
+        Fs->meta = calloc(1, sizeof(vfs_meta_t));
+    return (vfs_meta_t *)Fs->meta;
+}
+
+static void vfs_meta_free(vfs_t *Fs)
 {
-    if (is_valid_dev(name))
+    vfs_meta_t *meta = (vfs_meta_t *)Fs->meta;
+    if (meta)
     {
-        for (vfs_node *drive = _this->head; drive; drive = drive->next)
-            if (drive->fs->name[0] == name[0])
-                return drive->fs;
+        vfs_listing_put(meta->dir);
+        free(meta);
+        Fs->meta = NULL;
     }
-    return NULL;
 }
 
-void list_remove(vfs_list_t *_this, const vfs_t *item)
+static void vfs_meta_tostat(struct stat *st, mode_t mode, off_t size, time_t mtime)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = mode;
+    st->st_size = size;
+    st->st_mtime = mtime;
+}
+
+static bool vfs_meta_get(vfs_t *Fs, const char *rel, struct stat *st)
 {
-    vfs_node *prev;
-    vfs_node *next;
-    for (vfs_node *node = _this->head; node; node = node->next)
-        if (node->fs == item)
+    vfs_meta_t *meta = (vfs_meta_t *)Fs->meta;
+    if (NULL == meta)
+        return false;
+    unsigned int hash = strhash(rel);
+    for (int i = 0; i < VFS_STAT_CACHE; i++)
+    {
+        vfs_meta_stat_t *e = &meta->stat[i];
+        if (e->gen == Fs->gen && e->hash == hash && 0 == strcmp(e->path, rel))
         {
-            prev = node->prev;
-            next = node->next;
-            prev->next = next;
-            next->prev = prev;
-            free(node);
-            break;
+            vfs_meta_tostat(st, e->mode, e->size, e->mtime);
+            return true;
         }
+    }
+    vfs_listing_t *list = meta->dir;
+    const char *name = strrchr(rel, '/');
+    if (list && list->gen == Fs->gen && name && name[1] && strlen(list->path) == (size_t)(name - rel) && 0 == strncmp(list->path, rel, name - rel))
+    {
+        for (int i = 0; i < list->count; i++)
+            if (0 == strcmp(list->entry[i].name, name + 1))
+            {
+                vfs_meta_tostat(st, list->entry[i].mode, list->entry[i].size, list->entry[i].mtime);
+                return true;
+            }
+    }
+    return false;
 }
 
-void vfs_create_list(vfs_list_t *_this)
+static void vfs_meta_put(vfs_t *Fs, const char *rel, const struct stat *st)
 {
-    if (_this)
+    vfs_meta_t *meta;
+    if (strlen(rel) < VFS_STAT_PATH_MAX && (meta = vfs_meta(Fs)))
     {
-        _this->head = NULL;
-        _this->tail = NULL;
-        _this->add = &list_add;
-        _this->get = &list_get;
-        _this->remove = &list_remove;
-        _this->create_node = &create_node;
+        vfs_meta_stat_t *e = &meta->stat[meta->next];
+        meta->next = (meta->next + 1) % VFS_STAT_CACHE;
+        e->gen = Fs->gen;
+        e->hash = strhash(rel);
+        e->mode = st->st_mode;
+        e->size = st->st_size;
+        e->mtime = st->st_mtime;
+        strcpy(e->path, rel);
     }
 }
 
-/*
+/* Add the entry to the listing being read, stop recording if it does not fit */
+static void vfs_meta_record(vfs_dir_t *dir, const struct stat *st)
+{
+    vfs_listing_t *list = dir->list;
+    char *name;
+    if (list->count < VFS_DIR_CACHE && (name = strdup(dir->ent.d_name)))
+    {
+        vfs_meta_entry_t *e = &list->entry[list->count++];
+        e->mode = st->st_mode;
+        e->size = st->st_size;
+        e->mtime = st->st_mtime;
+        e->name = name;
+    }
+    else
+    {
+        vfs_listing_put(list);
+        dir->list = NULL;
+    }
+}
 
-*/
+/* Listing complete and nothing changed meanwhile, keep it */
+static void vfs_meta_publish(vfs_dir_t *dir)
+{
+    vfs_meta_t *meta;
+    if (dir->gen == dir->fs->gen && (meta = vfs_meta(dir->fs)))
+    {
+        vfs_listing_put(meta->dir);
+        meta->dir = dir->list;
+        meta->dir->gen = dir->gen;
+    }
+    else
+        vfs_listing_put(dir->list);
+    dir->list = NULL;
+}
 
-static vfs_t *vfs_add_fs(const char *name, const void *file_system_context)
+#else
+#define vfs_meta_free(FS)
+#endif // VFS_STAT_CACHE
+
+static inline void vfs_changed(vfs_t *Fs)
+{
+    if (0 == ++Fs->gen)
+        Fs->gen = 1;
+}
+
+/* "X:" drive or "/name" mount point, trailing '/' removed */
+static int vfs_mount_name(const char *path, char *name)
 {
-    if (vfs_list.get(&vfs_list, name))
+    int len = path ? strlen(path) : 0;
+    while (len > 1 && '/' == path[len - 1])
+        len--;
+    if (len >= VFS_NAME_MAX)
+        return -ENAMETOOLONG;
+    if (!((2 == len && ':' == path[1]) || (len && '/' == path[0])))
+        return -EINVAL;
+    memcpy(name, path, len);
+    name[len] = 0;
+    return len;
+}
+
+static int vfs_mount_find(const char *name)
+{
+    for (int i = 0; i < vfs_mount_count; i++)
+        if (0 == strcmp(vfs_mounts[i]->name, name))
+            return i;
+    return -1;
+}
+
+/* Longest mount point prefix of path, rel is the path inside the file system */
+static vfs_t *vfs_resolve(const char *path, const char **rel)
+{
+    if (path)
     {
-        goto EXIT;
+        for (int i = 0; i < vfs_mount_count; i++)
+        {
+            vfs_t *Fs = vfs_mounts[i];
+            int len = Fs->len;
+            if ('/' == Fs->name[len - 1]) // root "/"
+                len--;
+            if (0 == strncmp(path, Fs->name, len) && (0 == path[len] || '/' == path[len] || len < Fs->len))
+            {
+                if (rel)
+                    *rel = path + len;
+                return Fs;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int vfs_add_fs(const char *path, const void *file_system_context, int flags, vfs_t **added)
+{
+    char name[VFS_NAME_MAX];
+    int i, len;
+    if ((len = vfs_mount_name(path, name)) < 0)
+        return len;
+
+    vfs_t *lower = NULL;
+    if ((i = vfs_mount_find(name)) > -1)
+    {
+        if (0 == (flags & VFS_MOUNT_OVERLAY))
+            return -EEXIST;
+        lower = vfs_mounts[i];
     }
+    else if (vfs_mount_count >= VFS_MAX_MOUNTS)
+        return -ENFILE;
+
     vfs_t *fs = (vfs_t *)calloc(1, sizeof(vfs_t));
-    if (fs)
+    if (NULL == fs)
+        return -ENOMEM;
+    fs->ctx = (void *)file_system_context;
+    memcpy(fs->name, name, len + 1);
+    fs->len = len;
+    fs->flags = flags;
+    fs->lower = lower;
+    fs->gen = 1;
+
+    if (lower)
     {
-        vfs_list.add(&vfs_list, fs);
-        fs->ctx = (void*)file_system_context;
-        fs->name[0] = name[0];
-        fs->name[1] = ':';
-        fs->name[2] = 0;
-        return fs;
+        vfs_mounts[i] = fs; // on top, the lower is reached only through the overlay
     }
-EXIT:
-    return NULL;
+    else
+    {
+        for (i = vfs_mount_count; i > 0 && vfs_mounts[i - 1]->len < len; i--)
+            vfs_mounts[i] = vfs_mounts[i - 1];
+        vfs_mounts[i] = fs;
+        vfs_mount_count++;
+    }
+    *added = fs;
+    return 0;
+}
+
+static void vfs_remove_fs(vfs_t *fs)
+{
+    int i = vfs_mount_find(fs->name);
+    if (i < 0 || vfs_mounts[i] != fs)
+        return;
+    if (fs->lower)
+    {
+        vfs_mounts[i] = fs->lower;
+    }
+    else
+    {
+        for (vfs_mount_count--; i < vfs_mount_count; i++)
+            vfs_mounts[i] = vfs_mounts[i + 1];
+        vfs_mounts[vfs_mount_count] = NULL;
+    }
+    vfs_meta_free(fs);
+    free(fs);
+}
+
+static inline vfs_file_t *vfs_slot(int index)
+{
+    return &vfs_files_chunk[index / MAX_OPEN_FILES][index % MAX_OPEN_FILES];
 }
 
 static inline void vfs_clear_file(vfs_file_t *File)
 {
     if (File)
+    {
+        free(File->path);
         memset(File, 0, sizeof(vfs_file_t));
+    }
+}
+
+static void vfs_add_free_slots(int first, int count)
+{
+    for (int index = first + count - 1; index >= first; index--)
+    {
+        vfs_slot(index)->next = vfs_free_slot;
+        vfs_free_slot = index + 1;
+    }
 }
 
-static bool vfs_file_is_open(const char *path)
+static bool vfs_file_is_open(const char *path, unsigned int hash)
 {
     if (path)
     {
-        int hash = strhash(path);
-        for (int i = 0; i < MAX_OPEN_FILES; i++)
+        for (int i = vfs_path_bucket[hash & (VFS_PATH_BUCKETS - 1)]; i; i = vfs_slot(i - 1)->next)
         {
-            if (vfs_open_files[i].fd && vfs_open_files[i].file && vfs_open_files[i].hash && hash == vfs_open_files[i].hash)
+            vfs_file_t *File = vfs_slot(i - 1);
+            if (hash == File->hash && 0 == strcmp(path, File->path))
                 return true;
         }
     }
     return false;
 }
 
-static vfs_t *vfs_get_fs(const char *path, bool only_dev)
+static void vfs_path_add(int index)
 {
-    if (is_valid_dev(path))
-    {
-        if (only_dev)
-        {
-        OK:
-            return vfs_list.get(&vfs_list, path);
-        }
-        if (strlen(path) > 3 && '/' == path[2])
-            goto OK;
-    }
-    return NULL;
+    int *bucket = &vfs_path_bucket[vfs_slot(index)->hash & (VFS_PATH_BUCKETS - 1)];
+    vfs_slot(index)->next = *bucket;
+    *bucket = index + 1;
+}
+
+static void vfs_path_remove(int index)
+{
+    int *link = &vfs_path_bucket[vfs_slot(index)->hash & (VFS_PATH_BUCKETS - 1)];
+    while (*link && *link != index + 1)
+        link = &vfs_slot(*link - 1)->next;
+    if (*link)
+        *link = vfs_slot(index)->next;
 }
 
 static vfs_file_t *vfs_file_get_free_index(int *index)
 {
-    for (int i = 0; i < MAX_OPEN_FILES; i++)
+    if (0 == vfs_free_slot && vfs_files_count < MAX_OPEN_FILES * MAX_OPEN_FILES_CHUNKS)
     {
-        if (0 == vfs_open_files[i].fd)
+        vfs_file_t *chunk = (vfs_file_t *)calloc(MAX_OPEN_FILES, sizeof(vfs_file_t));
+        if (chunk)
         {
-            *index = i;
-            return &vfs_open_files[i];
+            vfs_files_chunk[vfs_files_count / MAX_OPEN_FILES] = chunk;
+            vfs_files_count += MAX_OPEN_FILES;
+            vfs_add_free_slots(vfs_files_count - MAX_OPEN_FILES, MAX_OPEN_FILES);
         }
     }
+    if (vfs_free_slot)
+    {
+        *index = vfs_free_slot - 1;
+        vfs_file_t *File = vfs_slot(*index);
+        vfs_free_slot = File->next;
+        File->next = 0;
+        return File;
+    }
     return NULL;
 }
 
-static int vfs_file_get_index(int fd)
+static void vfs_file_put_free_index(int index)
 {
-    if (fd >= FILES_FD_BASE && fd < FILES_FD_BASE + MAX_OPEN_FILES)
-    {
-        for (int index = 0; index < MAX_OPEN_FILES; index++)
-            if (vfs_open_files[index].fd == fd)
-                return index;
-    }
+    vfs_clear_file(vfs_slot(index));
+    vfs_add_free_slots(index, 1);
+}
+
+static inline int vfs_file_get_index(int fd)
+{
+    unsigned int index = fd - FILES_FD_BASE;
+    if (index < (unsigned int)vfs_files_count && vfs_slot(index)->fd == fd)
+        return index;
     return -1;
 }
 
@@ -202,13 +429,13 @@ static vfs_file_t *vfs_get_file(int fd)
     {
         return NULL;
     }
-    return &vfs_open_files[index];
+    return vfs_slot(index);
 }
 
 static bool vfs_is_file(vfs_file_t *File)
 {
     if (File)
-        return (File->fd >= FILES_FD_BASE && File->fd < FILES_FD_BASE + MAX_OPEN_FILES);
+        return (File->fd >= FILES_FD_BASE && File->fd < FILES_FD_BASE + vfs_files_count);
     return false;
 }
 
@@ -216,73 +443,102 @@ static bool vfs_is_file(vfs_file_t *File)
 
 */
 
-int vfs_mount(const char *path, const void *file_system_context)
+int vfs_mount_ex(const char *path, const void *file_system_context, int flags)
 {
     int err = -ENOENT;
     if (path && file_system_context)
     {
-        vfs_t *Fs = vfs_add_fs(path, file_system_context);
-        if (Fs && Fs->ctx)
+        vfs_t *Fs;
+        if (0 == (err = vfs_add_fs(path, file_system_context, flags, &Fs)))
         {
-            vfs_oper *op = (vfs_oper *)*(uint32_t *)Fs->ctx;
+            vfs_oper *op = *(vfs_oper **)Fs->ctx;
             if (op && op->init)
                 op->init(Fs);
             if (op && op->mount)
                 err = op->mount(Fs);
             else
                 err = -EACCES; //13
+            if (err)
+                vfs_remove_fs(Fs);
         }
-        else
-            err = -ENOMEM; //12
     }
     return err;
 }
 
+int vfs_mount(const char *path, const void *file_system_context)
+{
+    return vfs_mount_ex(path, file_system_context, 0);
+}
+
 int vfs_unmount(const char *path)
 {
-    if (path)
+    char name[VFS_NAME_MAX];
+    int i;
+    if (vfs_mount_name(path, name) < 0 || (i = vfs_mount_find(name)) < 0)
+        return -ENOENT;
+    vfs_t *Fs = vfs_mounts[i];
+    for (int index = 0; index < vfs_files_count; index++)
+        if (vfs_slot(index)->fs == Fs)
+            vfs_close(vfs_slot(index)->fd);
+    if (Fs->ctx)
     {
-        vfs_t *Fs = vfs_get_fs(path, 1);
-        if (Fs)
-        {
-            for (int index = 0; index < MAX_OPEN_FILES; index++)
-                if (vfs_open_files[index].fs == Fs)
-                    vfs_close(vfs_open_files[index].fd);
-            if (Fs->ctx)
-            {
-                vfs_oper *op = (vfs_oper *)*(uint32_t *)Fs->ctx;
-                if (op->unmount)
-                    op->unmount(Fs);
-            }
-            vfs_list.remove(&vfs_list, Fs);
-        }
+        vfs_oper *op = *(vfs_oper **)Fs->ctx;
+        if (op->unmount)
+            op->unmount(Fs);
     }
-    return -1;
+    vfs_remove_fs(Fs);
+    return 0;
+}
+
+static inline bool vfs_is_write(int flags)
+{
+    return (flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC | O_APPEND));
 }
 
 int vfs_open(const char *path, int flags, int mode)
 {
     int index, err = -1;
-    if (false == vfs_file_is_open(path))
+    unsigned int hash = strhash(path);
+    if (false == vfs_file_is_open(path, hash))
     {
+        const char *rel;
         vfs_t *Fs;
-        if ((Fs = vfs_get_fs(path, 0)))
+        if ((Fs = vfs_resolve(path, &rel)))
         {
+            if ((Fs->flags & VFS_MOUNT_RDONLY) && vfs_is_write(flags))
+                return -EROFS;
             vfs_file_t *File;
             if ((File = vfs_file_get_free_index(&index)))
             {
-                vfs_oper *op = (vfs_oper *)*(uint32_t *)Fs->ctx;
-                if (op && (File->file = op->open(Fs, path, flags, mode)))
+                vfs_oper *op = *(vfs_oper **)Fs->ctx;
+                File->file = op ? op->open(Fs, rel, flags, mode) : NULL;
+                if (NULL == File->file && Fs->lower && !vfs_is_write(flags))
+                {
+                    Fs = Fs->lower; // overlay, not in the upper
+                    op = *(vfs_oper **)Fs->ctx;
+                    File->file = op ? op->open(Fs, rel, flags, mode) : NULL;
+                }
+                if (File->file)
                 {
                     File->fs = Fs;
-                    File->hash = strhash(path);
-                    File->fd = index + 3;
-                    return File->fd;
+                    File->hash = hash;
+                    File->fd = index + FILES_FD_BASE;
+                    File->flags = flags;
+                    if (vfs_is_write(flags))
+                        vfs_changed(Fs);
+                    if ((File->path = strdup(path)))
+                    {
+                        vfs_path_add(index);
+                        return File->fd;
+                    }
+                    op->close(File);
+                    err = -ENOMEM;
                 }
+                vfs_file_put_free_index(index);
             }
             else
             {
-                vfs_clear_file(File);
+                err = -ENFILE;
             }
         }
     }
@@ -294,7 +550,7 @@ int vfs_open(const char *path, int flags, int mode)
     vfs_file_t *File = vfs_get_file(fd);                   \
     if (NULL == File || !vfs_is_file(File))                \
         goto end;                                          \
-    vfs_oper *op = (vfs_oper *)*(uint32_t *)File->fs->ctx; \
+    vfs_oper *op = *(vfs_oper **)File->fs->ctx;            \
     if (op && op->OPER)
 
 #define OPER_END() \
@@ -306,7 +562,10 @@ int vfs_close(int fd)
     IF_IS_VFS_FILE(close)
     {
         err = op->close(File);
-        vfs_clear_file(File);
+        if (vfs_is_write(File->flags))
+            vfs_changed(File->fs); // size and time are on the device now
+        vfs_path_remove(File->fd - FILES_FD_BASE);
+        vfs_file_put_free_index(File->fd - FILES_FD_BASE);
     }
     OPER_END();
 }
@@ -316,6 +575,7 @@ size_t vfs_write(int fd, const char *buf, size_t size)
     IF_IS_VFS_FILE(write)
     {
         err = op->write(File, buf, size);
+        vfs_changed(File->fs);
     }
     OPER_END();
 }
@@ -338,11 +598,307 @@ _off_t vfs_seek(int fd, _off_t where, int whence)
     OPER_END();
 }
 
+int vfs_ioctl(const char *path, int cmd, void *arg)
+{
+    int err = -ENOENT;
+    vfs_t *Fs = vfs_resolve(path, NULL);
+    if (Fs && Fs->ctx)
+    {
+        vfs_oper *op = *(vfs_oper **)Fs->ctx;
+        if (op && op->ioctl)
+            err = op->ioctl(Fs, cmd, arg);
+        else
+            err = -ENOTSUP;
+    }
+    return err;
+}
+
+/* ioctl of open file */
+int vfs_fioctl(int fd, int cmd, void *arg)
+{
+    vfs_file_t *File = vfs_get_file(fd);
+    if (NULL == File)
+        return -EBADF;
+    vfs_oper *op = *(vfs_oper **)File->fs->ctx;
+    if (NULL == op || NULL == op->fioctl)
+        return -ENOTSUP;
+    return op->fioctl(File, cmd, arg);
+}
+
+/*
+    Read only pointer to the file data at offset, no copy ( memory mapped device as XIP flash )
+    len returns the contiguous bytes from there, map again at offset + len for the next part
+*/
+const void *vfs_mmap(int fd, _off_t offset, size_t *len)
+{
+    vfs_file_t *File = vfs_get_file(fd);
+    if (NULL == File || NULL == len)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+    vfs_oper *op = *(vfs_oper **)File->fs->ctx;
+    if (NULL == op || NULL == op->mmap)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    return op->mmap(File, offset, len);
+}
+
+int vfs_fstat(int fd, struct stat *st)
+{
+    IF_IS_VFS_FILE(fstat)
+    {
+        err = st ? op->fstat(File, st) : -EINVAL;
+    }
+    OPER_END();
+}
+
+int vfs_stat(const char *path, struct stat *st)
+{
+    const char *rel;
+    vfs_t *Fs = vfs_resolve(path, &rel);
+    if (NULL == Fs || NULL == st)
+        return -ENOENT;
+#if VFS_STAT_CACHE
+    if (vfs_meta_get(Fs, rel, st))
+        return 0;
+    uint32_t gen = Fs->gen;
+#endif
+    int err = -ENOTSUP;
+    for (vfs_t *fs = Fs; fs; fs = fs->lower) // overlay: upper first
+    {
+        vfs_oper *op = *(vfs_oper **)fs->ctx;
+        if (op && op->stat && 0 == (err = op->stat(fs, rel, st)))
+            break;
+    }
+#if VFS_STAT_CACHE
+    if (0 == err && gen == Fs->gen)
+        vfs_meta_put(Fs, rel, st);
+#endif
+    return err;
+}
+
+/* Mount that can be modified, NULL and err if not */
+static vfs_t *vfs_resolve_write(const char *path, const char **rel, vfs_oper **op, int *err)
+{
+    vfs_t *Fs = vfs_resolve(path, rel);
+    *err = -ENOENT;
+    if (NULL == Fs)
+        return NULL;
+    *err = -EROFS;
+    if (Fs->flags & VFS_MOUNT_RDONLY)
+        return NULL;
+    *err = -EBUSY;
+    if (vfs_file_is_open(path, strhash(path)))
+        return NULL;
+    *op = *(vfs_oper **)Fs->ctx;
+    *err = -ENOTSUP;
+    return *op ? Fs : NULL;
+}
+
+int vfs_unlink(const char *path)
+{
+    int err;
+    const char *rel;
+    vfs_oper *op;
+    vfs_t *Fs = vfs_resolve_write(path, &rel, &op, &err);
+    if (Fs && op->unlink)
+    {
+        err = op->unlink(Fs, rel);
+        vfs_changed(Fs);
+    }
+    return err;
+}
+
+int vfs_rmdir(const char *path)
+{
+    return vfs_unlink(path);
+}
+
+int vfs_rename(const char *src, const char *dst)
+{
+    int err;
+    const char *rel_src, *rel_dst;
+    vfs_oper *op;
+    vfs_t *Fs = vfs_resolve_write(src, &rel_src, &op, &err);
+    if (Fs && op->rename)
+    {
+        if (Fs != vfs_resolve(dst, &rel_dst))
+            return -EXDEV;
+        if (vfs_file_is_open(dst, strhash(dst)))
+            return -EBUSY;
+        err = op->rename(Fs, rel_src, rel_dst);
+        vfs_changed(Fs);
+    }
+    return err;
+}
+
+int vfs_mkdir(const char *path, mode_t mode)
+{
+    int err;
+    const char *rel;
+    vfs_oper *op;
+    vfs_t *Fs = vfs_resolve_write(path, &rel, &op, &err);
+    if (Fs && op->mkdir)
+    {
+        err = op->mkdir(Fs, rel, mode);
+        vfs_changed(Fs);
+    }
+    return err;
+}
+
+static int vfs_dir_start(vfs_dir_t *dir)
+{
+    vfs_t *Fs = dir->fs;
+    dir->index = 0;
+#if VFS_STAT_CACHE
+    vfs_meta_t *meta = (vfs_meta_t *)Fs->meta;
+    if (meta && meta->dir && meta->dir->gen == Fs->gen && 0 == strcmp(meta->dir->path, dir->path))
+    {
+        dir->list = meta->dir; // no device access
+        dir->list->refs++;
+        return 0;
+    }
+    dir->gen = Fs->gen;
+    dir->list = vfs_listing_new(dir->path); // NULL: not recorded
+#endif
+    vfs_oper *op = *(vfs_oper **)Fs->ctx;
+    if (NULL == (dir->dir = op->opendir(Fs, dir->path)))
+    {
+#if VFS_STAT_CACHE
+        vfs_listing_put(dir->list);
+        dir->list = NULL;
+#endif
+        return -ENOENT;
+    }
+    return 0;
+}
+
+static void vfs_dir_stop(vfs_dir_t *dir)
+{
+    if (dir->dir)
+    {
+        vfs_oper *op = *(vfs_oper **)dir->fs->ctx;
+        if (op->closedir)
+            op->closedir(dir->fs, dir->dir);
+        dir->dir = NULL;
+    }
+#if VFS_STAT_CACHE
+    vfs_listing_put(dir->list);
+    dir->list = NULL;
+#endif
+}
+
+vfs_dir_t *vfs_opendir(const char *path)
+{
+    const char *rel;
+    vfs_t *Fs = vfs_resolve(path, &rel);
+    if (NULL == Fs)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    vfs_oper *op = *(vfs_oper **)Fs->ctx;
+    if (NULL == op || NULL == op->opendir || NULL == op->readdir)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    int len = strlen(rel);
+    while (len && '/' == rel[len - 1])
+        len--;
+    vfs_dir_t *dir = (vfs_dir_t *)calloc(1, sizeof(vfs_dir_t) + len + 1);
+    if (NULL == dir)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    dir->fs = Fs;
+    dir->path = (char *)(dir + 1);
+    memcpy(dir->path, rel, len);
+    int err = vfs_dir_start(dir);
+    if (err)
+    {
+        free(dir);
+        errno = -err;
+        return NULL;
+    }
+    return dir;
+}
+
+struct dirent *vfs_readdir(vfs_dir_t *dir)
+{
+    if (NULL == dir)
+        return NULL;
+    struct dirent *ent = &dir->ent;
+#if VFS_STAT_CACHE
+    if (NULL == dir->dir)
+    {
+        if (NULL == dir->list || dir->index >= dir->list->count)
+            return NULL;
+        vfs_meta_entry_t *e = &dir->list->entry[dir->index++];
+        ent->d_ino = dir->index;
+        ent->d_type = S_ISDIR(e->mode) ? DT_DIR : DT_REG;
+        strncpy(ent->d_name, e->name, NAME_MAX);
+        return ent;
+    }
+#endif
+    if (NULL == dir->dir)
+        return NULL;
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    vfs_oper *op = *(vfs_oper **)dir->fs->ctx;
+    if (op->readdir(dir->fs, dir->dir, ent, &st) <= 0)
+    {
+#if VFS_STAT_CACHE
+        if (dir->list)
+            vfs_meta_publish(dir);
+#endif
+        return NULL;
+    }
+    ent->d_ino = ++dir->index;
+#if VFS_STAT_CACHE
+    if (dir->list)
+        vfs_meta_record(dir, &st);
+#endif
+    return ent;
+}
+
+void vfs_rewinddir(vfs_dir_t *dir)
+{
+    if (dir)
+    {
+        vfs_dir_stop(dir);
+        vfs_dir_start(dir);
+    }
+}
+
+int vfs_closedir(vfs_dir_t *dir)
+{
+    if (NULL == dir)
+        return -EBADF;
+    vfs_dir_stop(dir);
+    free(dir);
+    return 0;
+}
+
+/* POSIX, DIR of dirent.h is vfs_dir_t ( FatFs has own DIR, dirent.h is not included ) */
+
+vfs_dir_t *opendir(const char *path) { return vfs_opendir(path); }
+
+struct dirent *readdir(vfs_dir_t *dir) { return vfs_readdir(dir); }
+
+void rewinddir(vfs_dir_t *dir) { vfs_rewinddir(dir); }
+
+int closedir(vfs_dir_t *dir) { return vfs_closedir(dir); }
+
 #pragma GCC push_options
 #pragma GCC optimize("-O0")
 static void pre_vfs_init(void)
 {
-    vfs_create_list(&vfs_list);
+    vfs_add_free_slots(0, MAX_OPEN_FILES);
 }
 PRE_INIT_FUNC(pre_vfs_init);
 #pragma GCC pop_options
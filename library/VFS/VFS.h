@@ -25,6 +25,11 @@ extern "C"
 
 #include <wizio.h>
 #include <vfs_config.h>
+#include <sys/stat.h>
+
+#define VFS_DIRENT_ONLY
+#include "dirent.h"
+#undef VFS_DIRENT_ONLY
 
 #ifdef USE_LFS
 #include <lfs.h>
@@ -36,6 +41,38 @@ extern "C"
 
 #define FILES_FD_BASE 3
 
+#ifndef MAX_OPEN_FILES_CHUNKS
+#define MAX_OPEN_FILES_CHUNKS 16 /* open files table grows by MAX_OPEN_FILES up to this many times */
+#endif
+
+#ifndef VFS_MAX_MOUNTS
+#define VFS_MAX_MOUNTS 8
+#endif
+
+#ifndef VFS_NAME_MAX
+#define VFS_NAME_MAX 16 /* mount point "/flash" or drive "F:" */
+#endif
+
+#ifndef VFS_PATH_BUCKETS
+#define VFS_PATH_BUCKETS 32 /* open path index, power of 2 */
+#endif
+
+#ifndef VFS_STAT_CACHE
+#define VFS_STAT_CACHE 8 /* stat() results per mount, 0: disable metadata cache */
+#endif
+
+#ifndef VFS_STAT_PATH_MAX
+#define VFS_STAT_PATH_MAX 48 /* longer paths are not cached */
+#endif
+
+#ifndef VFS_DIR_CACHE
+#define VFS_DIR_CACHE 32 /* entries of the last listed directory per mount */
+#endif
+
+#ifndef VFS_IO_STATS
+#define VFS_IO_STATS 1 /* count block device operations, 0: disable */
+#endif
+
     struct vfs_s;
     struct vfs_file_s;
 
@@ -51,16 +88,77 @@ extern "C"
         size_t (*write)(struct vfs_file_s *, const char *, size_t);
         size_t (*read)(struct vfs_file_s *, char *, size_t);
         _off_t (*seek)(struct vfs_file_s *, _off_t, int);
+        int (*fstat)(struct vfs_file_s *, struct stat *);
+        const void *(*mmap)(struct vfs_file_s *, _off_t, size_t *);
+        int (*fioctl)(struct vfs_file_s *, int, void *);
+
+        /* PATH */
+        int (*stat)(struct vfs_s *, const char *, struct stat *);
+        int (*unlink)(struct vfs_s *, const char *); // file or empty directory
+        int (*rename)(struct vfs_s *, const char *, const char *);
 
         /* DIR */
-        int (*mkdir)(struct vfs_file_s *, const char *, mode_t);
+        int (*mkdir)(struct vfs_s *, const char *, mode_t);
+        void *(*opendir)(struct vfs_s *, const char *);
+        int (*readdir)(struct vfs_s *, void *, struct dirent *, struct stat *); // 1: entry, 0: end
+        int (*closedir)(struct vfs_s *, void *);
+
+        /* CONTROL */
+        int (*ioctl)(struct vfs_s *, int, void *);
     } vfs_oper;
 
+    /* vfs_ioctl() commands */
+    enum
+    {
+        VFS_IOCTL_SYNC = 1,      /* write back cached data, arg: NULL                  */
+        VFS_IOCTL_CACHE_STATS,   /* arg: vfs_cache_stats_t *                           */
+        VFS_IOCTL_CACHE_RESET,   /* clear the cache counters, arg: NULL                */
+        VFS_IOCTL_PREALLOCATE,   /* fd, contiguous space for empty file, arg: _off_t * */
+        VFS_IOCTL_FASTSEEK,      /* fd, build the seek map now, arg: NULL              */
+        VFS_IOCTL_IO_STATS,      /* arg: vfs_io_stats_t *                              */
+        VFS_IOCTL_IO_RESET,      /* clear the device counters, arg: NULL               */
+    };
+
+    typedef struct vfs_cache_stats_s
+    {
+        uint32_t hits;       /* sectors served from cache          */
+        uint32_t misses;     /* sectors read from the device       */
+        uint32_t read_ahead; /* sectors prefetched by read-ahead   */
+        uint32_t writes;     /* sectors written to the cache       */
+        uint32_t write_back; /* sectors written to the device      */
+        uint32_t flushes;    /* device write calls by the cache    */
+        uint32_t evictions;  /* dirty sectors evicted by LRU       */
+    } vfs_cache_stats_t;
+
+    /* Block device operations below all caches, bytes / ops show the I/O amplification of a workload */
+    typedef struct vfs_io_stats_s
+    {
+        uint32_t reads;       /* read calls                         */
+        uint32_t read_bytes;  /*                                    */
+        uint32_t writes;      /* write / program calls              */
+        uint32_t write_bytes; /*                                    */
+        uint32_t erases;      /* erase calls                        */
+        uint32_t erase_bytes; /*                                    */
+        uint32_t syncs;       /* device flush calls                 */
+    } vfs_io_stats_t;
+
+    /* vfs_mount_ex() flags */
+    enum
+    {
+        VFS_MOUNT_RDONLY = 1,  /* refuse open for write                                        */
+        VFS_MOUNT_OVERLAY = 2, /* mount over the same mount point, reads fall through to lower */
+    };
+
     typedef struct vfs_s
     {
-        void *ctx;    // file_system_context -> vfs_oper *op;
-        char name[3]; // "A:"
-    } vfs_t;          // list
+        void *ctx;               // file_system_context -> vfs_oper *op;
+        char name[VFS_NAME_MAX]; // "/sd" or "A:"
+        uint8_t len;             // strlen( name )
+        uint8_t flags;           // VFS_MOUNT_*
+        struct vfs_s *lower;     // overlay
+        uint32_t gen;            // changes on every modification, metadata cache is valid while same
+        void *meta;              // metadata cache
+    } vfs_t;                     // mount table
 
     typedef struct vfs_file_s
     {
@@ -68,20 +166,42 @@ extern "C"
         vfs_t *fs;         // link to file_system_context
         int fd;            // real
         unsigned int hash; // path
+        char *path;        // hash collisions
+        int next;          // slot + 1, path bucket chain if open, free list if not
+        int flags;         // open
     } vfs_file_t;          // array of open files
 
     int vfs_init(void);
     int vfs_mount(const char *path, const void *file_system_context);
+    int vfs_mount_ex(const char *path, const void *file_system_context, int flags);
     int vfs_unmount(const char *path);
     int vfs_open(const char *path, int flags, int mode);
     int vfs_close(int fd);
     size_t vfs_write(int fd, const char *buf, size_t size);
     size_t vfs_read(int fd, char *buf, size_t size);
     _off_t vfs_seek(int fd, _off_t where, int whence);
+    int vfs_ioctl(const char *path, int cmd, void *arg);
+    int vfs_fioctl(int fd, int cmd, void *arg);
+
+    const void *vfs_mmap(int fd, _off_t offset, size_t *len);
+    int vfs_fstat(int fd, struct stat *st);
+    int vfs_stat(const char *path, struct stat *st);
+    int vfs_unlink(const char *path);
+    int vfs_rmdir(const char *path);
+    int vfs_rename(const char *src, const char *dst);
+    int vfs_mkdir(const char *path, mode_t mode);
+
+    typedef struct vfs_dir_s vfs_dir_t;
+    vfs_dir_t *vfs_opendir(const char *path);
+    struct dirent *vfs_readdir(vfs_dir_t *dir);
+    void vfs_rewinddir(vfs_dir_t *dir);
+    int vfs_closedir(vfs_dir_t *dir);
 
     extern unsigned int strhash(const void *p);
 
+#ifndef PRE_INIT_FUNC
 #define PRE_INIT_FUNC(F) static __attribute__((section(".preinit_array"))) void (*__##F)(void) = F
+#endif
 
 #ifdef __cplusplus
 }
@@ -28,12 +28,19 @@
 #define FFS_ERR(ERR, TXT)
 //printf("[ERROR] at line %d, %s( %d ) %s\n", __LINE__, __func__, (int)ERR, (char *)TXT);
 
+typedef struct fatfs_file_s
+{
+    FIL fil;       // must be first
+    bool clmt_off; // no seek map for this file
+} fatfs_file_t;
+
 typedef struct fatfs_context_s
 {
     vfs_oper *op; // must be first
     FATFS *fs;
     struct fatfs_config *cfg;
     void *pMutex;
+    const fatfs_diskio_t *disk;
 } fatfs_context_t;
 
 #define FATFS_FS_CTX ((fatfs_context_t *)Fs->ctx)
@@ -43,6 +50,7 @@ typedef struct fatfs_context_s
 #define FATFS_CTX ((fatfs_context_t *)File->fs->ctx)
 #define FATFS_FFS ((FATFS *)FATFS_CTX->lfs)
 #define FATFS_FILE ((FIL *)File->file)
+#define FATFS_FILE_CTX ((fatfs_file_t *)File->file)
 #define FATFS_MUTEX FATFS_CTX->pMutex
 
 static int ffs_toerror(FRESULT fr)
@@ -94,6 +102,102 @@ static int ffs_toerror(FRESULT fr)
     return -ENOTSUP;
 }
 
+#if FF_USE_FASTSEEK
+
+#if FATFS_CLMT_SLOTS
+static DWORD clmt_pool[FATFS_CLMT_SLOTS][FATFS_CLMT_ITEMS];
+static uint32_t clmt_used; /* bit per slot */
+#endif
+
+static DWORD *clmt_alloc(UINT items)
+{
+#if FATFS_CLMT_SLOTS
+    if (items <= FATFS_CLMT_ITEMS)
+        for (int i = 0; i < FATFS_CLMT_SLOTS; i++)
+            if (0 == (clmt_used & (1u << i)))
+            {
+                clmt_used |= 1u << i;
+                return clmt_pool[i];
+            }
+#endif
+    return (DWORD *)malloc(items * sizeof(DWORD));
+}
+
+static bool clmt_pooled(DWORD *tbl)
+{
+#if FATFS_CLMT_SLOTS
+    return tbl >= clmt_pool[0] && tbl < clmt_pool[FATFS_CLMT_SLOTS];
+#else
+    return false;
+#endif
+}
+
+static void clmt_free(FIL *fp)
+{
+    DWORD *tbl = fp->cltbl;
+    fp->cltbl = NULL;
+    if (NULL == tbl)
+        return;
+#if FATFS_CLMT_SLOTS
+    if (clmt_pooled(tbl))
+    {
+        clmt_used &= ~(1u << ((tbl - clmt_pool[0]) / FATFS_CLMT_ITEMS));
+        return;
+    }
+#endif
+    free(tbl);
+}
+
+/*
+    Cluster link map table: the file position is found without walking the FAT chain.
+    Tried in a pool slot first, FatFs returns the needed size if the file is more fragmented.
+    Heap tables are trimmed to the used size. Locked
+*/
+static FRESULT clmt_build(FIL *fp)
+{
+    FSIZE_t pos = f_tell(fp);
+    UINT items = FATFS_CLMT_ITEMS;
+    FRESULT res = FR_NOT_ENOUGH_CORE;
+    for (int retry = 0; retry < 2; retry++)
+    {
+        if (NULL == (fp->cltbl = clmt_alloc(items)))
+            return FR_NOT_ENOUGH_CORE;
+        fp->cltbl[0] = items;
+        if ((res = f_lseek(fp, CREATE_LINKMAP)) != FR_NOT_ENOUGH_CORE)
+            break;
+        items = fp->cltbl[0];
+        clmt_free(fp);
+        if (items > FATFS_CLMT_MAX)
+            break;
+    }
+    if (res != FR_OK)
+    {
+        clmt_free(fp);
+        return res;
+    }
+    if (!clmt_pooled(fp->cltbl) && fp->cltbl[0] < items)
+    {
+        DWORD *tbl = (DWORD *)realloc(fp->cltbl, fp->cltbl[0] * sizeof(DWORD));
+        if (tbl)
+            fp->cltbl = tbl;
+    }
+    return f_lseek(fp, pos); // sync the position to the map
+}
+
+/* Read only files larger than few clusters get the map at the first seek */
+static void clmt_auto(fatfs_file_t *file)
+{
+    FIL *fp = &file->fil;
+    if (fp->cltbl || file->clmt_off)
+        return;
+    file->clmt_off = true; // once
+    if (0 == (fp->flag & FA_WRITE) && f_size(fp) > (FSIZE_t)fp->obj.fs->csize * FF_MAX_SS * FATFS_CLMT_MIN_CLUSTERS)
+        if (clmt_build(fp) != FR_OK)
+            FFS_ERR(0, "seek map");
+}
+
+#endif // FF_USE_FASTSEEK
+
 static int ffs_tomode(int m)
 {
     int res = 0;
@@ -119,6 +223,10 @@ static int ffs_tomode(int m)
         res |= FA_CREATE_ALWAYS;
     }
     else if (m & O_APPEND)
+    {
+        res |= FA_OPEN_APPEND; /* FA_OPEN_ALWAYS and the file pointer at the end */
+    }
+    else if (m & O_CREAT)
     {
         res |= FA_OPEN_ALWAYS;
     }
@@ -129,11 +237,99 @@ static int ffs_tomode(int m)
     return res;
 }
 
+#if VFS_IO_STATS
+
+/* Counting layer on top of the block device, under the sector cache */
+
+static const fatfs_diskio_t *io_disk = &FATFS_DISKIO;
+static vfs_io_stats_t io_st;
+
+static DSTATUS io_initialize(BYTE pdrv) { return io_disk->initialize(pdrv); }
+
+static DSTATUS io_status(BYTE pdrv) { return io_disk->status(pdrv); }
+
+static DRESULT io_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    io_st.reads++;
+    io_st.read_bytes += count * FF_MAX_SS;
+    return io_disk->read(pdrv, buff, sector, count);
+}
+
+static DRESULT io_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (!io_disk->write)
+        return RES_WRPRT;
+    io_st.writes++;
+    io_st.write_bytes += count * FF_MAX_SS;
+    return io_disk->write(pdrv, buff, sector, count);
+}
+
+static DRESULT io_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    if (CTRL_SYNC == cmd)
+        io_st.syncs++;
+    else if (CTRL_ERASE_SECTOR == cmd)
+    {
+        io_st.erases++;
+        io_st.erase_bytes += (((DWORD *)buff)[1] - ((DWORD *)buff)[0] + 1) * FF_MAX_SS;
+    }
+    if (io_disk->ioctl)
+        return io_disk->ioctl(pdrv, cmd, buff);
+    return CTRL_SYNC == cmd ? RES_OK : RES_PARERR;
+}
+
+static const fatfs_diskio_t io_diskio = {
+    .initialize = io_initialize,
+    .status = io_status,
+    .read = io_read,
+    .write = io_write,
+    .ioctl = io_ioctl,
+};
+
+#endif // VFS_IO_STATS
+
+/* FatFs diskio, forwarded to the block device of the mounted context */
+
+static const fatfs_diskio_t *fatfs_disk = &FATFS_DISKIO;
+
+DSTATUS disk_initialize(BYTE pdrv) { return fatfs_disk->initialize(pdrv); }
+
+DSTATUS disk_status(BYTE pdrv) { return fatfs_disk->status(pdrv); }
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    return fatfs_disk->read(pdrv, buff, sector, count);
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (fatfs_disk->write)
+        return fatfs_disk->write(pdrv, buff, sector, count);
+    return RES_WRPRT;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    if (fatfs_disk->ioctl)
+        return fatfs_disk->ioctl(pdrv, cmd, buff);
+    return RES_PARERR;
+}
+
 static int s_fatfs_mount(vfs_t *Fs)
 {
     //FFS_LOG(0," ");
+    const fatfs_diskio_t *disk = FATFS_FS_CTX->disk ? FATFS_FS_CTX->disk : &FATFS_DISKIO;
+#if VFS_IO_STATS
+    io_disk = disk;
+    disk = &io_diskio;
+#endif
+#if FATFS_CACHE_SECTORS
+    fatfs_cache_attach(disk);
+    disk = &fatfs_cache_diskio;
+#endif
+    fatfs_disk = disk;
     MUTEX_LOCK(FATFS_FS_MUTEX);
-    FRESULT err = f_mount(FATFS_FS_FFS, Fs->name, 0);
+    FRESULT err = f_mount(FATFS_FS_FFS, "", 0);
     MUTEX_UNLOCK(FATFS_FS_MUTEX);
     return ffs_toerror(err);
 }
@@ -142,7 +338,8 @@ static int s_fatfs_unmount(vfs_t *Fs)
 {
     //FFS_LOG(0, " ");
     MUTEX_LOCK(FATFS_FS_MUTEX);
-    FRESULT err = f_unmount(Fs->name);
+    disk_ioctl(0, CTRL_SYNC, NULL);
+    FRESULT err = f_unmount("");
     MUTEX_UNLOCK(FATFS_FS_MUTEX);
     return ffs_toerror(err);
 }
@@ -150,11 +347,11 @@ static int s_fatfs_unmount(vfs_t *Fs)
 static void *s_fatfs_open(vfs_t *Fs, const char *path, int flags, int mode)
 {
     FFS_LOG(0, " ");
-    FIL *file = (FIL *)calloc(1, sizeof(FIL));
+    fatfs_file_t *file = (fatfs_file_t *)calloc(1, sizeof(fatfs_file_t));
     if (file)
     {
         MUTEX_LOCK(FATFS_FS_MUTEX);
-        if ((errno = ffs_toerror(f_open(file, path, ffs_tomode(flags)))))
+        if ((errno = ffs_toerror(f_open(&file->fil, path, ffs_tomode(flags)))))
         {
             FFS_ERR(errno, path);
             free(file);
@@ -175,6 +372,9 @@ static int s_fatfs_close(vfs_file_t *File)
     FFS_LOG(0, " ");
     MUTEX_LOCK(FATFS_MUTEX);
     FRESULT err = f_close(FATFS_FILE);
+#if FF_USE_FASTSEEK
+    clmt_free(FATFS_FILE);
+#endif
     free(FATFS_FILE);
     MUTEX_UNLOCK(FATFS_MUTEX);
     return ffs_toerror(err);
@@ -185,6 +385,10 @@ static size_t s_fatfs_write(vfs_file_t *File, const char *buf, size_t size)
     FFS_LOG(0, " ");
     MUTEX_LOCK(FATFS_MUTEX);
     unsigned wr = 0;
+#if FF_USE_FASTSEEK
+    if (FATFS_FILE->cltbl && f_tell(FATFS_FILE) + size > f_size(FATFS_FILE))
+        clmt_free(FATFS_FILE); // the file can not grow in fast seek mode
+#endif
     FRESULT err = f_write(FATFS_FILE, buf, size, &wr);
     MUTEX_UNLOCK(FATFS_MUTEX);
     if (wr)
@@ -227,6 +431,12 @@ static _off_t s_fatfs_seek(vfs_file_t *File, _off_t offset, int mode)
         return -1;
     }
     MUTEX_LOCK(FATFS_MUTEX);
+#if FF_USE_FASTSEEK
+    if (FATFS_FILE->cltbl && new_pos > f_size(FATFS_FILE))
+        clmt_free(FATFS_FILE); // seek past the end grows the file
+    else if (new_pos != f_tell(FATFS_FILE))
+        clmt_auto(FATFS_FILE_CTX);
+#endif
     FRESULT err = f_lseek(FATFS_FILE, new_pos);
     MUTEX_UNLOCK(FATFS_MUTEX);
     if (err != FR_OK)
@@ -234,6 +444,210 @@ static _off_t s_fatfs_seek(vfs_file_t *File, _off_t offset, int mode)
     return new_pos;
 }
 
+static void ffs_tostat(const FILINFO *fi, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = (fi->fattrib & AM_DIR) ? S_IFDIR | 0777 : S_IFREG | 0666;
+    if (fi->fattrib & AM_RDO)
+        st->st_mode &= ~0222;
+    st->st_size = fi->fsize;
+    struct tm tm = {
+        .tm_year = (fi->fdate >> 9) + 80,
+        .tm_mon = ((fi->fdate >> 5) & 15) - 1,
+        .tm_mday = fi->fdate & 31,
+        .tm_hour = fi->ftime >> 11,
+        .tm_min = (fi->ftime >> 5) & 63,
+        .tm_sec = (fi->ftime & 31) * 2,
+        .tm_isdst = -1,
+    };
+    st->st_mtime = mktime(&tm);
+}
+
+static inline bool ffs_is_root(const char *path)
+{
+    while ('/' == *path)
+        path++;
+    return 0 == *path;
+}
+
+static int s_fatfs_fstat(vfs_file_t *File, struct stat *st)
+{
+    FFS_LOG(0, " ");
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = S_IFREG | 0666;
+    st->st_size = f_size(FATFS_FILE);
+    return 0;
+}
+
+static int s_fatfs_stat(vfs_t *Fs, const char *path, struct stat *st)
+{
+    FFS_LOG(0, path);
+    if (ffs_is_root(path))
+    {
+        memset(st, 0, sizeof(struct stat));
+        st->st_mode = S_IFDIR | 0777;
+        return 0;
+    }
+    FILINFO fi;
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_stat(path, &fi);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    if (FR_OK == err)
+        ffs_tostat(&fi, st);
+    return ffs_toerror(err);
+}
+
+static int s_fatfs_unlink(vfs_t *Fs, const char *path)
+{
+    FFS_LOG(0, path);
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_unlink(path);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    return ffs_toerror(err);
+}
+
+static int s_fatfs_rename(vfs_t *Fs, const char *src, const char *dst)
+{
+    FFS_LOG(0, src);
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_rename(src, dst);
+    if (FR_EXIST == err && FR_OK == (err = f_unlink(dst))) // POSIX replaces
+        err = f_rename(src, dst);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    return ffs_toerror(err);
+}
+
+static int s_fatfs_mkdir(vfs_t *Fs, const char *path, mode_t mode)
+{
+    FFS_LOG(0, path);
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_mkdir(path);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    return ffs_toerror(err);
+}
+
+static void *s_fatfs_opendir(vfs_t *Fs, const char *path)
+{
+    FFS_LOG(0, path);
+    DIR *dir = (DIR *)calloc(1, sizeof(DIR));
+    if (dir)
+    {
+        MUTEX_LOCK(FATFS_FS_MUTEX);
+        if ((errno = -ffs_toerror(f_opendir(dir, path))))
+        {
+            FFS_ERR(errno, path);
+            free(dir);
+            dir = NULL;
+        }
+        MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    }
+    else
+        errno = ENOMEM;
+    return dir;
+}
+
+static int s_fatfs_readdir(vfs_t *Fs, void *dir, struct dirent *ent, struct stat *st)
+{
+    FILINFO fi;
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_readdir((DIR *)dir, &fi);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    if (FR_OK != err)
+        return ffs_toerror(err);
+    if (0 == fi.fname[0])
+        return 0; // end
+    ffs_tostat(&fi, st);
+    ent->d_type = (fi.fattrib & AM_DIR) ? DT_DIR : DT_REG;
+    strncpy(ent->d_name, fi.fname, NAME_MAX);
+    ent->d_name[NAME_MAX] = 0;
+    return 1;
+}
+
+static int s_fatfs_closedir(vfs_t *Fs, void *dir)
+{
+    MUTEX_LOCK(FATFS_FS_MUTEX);
+    FRESULT err = f_closedir((DIR *)dir);
+    MUTEX_UNLOCK(FATFS_FS_MUTEX);
+    free(dir);
+    return ffs_toerror(err);
+}
+
+static int s_fatfs_ioctl(vfs_t *Fs, int cmd, void *arg)
+{
+    FFS_LOG(cmd, " ");
+    int err = 0;
+    switch (cmd)
+    {
+    case VFS_IOCTL_SYNC:
+        MUTEX_LOCK(FATFS_FS_MUTEX);
+        if (disk_ioctl(0, CTRL_SYNC, NULL) != RES_OK)
+            err = -EIO;
+        MUTEX_UNLOCK(FATFS_FS_MUTEX);
+        break;
+#if FATFS_CACHE_SECTORS
+    case VFS_IOCTL_CACHE_STATS:
+        if (arg)
+            fatfs_cache_stats((vfs_cache_stats_t *)arg);
+        else
+            err = -EINVAL;
+        break;
+    case VFS_IOCTL_CACHE_RESET:
+        fatfs_cache_reset_stats();
+        break;
+#endif
+#if VFS_IO_STATS
+    case VFS_IOCTL_IO_STATS:
+        if (arg)
+            *(vfs_io_stats_t *)arg = io_st;
+        else
+            err = -EINVAL;
+        break;
+    case VFS_IOCTL_IO_RESET:
+        memset(&io_st, 0, sizeof(io_st));
+        break;
+#endif
+    default:
+        err = -ENOTSUP;
+    }
+    return err;
+}
+
+static int s_fatfs_fioctl(vfs_file_t *File, int cmd, void *arg)
+{
+    FFS_LOG(cmd, " ");
+    FRESULT res;
+    switch (cmd)
+    {
+#if FF_USE_EXPAND
+    case VFS_IOCTL_PREALLOCATE:
+        if (NULL == arg || *(_off_t *)arg <= 0)
+            return -EINVAL;
+        MUTEX_LOCK(FATFS_MUTEX);
+        if ((res = f_expand(FATFS_FILE, *(_off_t *)arg, 1)) == FR_OK)
+        {
+#if FF_USE_FASTSEEK
+            clmt_free(FATFS_FILE);
+            if (clmt_build(FATFS_FILE) == FR_OK) // one fragment
+                FATFS_FILE_CTX->clmt_off = true;
+#endif
+        }
+        MUTEX_UNLOCK(FATFS_MUTEX);
+        break;
+#endif
+#if FF_USE_FASTSEEK
+    case VFS_IOCTL_FASTSEEK:
+        MUTEX_LOCK(FATFS_MUTEX);
+        res = FATFS_FILE->cltbl ? FR_OK : clmt_build(FATFS_FILE);
+        FATFS_FILE_CTX->clmt_off = true;
+        MUTEX_UNLOCK(FATFS_MUTEX);
+        break;
+#endif
+    default:
+        return -ENOTSUP;
+    }
+    return ffs_toerror(res);
+}
+
 vfs_oper fatfs_oper = {
     .mount = s_fatfs_mount,
     .unmount = s_fatfs_unmount,
@@ -242,7 +656,18 @@ vfs_oper fatfs_oper = {
     .write = s_fatfs_write,
     .read = s_fatfs_read,
     .seek = s_fatfs_seek,
-    //.mkdir = s_fatfs_mkdir,
+    .fstat = s_fatfs_fstat,
+    .fioctl = s_fatfs_fioctl,
+    /* PATH */
+    .stat = s_fatfs_stat,
+    .unlink = s_fatfs_unlink,
+    .rename = s_fatfs_rename,
+    /* DIR */
+    .mkdir = s_fatfs_mkdir,
+    .opendir = s_fatfs_opendir,
+    .readdir = s_fatfs_readdir,
+    .closedir = s_fatfs_closedir,
+    .ioctl = s_fatfs_ioctl,
 };
 
 static FATFS fatfs;
@@ -250,6 +675,7 @@ static fatfs_context_t fatfs_ctx = {
     .op = &fatfs_oper,
     .fs = &fatfs,
     .pMutex = NULL,
+    .disk = &FATFS_DISKIO,
 };
 
 #endif // USE_FATFS
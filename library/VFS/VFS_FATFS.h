@@ -36,7 +36,7 @@ extern "C"
 #include <diskio.h>
 
 #ifndef FATFS_LETTER
-#define FATFS_LETTER "0:"
+#define FATFS_LETTER "0:" /* or mount point "/sd" */
 #endif
 
 #ifndef FATFS_USE_WRITE
@@ -47,10 +47,22 @@ extern "C"
 #define FATFS_USE_IOCTL 1 /* 1: Enable disk_ioctl fucntion */
 #endif
 
+#ifndef FATFS_SPI_DMA
+#define FATFS_SPI_DMA 1 /* 1: Move data blocks with DMA */
+#endif
+
+#if FATFS_SPI_DMA
+#include <hardware/dma.h>
+#endif
+
 #ifndef FATFS_SPI
 #define FATFS_SPI spi0
 #endif
 
+#ifndef FATFS_SPI_BRG
+#define FATFS_SPI_BRG 12500000u /* Hz */
+#endif
+
 #ifndef FATFS_SPI_SCK
 #define FATFS_SPI_SCK 9 /* SPI0_SCK */
 #endif
@@ -67,6 +79,85 @@ extern "C"
 #define FATFS_CS_PIN 12 /* SPI0_CSn */
 #endif
 
+/* SDIO 4-bit ( fatfs_sdio.c ) */
+
+#ifndef FATFS_SDIO_PIO
+#define FATFS_SDIO_PIO pio1 /* 31 instructions and 2 state machines */
+#endif
+
+#ifndef FATFS_SDIO_CLK
+#define FATFS_SDIO_CLK 10
+#endif
+
+#ifndef FATFS_SDIO_CMD
+#define FATFS_SDIO_CMD 11
+#endif
+
+#ifndef FATFS_SDIO_D0
+#define FATFS_SDIO_D0 12 /* D0..D3 must be consecutive */
+#endif
+
+#ifndef FATFS_SDIO_BRG
+#define FATFS_SDIO_BRG 25000000u /* Hz, default speed max */
+#endif
+
+#ifndef FATFS_SDIO_MAX_BLOCKS
+#define FATFS_SDIO_MAX_BLOCKS 32 /* Blocks per CMD18 */
+#endif
+
+/* Block device, selected at mount time */
+
+typedef struct fatfs_diskio_s
+{
+    DSTATUS (*initialize)(BYTE pdrv);
+    DSTATUS (*status)(BYTE pdrv);
+    DRESULT (*read)(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+    DRESULT (*write)(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+    DRESULT (*ioctl)(BYTE pdrv, BYTE cmd, void *buff);
+} fatfs_diskio_t;
+
+extern const fatfs_diskio_t fatfs_spi_diskio;  /* fatfs_sd.c   */
+extern const fatfs_diskio_t fatfs_sdio_diskio; /* fatfs_sdio.c */
+
+#ifndef FATFS_DISKIO
+#define FATFS_DISKIO fatfs_spi_diskio
+#endif
+
+/* Write-back sector cache between FatFs and the block device ( fatfs_cache.c ) */
+
+#ifndef FATFS_CACHE_SECTORS
+#define FATFS_CACHE_SECTORS 8 /* LRU sectors, 0: disable cache */
+#endif
+
+#ifndef FATFS_CACHE_BURST
+#define FATFS_CACHE_BURST 4 /* Sectors per read-ahead ( CMD18 ) and write-back ( CMD25 ) */
+#endif
+
+#if FATFS_CACHE_SECTORS
+extern const fatfs_diskio_t fatfs_cache_diskio;
+void fatfs_cache_attach(const fatfs_diskio_t *disk);
+void fatfs_cache_stats(vfs_cache_stats_t *stats);
+void fatfs_cache_reset_stats(void);
+#endif
+
+/* Fast seek: cluster link map of read only and preallocated files ( FF_USE_FASTSEEK ) */
+
+#ifndef FATFS_CLMT_SLOTS
+#define FATFS_CLMT_SLOTS 4 /* Pooled tables, 0: heap only */
+#endif
+
+#ifndef FATFS_CLMT_ITEMS
+#define FATFS_CLMT_ITEMS 64 /* DWORDs per pooled table, ( ITEMS - 2 ) / 2 fragments */
+#endif
+
+#ifndef FATFS_CLMT_MAX
+#define FATFS_CLMT_MAX 1024 /* DWORDs, more fragmented files follow the FAT chain */
+#endif
+
+#ifndef FATFS_CLMT_MIN_CLUSTERS
+#define FATFS_CLMT_MIN_CLUSTERS 8 /* Smaller files follow the FAT chain */
+#endif
+
 //TODO
 #define FATFS_DETECT_PIN -1
 //TODO
@@ -80,11 +171,16 @@ extern "C"
 /* MMC/SD command */
 #define CMD0 (0)           /* GO_IDLE_STATE */
 #define CMD1 (1)           /* SEND_OP_COND (MMC) */
+#define CMD2 (2)           /* ALL_SEND_CID */
+#define CMD3 (3)           /* SEND_RELATIVE_ADDR */
+#define ACMD6 (0x80 + 6)   /* SET_BUS_WIDTH (SDC) */
+#define CMD7 (7)           /* SELECT_CARD */
 #define ACMD41 (0x80 + 41) /* SEND_OP_COND (SDC) */
 #define CMD8 (8)           /* SEND_IF_COND */
 #define CMD9 (9)           /* SEND_CSD */
 #define CMD10 (10)         /* SEND_CID */
 #define CMD12 (12)         /* STOP_TRANSMISSION */
+#define CMD13 (13)         /* SEND_STATUS */
 #define ACMD13 (0x80 + 13) /* SD_STATUS (SDC) */
 #define CMD16 (16)         /* SET_BLOCKLEN */
 #define CMD17 (17)         /* READ_SINGLE_BLOCK */
@@ -28,8 +28,26 @@ typedef struct lfs_context_s
     lfs_t *lfs;
     struct lfs_config *cfg;
     void *pMutex;
+    const uint8_t *(*memory)(void); // memory mapped device, NULL if not
+#if VFS_IO_STATS
+    vfs_io_stats_t io;
+#endif
 } lfs_context_t;
 
+#if VFS_IO_STATS
+#define LFS_IO_COUNT(CFG, OP, SIZE)                           \
+    do                                                        \
+    {                                                         \
+        lfs_context_t *ctx = (lfs_context_t *)(CFG)->context; \
+        ctx->io.OP##s++;                                      \
+        ctx->io.OP##_bytes += (SIZE);                         \
+    } while (0)
+#define LFS_IO_SYNC(CFG) ((lfs_context_t *)(CFG)->context)->io.syncs++
+#else
+#define LFS_IO_COUNT(CFG, OP, SIZE)
+#define LFS_IO_SYNC(CFG)
+#endif
+
 #define LFS_FS_CTX ((lfs_context_t *)Fs->ctx)
 #define LFS_FS_LFS (lfs_t *)LFS_FS_CTX->lfs
 #define LFS_FS_CFG ((struct lfs_config *)LFS_FS_CTX->cfg)
@@ -127,9 +145,9 @@ static void *s_lfs_open(vfs_t *Fs, const char *path, int flags, int mode)
     if (file)
     {
         MUTEX_LOCK(LFS_FS_MUTEX);
-        if ((errno = lfs_toerror(lfs_file_open(LFS_FS_LFS, file, path + 3, lfs_tomode(flags)))))
+        if ((errno = lfs_toerror(lfs_file_open(LFS_FS_LFS, file, path, lfs_tomode(flags)))))
         {
-            LFS_PRINTF("[ERROR] %s( %d ) '%s'\n", __func__, errno, path + 3);
+            LFS_PRINTF("[ERROR] %s( %d ) '%s'\n", __func__, errno, path);
             free(file);
             file = NULL;
         }
@@ -178,11 +196,168 @@ static _off_t s_lfs_seek(vfs_file_t *File, _off_t where, int whence)
     return err;
 }
 
-static int s_lfs_mkdir(vfs_file_t *File, const char *name, mode_t mode)
+/* Direct pointer to the file data at offset, len is the contiguous part ( to the end of block ) */
+static const void *s_lfs_mmap(vfs_file_t *File, _off_t offset, size_t *len)
+{
+    if (NULL == LFS_CTX->memory)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    const uint8_t *ptr = NULL;
+    lfs_t *lfs = LFS_LFS;
+    lfs_file_t *file = LFS_FILE;
+    uint8_t byte;
+    errno = EINVAL;
+    MUTEX_LOCK(LFS_MUTEX);
+    lfs_soff_t pos = lfs_file_tell(lfs, file);
+    lfs_soff_t size = lfs_file_size(lfs, file);
+    if (file->flags & (LFS_F_INLINE | LFS_F_WRITING))
+    {
+        errno = (file->flags & LFS_F_INLINE) ? ENOTSUP : EBUSY; // inline data is in the metadata, written data may be in cache
+    }
+    else if (offset >= 0 && offset < size && offset == lfs_file_seek(lfs, file, offset, LFS_SEEK_SET) && 1 == lfs_file_read(lfs, file, &byte, 1))
+    {
+        /* the read found the block of offset */
+        lfs_off_t off = file->off - 1;
+        size_t n = lfs->cfg->block_size - off;
+        if (n > (size_t)(size - offset))
+            n = size - offset;
+        lfs->cfg->sync(lfs->cfg); // pending flash jobs
+        ptr = LFS_CTX->memory() + file->block * lfs->cfg->block_size + off;
+        *len = n;
+        errno = 0;
+    }
+    lfs_file_seek(lfs, file, pos, LFS_SEEK_SET);
+    MUTEX_UNLOCK(LFS_MUTEX);
+    return ptr;
+}
+
+static void lfs_tostat(const struct lfs_info *info, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = (LFS_TYPE_DIR == info->type) ? S_IFDIR | 0777 : S_IFREG | 0666;
+    st->st_size = info->size;
+}
+
+static int s_lfs_fstat(vfs_file_t *File, struct stat *st)
 {
     MUTEX_LOCK(LFS_MUTEX);
-    int err = lfs_toerror(lfs_mkdir(LFS_LFS, name));
+    int err = lfs_file_size(LFS_LFS, LFS_FILE);
     MUTEX_UNLOCK(LFS_MUTEX);
+    if (err < 0)
+        return lfs_toerror(err);
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = S_IFREG | 0666;
+    st->st_size = err;
+    return 0;
+}
+
+static int s_lfs_stat(vfs_t *Fs, const char *path, struct stat *st)
+{
+    struct lfs_info info;
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    int err = lfs_toerror(lfs_stat(LFS_FS_LFS, path, &info));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    if (0 == err)
+        lfs_tostat(&info, st);
+    return err;
+}
+
+static int s_lfs_unlink(vfs_t *Fs, const char *path)
+{
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    int err = lfs_toerror(lfs_remove(LFS_FS_LFS, path));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    return err;
+}
+
+static int s_lfs_rename(vfs_t *Fs, const char *src, const char *dst)
+{
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    int err = lfs_toerror(lfs_rename(LFS_FS_LFS, src, dst));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    return err;
+}
+
+static int s_lfs_mkdir(vfs_t *Fs, const char *path, mode_t mode)
+{
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    int err = lfs_toerror(lfs_mkdir(LFS_FS_LFS, path));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    return err;
+}
+
+static void *s_lfs_opendir(vfs_t *Fs, const char *path)
+{
+    lfs_dir_t *dir = (lfs_dir_t *)calloc(1, sizeof(lfs_dir_t));
+    if (dir)
+    {
+        MUTEX_LOCK(LFS_FS_MUTEX);
+        if ((errno = -lfs_toerror(lfs_dir_open(LFS_FS_LFS, dir, path))))
+        {
+            LFS_PRINTF("[ERROR] %s( %d ) '%s'\n", __func__, errno, path);
+            free(dir);
+            dir = NULL;
+        }
+        MUTEX_UNLOCK(LFS_FS_MUTEX);
+    }
+    else
+        errno = ENOMEM;
+    return dir;
+}
+
+static int s_lfs_readdir(vfs_t *Fs, void *dir, struct dirent *ent, struct stat *st)
+{
+    struct lfs_info info;
+    int res;
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    do
+        res = lfs_dir_read(LFS_FS_LFS, (lfs_dir_t *)dir, &info);
+    while (res > 0 && '.' == info.name[0] && (0 == info.name[1] || ('.' == info.name[1] && 0 == info.name[2])));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    if (res <= 0)
+        return lfs_toerror(res);
+    lfs_tostat(&info, st);
+    ent->d_type = (LFS_TYPE_DIR == info.type) ? DT_DIR : DT_REG;
+    strncpy(ent->d_name, info.name, NAME_MAX);
+    ent->d_name[NAME_MAX] = 0;
+    return 1;
+}
+
+static int s_lfs_closedir(vfs_t *Fs, void *dir)
+{
+    MUTEX_LOCK(LFS_FS_MUTEX);
+    int err = lfs_toerror(lfs_dir_close(LFS_FS_LFS, (lfs_dir_t *)dir));
+    MUTEX_UNLOCK(LFS_FS_MUTEX);
+    free(dir);
+    return err;
+}
+
+static int s_lfs_ioctl(vfs_t *Fs, int cmd, void *arg)
+{
+    int err = 0;
+    switch (cmd)
+    {
+    case VFS_IOCTL_SYNC:
+        MUTEX_LOCK(LFS_FS_MUTEX);
+        err = lfs_toerror(LFS_FS_CFG->sync(LFS_FS_CFG));
+        MUTEX_UNLOCK(LFS_FS_MUTEX);
+        break;
+#if VFS_IO_STATS
+    case VFS_IOCTL_IO_STATS:
+        if (arg)
+            *(vfs_io_stats_t *)arg = LFS_FS_CTX->io;
+        else
+            err = -EINVAL;
+        break;
+    case VFS_IOCTL_IO_RESET:
+        memset(&LFS_FS_CTX->io, 0, sizeof(vfs_io_stats_t));
+        break;
+#endif
+    default:
+        err = -ENOTSUP;
+    }
     return err;
 }
 
@@ -196,8 +371,18 @@ vfs_oper lfs_oper = {
     .write = s_lfs_write,
     .read = s_lfs_read,
     .seek = s_lfs_seek,
+    .fstat = s_lfs_fstat,
+    .mmap = s_lfs_mmap,
+    /* PATH */
+    .stat = s_lfs_stat,
+    .unlink = s_lfs_unlink,
+    .rename = s_lfs_rename,
     /* DIR */
-    .mkdir = s_lfs_mkdir
+    .mkdir = s_lfs_mkdir,
+    .opendir = s_lfs_opendir,
+    .readdir = s_lfs_readdir,
+    .closedir = s_lfs_closedir,
+    .ioctl = s_lfs_ioctl,
     //
 };
 
@@ -215,23 +400,30 @@ static uint8_t *lfs_ram_memory[LFS_RAM_BLOCK_SIZE * LFS_RAM_BLOCK_COUNT] __attri
 
 static int lfs_ram_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
 {
+    LFS_IO_COUNT(c, read, size);
     memcpy(buffer, lfs_ram_memory + (c->block_size * block) + off, size);
     return LFS_ERR_OK;
 }
 
 static int lfs_ram_write(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
 {
+    LFS_IO_COUNT(c, write, size);
     memcpy(lfs_ram_memory + (c->block_size * block) + off, buffer, size);
     return LFS_ERR_OK;
 }
 
 static int lfs_ram_erase(const struct lfs_config *c, lfs_block_t block)
 {
+    LFS_IO_COUNT(c, erase, c->block_size);
     memset(lfs_ram_memory + (c->block_size * block), 0, c->block_size);
     return LFS_ERR_OK;
 }
 
-static int lfs_ram_sync(const struct lfs_config *c) { return LFS_ERR_OK; }
+static int lfs_ram_sync(const struct lfs_config *c)
+{
+    LFS_IO_SYNC(c);
+    return LFS_ERR_OK;
+}
 
 /*
 
@@ -288,40 +480,140 @@ static inline uint32_t lfs_rom_memory(void)
     return ((uint32_t)&__flash_binary_end + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
 }
 
-static int lfs_rom_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+/*
+    Flash is not readable while erase or program runs, so nothing may execute from XIP:
+    interrupts are off and the other core is parked for one slice only, a page program or a sector erase.
+    Interrupts are served between the slices.
+*/
+static void __not_in_flash_func(lfs_rom_slice)(bool erase, uint32_t flash_offs, const uint8_t *data)
 {
-    memcpy(buffer, (const void *)lfs_rom_memory() + (c->block_size * block) + off, size);
-    return LFS_ERR_OK;
+#if LFS_ROM_LOCKOUT
+    multicore_lockout_start_blocking();
+#endif
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (erase)
+        flash_range_erase(flash_offs, FLASH_SECTOR_SIZE);
+    else
+        flash_range_program(flash_offs, data, FLASH_PAGE_SIZE);
+    restore_interrupts(saved_irq);
+#if LFS_ROM_LOCKOUT
+    multicore_lockout_end_blocking();
+#endif
 }
 
-static int lfs_rom_write(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+static void lfs_rom_flash(bool erase, uint32_t flash_offs, const uint8_t *data, uint32_t size)
 {
-    if (c->block_size != FLASH_SECTOR_SIZE)
-        return LFS_ERR_CORRUPT;
-    uint8_t *buf = (uint8_t *)buffer;
-    uint32_t flash_offs = lfs_rom_memory() + (c->block_size * block) - XIP_BASE;
-    LFS_PRINTF("[WRITE] ADDR = %08X\n", (int)flash_offs);
-    uint32_t saved_irq = save_and_disable_interrupts();
+    uint32_t step = erase ? FLASH_SECTOR_SIZE : FLASH_PAGE_SIZE;
+    LFS_PRINTF("[%s] ADDR = %08X  size = %d\n", erase ? "ERASE" : "WRITE", (int)flash_offs, (int)size);
+    for (; size >= step; size -= step, flash_offs += step, data += step)
+        lfs_rom_slice(erase, flash_offs, data);
+}
+
+#if defined(USE_FREERTOS) && LFS_ROM_QUEUE
+
+typedef struct lfs_rom_job_s
+{
+    bool erase;
+    uint32_t flash_offs;
+    uint32_t size;
+    uint8_t data[LFS_ROM_CACHE_SIZE];
+} lfs_rom_job_t;
+
+static QueueHandle_t lfs_rom_queue;
+static SemaphoreHandle_t lfs_rom_done;
+static volatile int lfs_rom_pending;
+
+static void lfs_rom_task(void *arg)
+{
+    static lfs_rom_job_t job;
+    while (1)
     {
-        if (off) // ?
+        if (xQueueReceive(lfs_rom_queue, &job, portMAX_DELAY))
         {
-            uint32_t len = c->block_size - off;
-            flash_range_program(flash_offs + off, buf, len);
-            flash_offs += len;
-            buf += len;
-            size -= len;
+            lfs_rom_flash(job.erase, job.flash_offs, job.data, job.size);
+            taskENTER_CRITICAL();
+            lfs_rom_pending--;
+            taskEXIT_CRITICAL();
+            xSemaphoreGive(lfs_rom_done);
         }
-        while ((int)size > 0)
+    }
+}
+
+/* Wait for the pending jobs only */
+static void lfs_rom_wait(void)
+{
+    while (lfs_rom_pending)
+        xSemaphoreTake(lfs_rom_done, portMAX_DELAY);
+}
+
+/* Queue the job, in place if the scheduler is not running yet */
+static bool lfs_rom_submit(bool erase, uint32_t flash_offs, const uint8_t *data, uint32_t size)
+{
+    static lfs_rom_job_t job; // callers hold the mount mutex
+    if ((!erase && size > sizeof(job.data)) || taskSCHEDULER_RUNNING != xTaskGetSchedulerState())
+        return false;
+    if (NULL == lfs_rom_queue)
+    {
+        if (NULL == lfs_rom_done)
+            lfs_rom_done = xSemaphoreCreateBinary();
+        QueueHandle_t queue = xQueueCreate(LFS_ROM_QUEUE, sizeof(lfs_rom_job_t));
+        if (NULL == queue || NULL == lfs_rom_done)
+            return false;
+        lfs_rom_queue = queue;
+        if (pdPASS != xTaskCreate(lfs_rom_task, "lfs_rom", configMINIMAL_STACK_SIZE + 128, NULL, LFS_ROM_TASK_PRIORITY, NULL))
         {
-            LFS_PRINTF("[WRITE] ADDR = %08X  size = %d\n", (int)flash_offs, (int)size);
-            flash_range_program(flash_offs, buf, size);
-            flash_offs += c->block_size;
-            buf += c->block_size;
-            size -= c->block_size;
+            LFS_PRINTF("[ERROR] %s() no task\n", __func__);
+            lfs_rom_queue = NULL;
+            vQueueDelete(queue);
+            return false;
         }
     }
-    restore_interrupts(saved_irq);
-    LFS_PRINTF("[WRITE] OK\n");
+    job.erase = erase;
+    job.flash_offs = flash_offs;
+    job.size = size;
+    if (!erase) // erase carries no data, only the range
+        memcpy(job.data, data, size);
+    taskENTER_CRITICAL();
+    lfs_rom_pending++;
+    taskEXIT_CRITICAL();
+    xQueueSend(lfs_rom_queue, &job, portMAX_DELAY); // blocks while full
+    return true;
+}
+
+#else
+#define lfs_rom_wait()
+#define lfs_rom_submit(ERASE, OFFS, DATA, SIZE) false
+#endif
+
+static int lfs_rom_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    lfs_rom_wait(); // the data may be still in the queue
+    LFS_IO_COUNT(c, read, size);
+    uint32_t addr = lfs_rom_memory() + (c->block_size * block) + off;
+#if LFS_ROM_BYPASS_SIZE
+    if (size >= LFS_ROM_BYPASS_SIZE) // large read goes past LittleFS cache, keep XIP cache for code
+        addr += XIP_NOCACHE_NOALLOC_BASE - XIP_BASE;
+#endif
+    memcpy(buffer, (const void *)addr, size);
+    return LFS_ERR_OK;
+}
+
+static const uint8_t *lfs_rom_map(void)
+{
+    return (const uint8_t *)lfs_rom_memory();
+}
+
+static int lfs_rom_write(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+    if (c->block_size != FLASH_SECTOR_SIZE || (off | size) & (FLASH_PAGE_SIZE - 1))
+        return LFS_ERR_CORRUPT;
+    LFS_IO_COUNT(c, write, size);
+    uint32_t flash_offs = lfs_rom_memory() + (c->block_size * block) + off - XIP_BASE;
+    if (!lfs_rom_submit(false, flash_offs, (const uint8_t *)buffer, size))
+    {
+        lfs_rom_wait(); // keep the order with the queued jobs
+        lfs_rom_flash(false, flash_offs, (const uint8_t *)buffer, size);
+    }
     return LFS_ERR_OK;
 }
 
@@ -329,18 +621,22 @@ static int lfs_rom_erase(const struct lfs_config *c, lfs_block_t block)
 {
     if (c->block_size != FLASH_SECTOR_SIZE)
         return LFS_ERR_CORRUPT;
+    LFS_IO_COUNT(c, erase, c->block_size);
     uint32_t flash_offs = lfs_rom_memory() + (c->block_size * block) - XIP_BASE;
-    LFS_PRINTF("[ERASE] PAGE ADDR = 0x%08X  size = %d\n", (int)flash_offs, (int)c->block_size);
-    uint32_t saved_irq = save_and_disable_interrupts();
+    if (!lfs_rom_submit(true, flash_offs, NULL, c->block_size))
     {
-        flash_range_erase(flash_offs, c->block_size /*4096*/);
+        lfs_rom_wait(); // keep the order with the queued jobs
+        lfs_rom_flash(true, flash_offs, NULL, c->block_size);
     }
-    restore_interrupts(saved_irq);
-    LFS_PRINTF("[ERASE] OK\n");
     return LFS_ERR_OK; // PICO_FLASH_SIZE_BYTES = 200000
 }
 
-static int lfs_rom_sync(const struct lfs_config *c) { return LFS_ERR_OK; }
+static int lfs_rom_sync(const struct lfs_config *c)
+{
+    LFS_IO_SYNC(c);
+    lfs_rom_wait();
+    return LFS_ERR_OK;
+}
 
 /*
 
@@ -369,6 +665,7 @@ static lfs_context_t lfs_rom_ctx = {
     .lfs = &lfs_rom,
     .cfg = (struct lfs_config *)&lfs_rom_cfg,
     .pMutex = NULL,
+    .memory = lfs_rom_map,
 };
 
 #pragma GCC push_options
@@ -392,6 +689,15 @@ int lfs_init(void)
 {
     int err = 0;
 
+#if defined(USE_LFS_RAM) && defined(USE_LFS_ROM) && defined(LFS_RAM_OVERLAY)
+    /* Flash at LFS_ROM_LETTER, RAM on top of it: new and rewritten files live in RAM */
+    err = vfs_mount_ex(LFS_ROM_LETTER, &lfs_rom_ctx, VFS_MOUNT_RDONLY);
+    if (0 == err)
+        err = vfs_mount_ex(LFS_ROM_LETTER, &lfs_ram_ctx, VFS_MOUNT_OVERLAY);
+    LFS_PRINTF("[LFS] %s( %d ) overlay %s\n", __func__, err, LFS_ROM_LETTER);
+    return err;
+#endif
+
 #ifdef USE_LFS_RAM
     err = vfs_mount(LFS_RAM_LETTER, &lfs_ram_ctx);
     LFS_PRINTF("[LFS] %s( %d ) disk %s\n", __func__, err, LFS_RAM_LETTER);
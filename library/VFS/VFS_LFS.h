@@ -28,9 +28,11 @@ extern "C"
     //////////////////////////////////////////////////////////////////////////////////////
 
 #ifndef LFS_RAM_LETTER
-#define LFS_RAM_LETTER "R:"
+#define LFS_RAM_LETTER "R:" /* or mount point "/ram" */
 #endif
 
+//#define LFS_RAM_OVERLAY /* Mount the RAM disk over the ROM disk at LFS_ROM_LETTER */
+
 #ifndef LFS_RAM_BLOCK_COUNT
 #define LFS_RAM_BLOCK_COUNT 128 /* Size 16k ( 128 x 128) */
 #endif
@@ -62,7 +64,7 @@ extern "C"
     //////////////////////////////////////////////////////////////////////////////////////
 
 #ifndef LFS_ROM_LETTER
-#define LFS_ROM_LETTER "F:"
+#define LFS_ROM_LETTER "F:" /* or mount point "/flash" */
 #endif
 
 #ifndef LFS_ROM_BLOCK_COUNT
@@ -91,6 +93,22 @@ extern "C"
 
 #ifndef LFS_ROM_BLOCK_CYCLES
 #define LFS_ROM_BLOCK_CYCLES 1000
+#endif
+
+#ifndef LFS_ROM_BYPASS_SIZE
+#define LFS_ROM_BYPASS_SIZE 1024 /* reads from this size do not allocate in XIP cache, 0: disable */
+#endif
+
+#ifndef LFS_ROM_QUEUE
+#define LFS_ROM_QUEUE 4 /* USE_FREERTOS: flash jobs done by a task, caller waits only on read or sync. 0: in place */
+#endif
+
+#ifndef LFS_ROM_TASK_PRIORITY
+#define LFS_ROM_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+
+#ifndef LFS_ROM_LOCKOUT
+#define LFS_ROM_LOCKOUT 0 /* 1: the other core called multicore_lockout_victim_init(), park it while flash is busy */
 #endif
 
     //#define LFS_ROM_PRE_FORMAT /* ONLY FOR TEST */
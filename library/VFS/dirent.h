@@ -0,0 +1,65 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    POSIX directory iteration over VFS ( newlib has no dirent.h for arm )
+    VFS.h takes only struct dirent, FatFs ff.h has own type DIR
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef _VFS_DIRENT_STRUCT_
+#define _VFS_DIRENT_STRUCT_
+
+#include <sys/types.h>
+
+#define DT_UNKNOWN 0
+#define DT_DIR 4
+#define DT_REG 8
+
+#ifndef NAME_MAX
+#define NAME_MAX 255
+#endif
+
+    struct dirent
+    {
+        ino_t d_ino;
+        unsigned char d_type;
+        char d_name[NAME_MAX + 1];
+    };
+
+#endif // _VFS_DIRENT_STRUCT_
+
+#if !defined(_VFS_DIRENT_H_) && !defined(VFS_DIRENT_ONLY)
+#define _VFS_DIRENT_H_
+
+    typedef struct vfs_dir_s DIR;
+
+    DIR *opendir(const char *path);
+    struct dirent *readdir(DIR *dir);
+    void rewinddir(DIR *dir);
+    int closedir(DIR *dir);
+
+#endif // _VFS_DIRENT_H_
+
+#ifdef __cplusplus
+}
+#endif
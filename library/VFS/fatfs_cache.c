@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/****************************************************************************************
+
+    Write-back sector cache for FatFs
+
+    Single sector reads and writes ( FAT, directories, file buffer ) are kept in
+    FATFS_CACHE_SECTORS lines with LRU eviction. Dirty lines are written back on
+    eviction or CTRL_SYNC, neighbour dirty sectors go out together as one CMD25.
+
+    Sequential single sector reads are prefetched FATFS_CACHE_BURST sectors at once
+    ( CMD18 ) in a separate window, so streaming a file does not flush the LRU.
+
+    Multi sector transfers go straight to the device.
+
+****************************************************************************************/
+
+#include "VFS.h"
+#ifdef USE_FATFS
+#include "VFS_FATFS.h"
+#if FATFS_CACHE_SECTORS
+
+#if FATFS_CACHE_BURST < 1
+#error "FATFS_CACHE_BURST must be at least 1"
+#endif
+
+#define CACHE_SS 512 /* FF_MAX_SS */
+
+typedef struct cache_line_s
+{
+    DWORD sector;
+    uint32_t used; /* LRU stamp */
+    bool valid;
+    bool dirty;
+} cache_line_t;
+
+static const fatfs_diskio_t *cache_disk = &FATFS_DISKIO;
+static cache_line_t cache_line[FATFS_CACHE_SECTORS];
+static BYTE cache_data[FATFS_CACHE_SECTORS][CACHE_SS] __attribute__((aligned(4)));
+static BYTE cache_burst[FATFS_CACHE_BURST][CACHE_SS] __attribute__((aligned(4)));
+static DWORD burst_sector; /* read-ahead window */
+static UINT burst_count;
+static DWORD cache_last = ~0; /* last single sector read */
+static DWORD cache_size;      /* device sectors, 0: unknown */
+static uint32_t cache_tick;
+static vfs_cache_stats_t cache_st;
+
+static int cache_find(DWORD sector)
+{
+    for (int i = 0; i < FATFS_CACHE_SECTORS; i++)
+        if (cache_line[i].valid && cache_line[i].sector == sector)
+            return i;
+    return -1;
+}
+
+static inline bool cache_is_dirty(DWORD sector, int *index)
+{
+    *index = cache_find(sector);
+    return *index > -1 && cache_line[*index].dirty;
+}
+
+static inline void burst_drop(DWORD sector, UINT count)
+{
+    if (burst_count && sector < burst_sector + burst_count && burst_sector < sector + count)
+        burst_count = 0;
+}
+
+/* Write line I together with the dirty lines next to it */
+static DRESULT cache_write_run(BYTE pdrv, int i)
+{
+    int run[FATFS_CACHE_BURST];
+    DWORD start = cache_line[i].sector;
+    UINT n = 0;
+    int k;
+
+    while (n + 1 < FATFS_CACHE_BURST && start && cache_is_dirty(start - 1, &k))
+    {
+        start--;
+        n++;
+    }
+    for (n = 0; n < FATFS_CACHE_BURST && cache_is_dirty(start + n, &k); n++)
+        run[n] = k;
+
+    DRESULT res;
+    if (n == 1)
+    {
+        res = cache_disk->write(pdrv, cache_data[run[0]], start, 1);
+    }
+    else
+    {
+        burst_count = 0; /* window is the staging buffer */
+        for (UINT j = 0; j < n; j++)
+            memcpy(cache_burst[j], cache_data[run[j]], CACHE_SS);
+        res = cache_disk->write(pdrv, cache_burst[0], start, n);
+    }
+    if (res == RES_OK)
+    {
+        for (UINT j = 0; j < n; j++)
+            cache_line[run[j]].dirty = false;
+        cache_st.write_back += n;
+        cache_st.flushes++;
+    }
+    return res;
+}
+
+static DRESULT cache_flush(BYTE pdrv)
+{
+    for (;;)
+    {
+        int low = -1; /* lowest dirty sector first, runs ascend */
+        for (int i = 0; i < FATFS_CACHE_SECTORS; i++)
+            if (cache_line[i].valid && cache_line[i].dirty && (low < 0 || cache_line[i].sector < cache_line[low].sector))
+                low = i;
+        if (low < 0)
+            return RES_OK;
+        DRESULT res = cache_write_run(pdrv, low);
+        if (res != RES_OK)
+            return res;
+    }
+}
+
+/* Free line, the LRU one is written back if dirty */
+static int cache_victim(BYTE pdrv)
+{
+    int lru = 0;
+    for (int i = 0; i < FATFS_CACHE_SECTORS; i++)
+    {
+        if (!cache_line[i].valid)
+            return i;
+        if (cache_line[i].used < cache_line[lru].used)
+            lru = i;
+    }
+    if (cache_line[lru].dirty)
+    {
+        cache_st.evictions++;
+        if (cache_write_run(pdrv, lru) != RES_OK)
+            return -1;
+    }
+    cache_line[lru].valid = false;
+    return lru;
+}
+
+static DSTATUS cache_initialize(BYTE pdrv)
+{
+    memset(cache_line, 0, sizeof(cache_line));
+    burst_count = 0;
+    cache_last = ~0;
+    cache_size = 0;
+    DSTATUS st = cache_disk->initialize(pdrv);
+    if (!(st & STA_NOINIT) && cache_disk->ioctl)
+        if (cache_disk->ioctl(pdrv, GET_SECTOR_COUNT, &cache_size) != RES_OK)
+            cache_size = 0;
+    return st;
+}
+
+static DSTATUS cache_status(BYTE pdrv)
+{
+    return cache_disk->status(pdrv);
+}
+
+static DRESULT cache_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    DRESULT res;
+    int i;
+
+    if (count > 1)
+    {
+        if ((res = cache_disk->read(pdrv, buff, sector, count)) == RES_OK)
+        {
+            for (i = 0; i < FATFS_CACHE_SECTORS; i++) /* newer than device */
+                if (cache_line[i].valid && cache_line[i].dirty && cache_line[i].sector - sector < count)
+                    memcpy(buff + (cache_line[i].sector - sector) * CACHE_SS, cache_data[i], CACHE_SS);
+            cache_st.misses += count;
+        }
+        return res;
+    }
+
+    if ((i = cache_find(sector)) > -1)
+    {
+        memcpy(buff, cache_data[i], CACHE_SS);
+        cache_line[i].used = ++cache_tick;
+        goto HIT;
+    }
+
+    if (burst_count && sector - burst_sector < burst_count)
+    {
+        memcpy(buff, cache_burst[sector - burst_sector], CACHE_SS);
+        goto HIT;
+    }
+
+    if (FATFS_CACHE_BURST > 1 && sector == cache_last + 1)
+    {
+        UINT n = FATFS_CACHE_BURST;
+        if (cache_size && sector + n > cache_size)
+            n = cache_size > sector ? cache_size - sector : 0;
+        if (n > 1)
+        {
+            if (cache_disk->read(pdrv, cache_burst[0], sector, n) == RES_OK)
+            {
+                burst_sector = sector;
+                burst_count = n;
+                for (i = 0; i < FATFS_CACHE_SECTORS; i++) /* window stays valid after write-back */
+                    if (cache_line[i].valid && cache_line[i].dirty && cache_line[i].sector - sector < n)
+                        memcpy(cache_burst[cache_line[i].sector - sector], cache_data[i], CACHE_SS);
+                memcpy(buff, cache_burst[0], CACHE_SS);
+                cache_st.read_ahead += n - 1;
+                goto MISS;
+            }
+            burst_count = 0;
+        }
+    }
+
+    if ((i = cache_victim(pdrv)) < 0)
+        return RES_ERROR;
+    if ((res = cache_disk->read(pdrv, cache_data[i], sector, 1)) != RES_OK)
+        return res;
+    cache_line[i].sector = sector;
+    cache_line[i].used = ++cache_tick;
+    cache_line[i].valid = true;
+    cache_line[i].dirty = false;
+    memcpy(buff, cache_data[i], CACHE_SS);
+
+MISS:
+    cache_st.misses++;
+    cache_last = sector;
+    return RES_OK;
+HIT:
+    cache_st.hits++;
+    cache_last = sector;
+    return RES_OK;
+}
+
+static DRESULT cache_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    DRESULT res;
+    int i;
+
+    if (!cache_disk->write)
+        return RES_WRPRT;
+
+    burst_drop(sector, count);
+
+    if (count > 1)
+    {
+        if ((res = cache_disk->write(pdrv, buff, sector, count)) == RES_OK)
+        {
+            for (i = 0; i < FATFS_CACHE_SECTORS; i++) /* now clean */
+                if (cache_line[i].valid && cache_line[i].sector - sector < count)
+                {
+                    memcpy(cache_data[i], buff + (cache_line[i].sector - sector) * CACHE_SS, CACHE_SS);
+                    cache_line[i].dirty = false;
+                }
+            cache_st.write_back += count;
+            cache_st.flushes++;
+        }
+        return res;
+    }
+
+    if ((i = cache_find(sector)) < 0)
+    {
+        if ((i = cache_victim(pdrv)) < 0)
+            return RES_ERROR;
+        cache_line[i].sector = sector;
+        cache_line[i].valid = true;
+    }
+    memcpy(cache_data[i], buff, CACHE_SS);
+    cache_line[i].dirty = true;
+    cache_line[i].used = ++cache_tick;
+    cache_st.writes++;
+    return RES_OK;
+}
+
+static DRESULT cache_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    DRESULT res;
+    switch (cmd)
+    {
+    case CTRL_SYNC:
+        if ((res = cache_flush(pdrv)) != RES_OK)
+            return res;
+        break;
+
+    case CTRL_ERASE_SECTOR:
+    {
+        DWORD st = ((DWORD *)buff)[0], ed = ((DWORD *)buff)[1];
+        for (int i = 0; i < FATFS_CACHE_SECTORS; i++)
+            if (cache_line[i].valid && cache_line[i].sector >= st && cache_line[i].sector <= ed)
+                cache_line[i].valid = false;
+        burst_drop(st, ed - st + 1);
+        break;
+    }
+    }
+    if (cache_disk->ioctl)
+        return cache_disk->ioctl(pdrv, cmd, buff);
+    return cmd == CTRL_SYNC ? RES_OK : RES_PARERR;
+}
+
+const fatfs_diskio_t fatfs_cache_diskio = {
+    .initialize = cache_initialize,
+    .status = cache_status,
+    .read = cache_read,
+    .write = cache_write,
+    .ioctl = cache_ioctl,
+};
+
+void fatfs_cache_attach(const fatfs_diskio_t *disk)
+{
+    if (disk && disk != &fatfs_cache_diskio)
+        cache_disk = disk;
+}
+
+void fatfs_cache_stats(vfs_cache_stats_t *stats)
+{
+    if (stats)
+        *stats = cache_st;
+}
+
+void fatfs_cache_reset_stats(void)
+{
+    memset(&cache_st, 0, sizeof(cache_st));
+}
+
+#endif // FATFS_CACHE_SECTORS
+#endif // USE_FATFS
@@ -61,6 +61,56 @@ static uint8_t spi_send(spi_inst_t *SPIx, uint8_t data)
 	return dst;
 }
 
+#if FATFS_SPI_DMA
+
+#ifdef USE_FREERTOS
+#define SD_DMA_YIELD() taskYIELD()
+#else
+#define SD_DMA_YIELD() tight_loop_contents()
+#endif
+
+static int sd_dma_tx = -1;
+static int sd_dma_rx = -1;
+static const uint8_t sd_dma_ff = 0xFF; /* dummy source when receiving */
+static uint8_t sd_dma_sink;			   /* dummy target when sending */
+
+static void init_dma(void)
+{
+	if (sd_dma_tx < 0)
+		sd_dma_tx = dma_claim_unused_channel(true);
+	if (sd_dma_rx < 0)
+		sd_dma_rx = dma_claim_unused_channel(true);
+}
+
+/* Start full duplex transfer: tx NULL sends 0xFF, rx NULL discards */
+static void spi_dma_start(const BYTE *tx, UINT btx, BYTE *rx, UINT btr)
+{
+	dma_channel_config c = dma_channel_get_default_config(sd_dma_rx);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_dreq(&c, spi_get_dreq(FATFS_SPI, false));
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, rx != NULL);
+	dma_channel_configure(sd_dma_rx, &c, rx ? rx : &sd_dma_sink, &spi_get_hw(FATFS_SPI)->dr, btr, false);
+
+	c = dma_channel_get_default_config(sd_dma_tx);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_dreq(&c, spi_get_dreq(FATFS_SPI, true));
+	channel_config_set_read_increment(&c, tx != NULL);
+	channel_config_set_write_increment(&c, false);
+	dma_channel_configure(sd_dma_tx, &c, &spi_get_hw(FATFS_SPI)->dr, tx ? tx : &sd_dma_ff, btx, false);
+
+	dma_start_channel_mask((1u << sd_dma_tx) | (1u << sd_dma_rx));
+}
+
+static void spi_dma_wait(void)
+{
+	/* rx is the last to finish, all bytes are clocked out when it is done */
+	while (dma_channel_is_busy(sd_dma_rx))
+		SD_DMA_YIELD();
+}
+
+#endif // FATFS_SPI_DMA
+
 static void init_spi(void)
 {
 	gpio_set_function(FATFS_SPI_MISO, GPIO_FUNC_SPI);
@@ -69,16 +119,36 @@ static void init_spi(void)
 	gpio_pull_up(FATFS_SPI_MISO);
 	spi_set_format(FATFS_SPI, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
 	spi_init(FATFS_SPI, FATFS_SPI_BRG);
+#if FATFS_SPI_DMA
+	init_dma();
+#endif
 }
 
-/* Receive multiple byte */
+/* Receive multiple byte and discard the trailing CRC */
 static void rcvr_spi_multi(
 	BYTE *buff, /* Pointer to data buffer */
 	UINT btr	/* Number of bytes to receive (even number) */
 )
 {
+#if FATFS_SPI_DMA
+	/*
+		Clock data + CRC in one DMA run, only the data is stored.
+		The two CRC bytes stay in the rx fifo ( 8 deep ) and are dropped after
+	*/
+	spi_dma_start(NULL, btr + 2, buff, btr);
+	spi_dma_wait();
+	for (int n = 2; n; n--)
+	{
+		while (!spi_is_readable(FATFS_SPI))
+			tight_loop_contents();
+		(void)spi_get_hw(FATFS_SPI)->dr;
+	}
+#else
 	/* Read multiple bytes, send 0xFF as dummy */
 	spi_read_blocking(FATFS_SPI, 0xFF, buff, btr);
+	spi_send(FATFS_SPI, 0xFF);
+	spi_send(FATFS_SPI, 0xFF); // Discard CRC
+#endif
 }
 
 #if FATFS_USE_WRITE
@@ -88,8 +158,13 @@ static void xmit_spi_multi(
 	UINT btx		  /* Number of bytes to send (even number) */
 )
 {
+#if FATFS_SPI_DMA
+	spi_dma_start(buff, btx, NULL, btx);
+	spi_dma_wait();
+#else
 	/* Write multiple bytes */
 	spi_write_blocking(FATFS_SPI, (const uint8_t *)buff, btx);
+#endif
 }
 #endif
 
@@ -166,9 +241,7 @@ static int rcvr_datablock(
 		return 0; // Function fails if invalid DataStart token or timeout
 	}
 
-	rcvr_spi_multi(buff, btr); // Store trailing data to the buffer
-	spi_send(FATFS_SPI, 0xFF);
-	spi_send(FATFS_SPI, 0xFF); // Discard CRC
+	rcvr_spi_multi(buff, btr); // Store trailing data to the buffer, discard CRC
 
 	return 1; // Function succeeded
 }
@@ -195,11 +268,13 @@ static int xmit_datablock(
 	if (token != 0xFD)
 	{							   /* Send data if token is other than StopTran */
 		xmit_spi_multi(buff, 512); /* Data */
-		spi_send(FATFS_SPI, 0xFF);
-		spi_send(FATFS_SPI, 0xFF); /* Dummy CRC */
 
-		resp = spi_send(FATFS_SPI, 0xFF); /* Receive data resp */
-		if ((resp & 0x1F) != 0x05)		  /* Function fails if the data packet was not accepted */
+		/* Dummy CRC + receive data resp in one go */
+		static const BYTE crc_resp[3] = {0xFF, 0xFF, 0xFF};
+		BYTE rx[3];
+		spi_write_read_blocking(FATFS_SPI, crc_resp, rx, 3);
+		resp = rx[2];
+		if ((resp & 0x1F) != 0x05) /* Function fails if the data packet was not accepted */
 		{
 			SD_PRINT_ERROR();
 			return 0;
@@ -242,17 +317,19 @@ static BYTE send_cmd(
 	}
 
 	/* Send command packet */
-	spi_send(FATFS_SPI, 0x40 | cmd);		/* Start + command index */
-	spi_send(FATFS_SPI, (BYTE)(arg >> 24)); /* Argument[31..24] */
-	spi_send(FATFS_SPI, (BYTE)(arg >> 16)); /* Argument[23..16] */
-	spi_send(FATFS_SPI, (BYTE)(arg >> 8));	/* Argument[15..8] */
-	spi_send(FATFS_SPI, (BYTE)arg);			/* Argument[7..0] */
-	n = 0x01;								/* Dummy CRC + Stop */
+	BYTE packet[6];
+	packet[0] = 0x40 | cmd;			/* Start + command index */
+	packet[1] = (BYTE)(arg >> 24); /* Argument[31..24] */
+	packet[2] = (BYTE)(arg >> 16); /* Argument[23..16] */
+	packet[3] = (BYTE)(arg >> 8);  /* Argument[15..8] */
+	packet[4] = (BYTE)arg;		   /* Argument[7..0] */
+	n = 0x01;					   /* Dummy CRC + Stop */
 	if (cmd == CMD0)
 		n = 0x95; /* Valid CRC for CMD0(0) */
 	if (cmd == CMD8)
 		n = 0x87; /* Valid CRC for CMD8(0x1AA) */
-	spi_send(FATFS_SPI, n);
+	packet[5] = n;
+	spi_write_blocking(FATFS_SPI, packet, sizeof(packet));
 
 	/* Receive command resp */
 	if (cmd == CMD12)
@@ -269,7 +346,7 @@ static BYTE send_cmd(
 	return res; /* Return received response */
 }
 
-DSTATUS disk_initialize(BYTE pdrv)
+static DSTATUS sd_initialize(BYTE pdrv)
 {
 	//SD_DBG(__func__);
 
@@ -391,7 +468,7 @@ DSTATUS disk_initialize(BYTE pdrv)
 /* Get Disk Status                                                       */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_status(BYTE pdrv)
+static DSTATUS sd_status(BYTE pdrv)
 {
 	//SD_DBG(__func__);
 	
@@ -418,7 +495,7 @@ DSTATUS disk_status(BYTE pdrv)
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read(
+static DRESULT sd_read(
 	BYTE pdrv,
 	BYTE *buff,	  /* Data buffer to store read data */
 	DWORD sector, /* Sector address (LBA) */
@@ -477,7 +554,7 @@ DRESULT disk_read(
 /*-----------------------------------------------------------------------*/
 
 #if FATFS_USE_WRITE
-DRESULT disk_write(
+static DRESULT sd_write(
 	BYTE pdrv,
 	const BYTE *buff, /* Data to be written */
 	DWORD sector,	  /* Sector address (LBA) */
@@ -563,7 +640,7 @@ DRESULT disk_write(
 /*-----------------------------------------------------------------------*/
 
 #if FATFS_USE_IOCTL
-DRESULT disk_ioctl(
+static DRESULT sd_ioctl(
 	BYTE pdrv,
 	BYTE cmd,  /* Control code */
 	void *buff /* Buffer to send/receive control data */
@@ -655,7 +732,7 @@ DRESULT disk_ioctl(
 	case CTRL_ERASE_SECTOR: /* Erase a block of sectors (used when _USE_ERASE == 1) */
 		if (!(FATFS_SD_CardType & CT_SDC))
 			break; /* Check if the card is SDC */
-		if (disk_ioctl(pdrv, MMC_GET_CSD, csd))
+		if (sd_ioctl(pdrv, MMC_GET_CSD, csd))
 			break; /* Get CSD */
 		if (!(csd[0] >> 6) && !(csd[10] & 0x40))
 			break; /* Check if sector erase can be applied to the card */
@@ -683,6 +760,18 @@ DRESULT disk_ioctl(
 }
 #endif
 
+const fatfs_diskio_t fatfs_spi_diskio = {
+	.initialize = sd_initialize,
+	.status = sd_status,
+	.read = sd_read,
+#if FATFS_USE_WRITE
+	.write = sd_write,
+#endif
+#if FATFS_USE_IOCTL
+	.ioctl = sd_ioctl,
+#endif
+};
+
 //Use custom get_fattime function
 //Implement RTC get time here if you need it
 DWORD get_fattime(void)
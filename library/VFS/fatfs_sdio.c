@@ -0,0 +1,724 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/****************************************************************************************
+
+    SD card in SDIO 4-bit mode ( PIO + DMA )
+
+    build_flags = -D FATFS_DISKIO=fatfs_sdio_diskio
+    Pins and PIO are FATFS_SDIO_* in VFS_FATFS.h
+
+    sdio_cmd  state machine sends commands, reads responses and drives CLK
+    sdio_data state machine moves D0..D3 nibbles, DMA moves the words
+
+    Each data line carries own CRC16, the four are checked at once as one 64-bit CRC
+    with polynomial x^64 + x^48 + x^20 + 1 over the nibble stream
+
+****************************************************************************************/
+
+#include "VFS.h"
+#ifdef USE_FATFS
+#include "VFS_FATFS.h"
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include "sdio.pio.h"
+
+#define SDIO_PRINT_ERROR()
+//printf("[ERROR] %s() at line %d\n", __func__, __LINE__)
+
+#ifdef USE_FREERTOS
+#define SDIO_YIELD() taskYIELD()
+#else
+#define SDIO_YIELD() tight_loop_contents()
+#endif
+
+#define SDIO_PIO FATFS_SDIO_PIO
+#define SDIO_BLOCK_WORDS (512 / 4)
+#define SDIO_TX_BITS 64                            /* 16 idle + 48 command bits */
+#define SDIO_TX_NIBBLES (8 + 1024 + 16 + 2)         /* 7 idle + start, data, CRC, end + hold */
+/*
+    Last tx word: nibbles 0xF, 0xF are the end bit and D0..D3 held high, the rest stays in OSR.
+    After those 8 bits are shifted out OSR is 0x100, rx takes it as count: far more nibbles
+    than the first pushed word ( CRC status token + busy ), sdio_write_wait() stops the sm there
+*/
+#define SDIO_TX_END 0xFF000001
+#define SDIO_STATUS_BIT(W, N) (((W) >> (28 - 4 * (N))) & 1) /* D0 of nibble N */
+
+enum
+{
+    SDIO_NONE = 0,
+    SDIO_R1,  /* 48 bits, index + CRC      */
+    SDIO_R1B, /* R1 + busy on D0           */
+    SDIO_R2,  /* 136 bits, CID / CSD       */
+    SDIO_R3,  /* 48 bits, OCR without CRC  */
+};
+
+static volatile DSTATUS SDIO_Stat = STA_NOINIT;
+static BYTE SDIO_CardType;
+static uint32_t SDIO_RCA;
+static BYTE SDIO_CSD[16];
+
+static PIO sdio_pio = SDIO_PIO;
+static int sdio_sm_cmd = -1;
+static int sdio_sm_data = -1;
+static uint sdio_cmd_offset;
+static uint sdio_data_offset;
+static pio_sm_config sdio_cfg_cmd;
+static pio_sm_config sdio_cfg_data;
+static int sdio_dma_data = -1;
+static int sdio_dma_ctrl = -1;
+
+/* DMA control blocks ( write address, count ) and received CRC, double buffered */
+static uint32_t sdio_ctrl_blocks[2][4 * FATFS_SDIO_MAX_BLOCKS + 2];
+static uint32_t sdio_crc[2][2 * FATFS_SDIO_MAX_BLOCKS];
+static uint32_t sdio_tail[3];
+static uint32_t sdio_bounce[SDIO_BLOCK_WORDS]; /* for buffers not aligned to word */
+
+static uint16_t sdio_data_instructions[count_of(sdio_data_program_instructions)];
+
+/*-----------------------------------------------------------------------*/
+/* CRC                                                                   */
+/*-----------------------------------------------------------------------*/
+
+static uint8_t sdio_crc7(const BYTE *data, int len)
+{
+    uint8_t crc = 0;
+    while (len--)
+    {
+        uint8_t d = *data++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc <<= 1;
+            if ((d ^ crc) & 0x80)
+                crc ^= 0x09;
+            d <<= 1;
+        }
+    }
+    return crc & 0x7F;
+}
+
+/* CRC16 of D0..D3 interleaved, 16 bits per step */
+static uint64_t sdio_crc16(const BYTE *data, UINT len)
+{
+    uint64_t crc = 0;
+    for (UINT i = 0; i < len; i += 2)
+    {
+        uint64_t t = (crc >> 48) ^ ((uint32_t)data[i] << 8 | data[i + 1]);
+        crc = (crc << 16) ^ (t << 48) ^ (t << 20) ^ t;
+    }
+    return crc;
+}
+
+/*-----------------------------------------------------------------------*/
+/* PIO                                                                   */
+/*-----------------------------------------------------------------------*/
+
+static void sdio_cmd_reset(void)
+{
+    pio_sm_init(sdio_pio, sdio_sm_cmd, sdio_cmd_offset, &sdio_cfg_cmd);
+    pio_sm_set_consecutive_pindirs(sdio_pio, sdio_sm_cmd, FATFS_SDIO_CMD, 1, false);
+    pio_sm_set_enabled(sdio_pio, sdio_sm_cmd, true);
+}
+
+static void sdio_data_stop(void)
+{
+    pio_sm_set_enabled(sdio_pio, sdio_sm_data, false);
+    dma_channel_abort(sdio_dma_ctrl);
+    dma_channel_abort(sdio_dma_data);
+    pio_sm_set_consecutive_pindirs(sdio_pio, sdio_sm_data, FATFS_SDIO_D0, 4, false);
+}
+
+static void sdio_set_clock(uint32_t hz)
+{
+    float div = (float)clock_get_hz(clk_sys) / (2.0f * hz); /* one instruction is half period */
+    sm_config_set_clkdiv(&sdio_cfg_cmd, div < 1.0f ? 1.0f : div);
+    sdio_cmd_reset();
+}
+
+static void sdio_init_pio(void)
+{
+    if (sdio_sm_cmd > -1)
+        return;
+
+    /* wait gpio 0 -> wait gpio CLK */
+    for (int i = 0; i < count_of(sdio_data_instructions); i++)
+    {
+        uint16_t insn = sdio_data_program_instructions[i];
+        if ((insn & 0xE060) == 0x2000)
+            insn |= FATFS_SDIO_CLK;
+        sdio_data_instructions[i] = insn;
+    }
+    const pio_program_t data_program = {
+        .instructions = sdio_data_instructions,
+        .length = count_of(sdio_data_instructions),
+        .origin = -1,
+    };
+    sdio_data_offset = pio_add_program(sdio_pio, &data_program);
+    sdio_cmd_offset = pio_add_program(sdio_pio, &sdio_cmd_program);
+    sdio_sm_cmd = pio_claim_unused_sm(sdio_pio, true);
+    sdio_sm_data = pio_claim_unused_sm(sdio_pio, true);
+    sdio_dma_data = dma_claim_unused_channel(true);
+    sdio_dma_ctrl = dma_claim_unused_channel(true);
+
+    pio_gpio_init(sdio_pio, FATFS_SDIO_CLK);
+    pio_gpio_init(sdio_pio, FATFS_SDIO_CMD);
+    gpio_pull_up(FATFS_SDIO_CMD);
+    for (int i = 0; i < 4; i++)
+    {
+        pio_gpio_init(sdio_pio, FATFS_SDIO_D0 + i);
+        gpio_pull_up(FATFS_SDIO_D0 + i);
+    }
+    pio_sm_set_pins_with_mask(sdio_pio, sdio_sm_cmd, 1u << FATFS_SDIO_CMD, (1u << FATFS_SDIO_CMD) | (1u << FATFS_SDIO_CLK));
+    pio_sm_set_pindirs_with_mask(sdio_pio, sdio_sm_cmd, 1u << FATFS_SDIO_CLK, (1u << FATFS_SDIO_CMD) | (1u << FATFS_SDIO_CLK));
+    pio_sm_set_pins_with_mask(sdio_pio, sdio_sm_data, 0xFu << FATFS_SDIO_D0, 0xFu << FATFS_SDIO_D0);
+    pio_sm_set_consecutive_pindirs(sdio_pio, sdio_sm_data, FATFS_SDIO_D0, 4, false);
+
+    pio_sm_config c = sdio_cmd_program_get_default_config(sdio_cmd_offset);
+    sm_config_set_sideset_pins(&c, FATFS_SDIO_CLK);
+    sm_config_set_out_pins(&c, FATFS_SDIO_CMD, 1);
+    sm_config_set_set_pins(&c, FATFS_SDIO_CMD, 1);
+    sm_config_set_in_pins(&c, FATFS_SDIO_CMD);
+    sm_config_set_jmp_pin(&c, FATFS_SDIO_CMD);
+    sm_config_set_out_shift(&c, false, true, 32);
+    sm_config_set_in_shift(&c, false, true, 32);
+    sm_config_set_mov_status(&c, STATUS_TX_LESSTHAN, 1);
+    sdio_cfg_cmd = c;
+
+    c = sdio_data_program_get_default_config(sdio_data_offset);
+    sm_config_set_out_pins(&c, FATFS_SDIO_D0, 4);
+    sm_config_set_set_pins(&c, FATFS_SDIO_D0, 4);
+    sm_config_set_in_pins(&c, FATFS_SDIO_D0);
+    sm_config_set_jmp_pin(&c, FATFS_SDIO_D0);
+    sm_config_set_out_shift(&c, false, true, 32);
+    sm_config_set_in_shift(&c, false, true, 32);
+    sdio_cfg_data = c;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Command                                                               */
+/*-----------------------------------------------------------------------*/
+
+/* 1:Ready, 0:Timeout */
+static int sdio_wait_ready(UINT wt /* Timeout [ms] */)
+{
+    absolute_time_t timeout_time = make_timeout_time_ms(wt);
+    while (!gpio_get(FATFS_SDIO_D0)) /* D0 low is busy, CLK is running */
+    {
+        if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time))
+        {
+            SDIO_PRINT_ERROR();
+            return 0;
+        }
+        SDIO_YIELD();
+    }
+    return 1;
+}
+
+/* Response bit K of the captured stream ( start bit is not captured ) */
+static inline int sdio_resp_bit(const uint32_t *w, int k)
+{
+    return (w[k >> 5] >> (31 - (k & 31))) & 1;
+}
+
+/* 0:OK, resp is 32 bits card status / OCR or 16 bytes CID / CSD */
+static int sdio_cmd(BYTE cmd, DWORD arg, int type, void *resp)
+{
+    static const uint8_t rx_words[] = {0, 2, 2, 5, 2};
+    uint32_t w[5];
+    BYTE p[6];
+
+    if (cmd & 0x80)
+    { /* CMD55 prior to ACMD<n> */
+        cmd &= 0x7F;
+        if (sdio_cmd(CMD55, SDIO_RCA << 16, SDIO_R1, NULL))
+            return -1;
+    }
+
+    p[0] = 0x40 | cmd;
+    p[1] = (BYTE)(arg >> 24);
+    p[2] = (BYTE)(arg >> 16);
+    p[3] = (BYTE)(arg >> 8);
+    p[4] = (BYTE)arg;
+    p[5] = (sdio_crc7(p, 5) << 1) | 1;
+
+    int n = rx_words[type];
+    pio_sm_put(sdio_pio, sdio_sm_cmd, (SDIO_TX_BITS - 1) << 16 | (n ? n * 32 - 1 : 0));
+    pio_sm_put(sdio_pio, sdio_sm_cmd, 0xFFFF0000 | p[0] << 8 | p[1]);
+    pio_sm_put(sdio_pio, sdio_sm_cmd, p[2] << 24 | p[3] << 16 | p[4] << 8 | p[5]);
+
+    absolute_time_t timeout_time = make_timeout_time_ms(10);
+    if (SDIO_NONE == type)
+    {
+        /* wait back in idle loop */
+        while (!pio_sm_is_tx_fifo_empty(sdio_pio, sdio_sm_cmd) || pio_sm_get_pc(sdio_pio, sdio_sm_cmd) > sdio_cmd_offset + 1)
+            if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time))
+                goto ERROR;
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        while (pio_sm_is_rx_fifo_empty(sdio_pio, sdio_sm_cmd))
+            if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time))
+                goto ERROR; /* no response */
+        w[i] = pio_sm_get(sdio_pio, sdio_sm_cmd);
+    }
+
+    if (SDIO_R2 == type)
+    {
+        /* 7 bits transmission + reserved, then 128 bits register */
+        if (resp)
+            for (int i = 0; i < 16; i++)
+            {
+                BYTE b = 0;
+                for (int k = 0; k < 8; k++)
+                    b = (b << 1) | sdio_resp_bit(w, 7 + 8 * i + k);
+                ((BYTE *)resp)[i] = b;
+            }
+        return 0;
+    }
+
+    /* 47 bits after start bit */
+    uint64_t r = ((uint64_t)w[0] << 32 | w[1]) >> 17;
+    for (int i = 0; i < 5; i++)
+        p[i] = (BYTE)(r >> (40 - 8 * i));
+    if (SDIO_R3 != type)
+    {
+        if ((p[0] & 0x3F) != cmd || sdio_crc7(p, 5) != ((r >> 1) & 0x7F))
+            goto ERROR;
+    }
+    if (resp)
+        *(uint32_t *)resp = (uint32_t)(r >> 8);
+    if (SDIO_R1B == type && !sdio_wait_ready(500))
+        return -1;
+    return 0;
+
+ERROR:
+    SDIO_PRINT_ERROR();
+    sdio_cmd_reset();
+    return -1;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Data                                                                  */
+/*-----------------------------------------------------------------------*/
+
+/*
+    Receive COUNT blocks of WORDS each
+    The control channel loads the data channel with ( address, count ) pairs:
+    block 0, CRC 0, block 1, CRC 1 ... and a null trigger to stop
+*/
+static void sdio_read_start(int set, BYTE *buff, UINT count, UINT words)
+{
+    uint32_t *cb = sdio_ctrl_blocks[set];
+    for (UINT i = 0; i < count; i++)
+    {
+        *cb++ = (uint32_t)(buff + i * words * 4);
+        *cb++ = words;
+        *cb++ = (uint32_t)&sdio_crc[set][2 * i];
+        *cb++ = 2;
+    }
+    *cb++ = 0;
+    *cb++ = 0;
+
+    pio_sm_init(sdio_pio, sdio_sm_data, sdio_data_offset + sdio_data_offset_rx, &sdio_cfg_data);
+    pio_sm_put(sdio_pio, sdio_sm_data, words * 8 + 16 - 1); /* data + CRC nibbles */
+
+    dma_channel_config c = dma_channel_get_default_config(sdio_dma_data);
+    channel_config_set_dreq(&c, pio_get_dreq(sdio_pio, sdio_sm_data, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_bswap(&c, true); /* first nibble is msb */
+    channel_config_set_chain_to(&c, sdio_dma_ctrl);
+    dma_channel_configure(sdio_dma_data, &c, NULL, &sdio_pio->rxf[sdio_sm_data], 0, false);
+
+    c = dma_channel_get_default_config(sdio_dma_ctrl);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 3); /* al1_write_addr, al1_transfer_count_trig */
+    dma_channel_configure(sdio_dma_ctrl, &c, &dma_hw->ch[sdio_dma_data].al1_write_addr, sdio_ctrl_blocks[set], 2, true);
+
+    pio_sm_set_enabled(sdio_pio, sdio_sm_data, true);
+}
+
+/* 1:OK, 0:Timeout */
+static int sdio_read_wait(int set, UINT count)
+{
+    absolute_time_t timeout_time = make_timeout_time_ms(100 + count);
+    uint32_t end = (uint32_t)&sdio_ctrl_blocks[set][4 * count + 2];
+    while (dma_channel_is_busy(sdio_dma_data) || dma_channel_is_busy(sdio_dma_ctrl) || dma_hw->ch[sdio_dma_ctrl].read_addr != end)
+    {
+        if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time))
+        {
+            SDIO_PRINT_ERROR();
+            sdio_data_stop();
+            return 0;
+        }
+        SDIO_YIELD();
+    }
+    pio_sm_set_enabled(sdio_pio, sdio_sm_data, false);
+    return 1;
+}
+
+/* 1:OK, 0:CRC error */
+static int sdio_read_check(int set, const BYTE *buff, UINT count, UINT words)
+{
+    for (UINT i = 0; i < count; i++)
+    {
+        uint64_t crc = (uint64_t)__builtin_bswap32(sdio_crc[set][2 * i]) << 32 | __builtin_bswap32(sdio_crc[set][2 * i + 1]);
+        if (crc != sdio_crc16(buff + i * words * 4, words * 4))
+        {
+            SDIO_PRINT_ERROR();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* One block: 7 idle + start nibbles, data, CRC, end, then the CRC status token falls in rx */
+static void sdio_write_start(const BYTE *buff, uint64_t crc)
+{
+    sdio_tail[0] = (uint32_t)(crc >> 32);
+    sdio_tail[1] = (uint32_t)crc;
+    sdio_tail[2] = SDIO_TX_END;
+
+    pio_sm_init(sdio_pio, sdio_sm_data, sdio_data_offset, &sdio_cfg_data);
+    pio_sm_put(sdio_pio, sdio_sm_data, SDIO_TX_NIBBLES - 1);
+    pio_sm_put(sdio_pio, sdio_sm_data, 0xFFFFFFF0);
+
+    dma_channel_config c = dma_channel_get_default_config(sdio_dma_ctrl);
+    channel_config_set_dreq(&c, pio_get_dreq(sdio_pio, sdio_sm_data, true));
+    dma_channel_configure(sdio_dma_ctrl, &c, &sdio_pio->txf[sdio_sm_data], sdio_tail, 3, false);
+
+    c = dma_channel_get_default_config(sdio_dma_data);
+    channel_config_set_dreq(&c, pio_get_dreq(sdio_pio, sdio_sm_data, true));
+    channel_config_set_bswap(&c, true);
+    channel_config_set_chain_to(&c, sdio_dma_ctrl);
+    dma_channel_configure(sdio_dma_data, &c, &sdio_pio->txf[sdio_sm_data], buff, SDIO_BLOCK_WORDS, true);
+
+    pio_sm_set_enabled(sdio_pio, sdio_sm_data, true);
+}
+
+/* 1:Accepted, 0:Error */
+static int sdio_write_wait(void)
+{
+    absolute_time_t timeout_time = make_timeout_time_ms(100);
+    while (pio_sm_is_rx_fifo_empty(sdio_pio, sdio_sm_data))
+    {
+        if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time))
+        {
+            SDIO_PRINT_ERROR();
+            sdio_data_stop();
+            return 0;
+        }
+        SDIO_YIELD();
+    }
+    uint32_t w = pio_sm_get(sdio_pio, sdio_sm_data);
+    pio_sm_set_enabled(sdio_pio, sdio_sm_data, false);
+    int status = SDIO_STATUS_BIT(w, 0) << 2 | SDIO_STATUS_BIT(w, 1) << 1 | SDIO_STATUS_BIT(w, 2);
+    if (status != 0x02) /* 010: Data accepted */
+    {
+        SDIO_PRINT_ERROR();
+        return 0;
+    }
+    return 1;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Disk                                                                  */
+/*-----------------------------------------------------------------------*/
+
+static DSTATUS sdio_initialize(BYTE pdrv)
+{
+    uint32_t r;
+    BYTE ty = 0;
+
+    sdio_init_pio();
+    sdio_set_clock(400000);
+    sleep_ms(1); /* >= 74 clocks */
+
+    SDIO_RCA = 0;
+    sdio_cmd(CMD0, 0, SDIO_NONE, NULL);
+
+    DWORD arg = 0x00FF8000; /* 2.7 - 3.6V */
+    if (sdio_cmd(CMD8, 0x1AA, SDIO_R1, &r) == 0 && (r & 0xFFF) == 0x1AA)
+        arg |= 1UL << 30; /* SDv2, HCS */
+
+    absolute_time_t timeout_time = make_timeout_time_ms(1000);
+    while (0 < absolute_time_diff_us(get_absolute_time(), timeout_time))
+    {
+        if (sdio_cmd(ACMD41, arg, SDIO_R3, &r) == 0 && (r & (1UL << 31)))
+        {
+            if (arg & (1UL << 30))
+                ty = (r & (1UL << 30)) ? CT_SD2 | CT_BLOCK : CT_SD2;
+            else
+                ty = CT_SD1;
+            break;
+        }
+        sleep_ms(1);
+    }
+
+    if (ty)
+    {
+        if (sdio_cmd(CMD2, 0, SDIO_R2, NULL) ||
+            sdio_cmd(CMD3, 0, SDIO_R1, &r))
+            ty = 0;
+        else
+            SDIO_RCA = r >> 16;
+    }
+
+    if (ty)
+    {
+        if (sdio_cmd(CMD9, SDIO_RCA << 16, SDIO_R2, SDIO_CSD) ||
+            sdio_cmd(CMD7, SDIO_RCA << 16, SDIO_R1B, NULL) ||
+            sdio_cmd(ACMD6, 2, SDIO_R1, NULL) || /* 4-bit bus */
+            sdio_cmd(CMD16, 512, SDIO_R1, NULL))
+            ty = 0;
+    }
+
+    SDIO_CardType = ty;
+    if (ty)
+    {
+        sdio_set_clock(FATFS_SDIO_BRG);
+        SDIO_Stat &= ~STA_NOINIT;
+    }
+    else
+    {
+        SDIO_PRINT_ERROR();
+        SDIO_Stat = STA_NOINIT;
+    }
+    return SDIO_Stat;
+}
+
+static DSTATUS sdio_status(BYTE pdrv)
+{
+    return SDIO_Stat;
+}
+
+static DRESULT sdio_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    if (SDIO_Stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    int step = (SDIO_CardType & CT_BLOCK) ? 1 : 512;
+
+    if ((uint32_t)buff & 3)
+    {
+        /* DMA is word wide, bounce one by one */
+        for (; count; count--, sector++, buff += 512)
+        {
+            if (sdio_read(pdrv, (BYTE *)sdio_bounce, sector, 1))
+                return RES_ERROR;
+            memcpy(buff, sdio_bounce, 512);
+        }
+        return RES_OK;
+    }
+
+    /*
+        Pipelined: while the next chunk is streamed by DMA the previous one is CRC checked
+    */
+    int set = 0, ok = 1;
+    BYTE *prev = NULL;
+    UINT prev_count = 0;
+    while (ok && (count || prev))
+    {
+        UINT n = count > FATFS_SDIO_MAX_BLOCKS ? FATFS_SDIO_MAX_BLOCKS : count;
+        if (n)
+        {
+            sdio_read_start(set, buff, n, SDIO_BLOCK_WORDS);
+            if (sdio_cmd(n > 1 ? CMD18 : CMD17, sector * step, SDIO_R1, NULL))
+            {
+                sdio_data_stop();
+                ok = 0;
+                break;
+            }
+        }
+        if (prev && !sdio_read_check(set ^ 1, prev, prev_count, SDIO_BLOCK_WORDS))
+            ok = 0;
+        if (n)
+        {
+            if (!sdio_read_wait(set, n))
+                ok = 0;
+            if (n > 1 && sdio_cmd(CMD12, 0, SDIO_R1B, NULL))
+                ok = 0;
+        }
+        prev = n ? buff : NULL;
+        prev_count = n;
+        buff += n * 512;
+        sector += n;
+        count -= n;
+        set ^= 1;
+    }
+    return ok ? RES_OK : RES_ERROR;
+}
+
+#if FATFS_USE_WRITE
+static DRESULT sdio_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (SDIO_Stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    if (!(SDIO_CardType & CT_BLOCK))
+        sector *= 512;
+
+    int bounce = (uint32_t)buff & 3;
+    if (bounce)
+        memcpy(sdio_bounce, buff, 512);
+
+    if (count == 1)
+    {
+        if (sdio_cmd(CMD24, sector, SDIO_R1, NULL))
+            return RES_ERROR;
+    }
+    else
+    {
+        sdio_cmd(ACMD23, count, SDIO_R1, NULL); /* Predefine number of sectors */
+        if (sdio_cmd(CMD25, sector, SDIO_R1, NULL))
+            return RES_ERROR;
+    }
+
+    /*
+        Pipelined: CRC of the next block is made while the card receives and programs the current
+    */
+    UINT n = count;
+    const BYTE *src = bounce ? (const BYTE *)sdio_bounce : buff;
+    uint64_t crc = sdio_crc16(src, 512);
+    while (n)
+    {
+        sdio_write_start(src, crc);
+        if (--n)
+        {
+            buff += 512;
+            if (bounce)
+            {
+                while (dma_channel_is_busy(sdio_dma_data) || dma_channel_is_busy(sdio_dma_ctrl))
+                    tight_loop_contents();
+                memcpy(sdio_bounce, buff, 512);
+            }
+            else
+                src = buff;
+            crc = sdio_crc16(src, 512);
+        }
+        if (!sdio_write_wait() || !sdio_wait_ready(500))
+            break;
+    }
+
+    if (count > 1 && sdio_cmd(CMD12, 0, SDIO_R1B, NULL))
+        n = 1;
+    return n ? RES_ERROR : RES_OK;
+}
+#endif
+
+#if FATFS_USE_IOCTL
+static DRESULT sdio_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    DRESULT res = RES_ERROR;
+    BYTE n, *csd = SDIO_CSD;
+    DWORD *dp, st, ed, csize;
+
+    if (SDIO_Stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    switch (cmd)
+    {
+    case CTRL_SYNC: /* Wait for end of internal write process of the drive */
+        if (sdio_wait_ready(500))
+            res = RES_OK;
+        break;
+
+    case GET_SECTOR_COUNT: /* Get drive capacity in unit of sector (DWORD) */
+        if ((csd[0] >> 6) == 1)
+        { /* SDC ver 2.00 */
+            csize = csd[9] + ((WORD)csd[8] << 8) + ((DWORD)(csd[7] & 63) << 16) + 1;
+            *(DWORD *)buff = csize << 10;
+        }
+        else
+        { /* SDC ver 1.XX */
+            n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
+            csize = (csd[8] >> 6) + ((WORD)csd[7] << 2) + ((WORD)(csd[6] & 3) << 10) + 1;
+            *(DWORD *)buff = csize << (n - 9);
+        }
+        res = RES_OK;
+        break;
+
+    case GET_BLOCK_SIZE: /* Get erase block size in unit of sector (DWORD) */
+        if (SDIO_CardType & CT_SD2)
+        {
+            /* SD status, 64 bytes */
+            sdio_read_start(0, (BYTE *)sdio_bounce, 1, 16);
+            if (sdio_cmd(ACMD13, 0, SDIO_R1, NULL) == 0 && sdio_read_wait(0, 1) && sdio_read_check(0, (BYTE *)sdio_bounce, 1, 16))
+            {
+                *(DWORD *)buff = 16UL << (((BYTE *)sdio_bounce)[10] >> 4);
+                res = RES_OK;
+            }
+            else
+                sdio_data_stop();
+        }
+        else
+        {
+            *(DWORD *)buff = (((csd[10] & 63) << 1) + ((WORD)(csd[11] & 128) >> 7) + 1) << ((csd[13] >> 6) - 1);
+            res = RES_OK;
+        }
+        break;
+
+    case CTRL_ERASE_SECTOR: /* Erase a block of sectors (used when _USE_ERASE == 1) */
+        if (!(csd[0] >> 6) && !(csd[10] & 0x40))
+            break; /* Check if sector erase can be applied to the card */
+        dp = buff;
+        st = dp[0];
+        ed = dp[1];
+        if (!(SDIO_CardType & CT_BLOCK))
+        {
+            st *= 512;
+            ed *= 512;
+        }
+        if (sdio_cmd(CMD32, st, SDIO_R1, NULL) == 0 && sdio_cmd(CMD33, ed, SDIO_R1, NULL) == 0 &&
+            sdio_cmd(CMD38, 0, SDIO_R1, NULL) == 0 && sdio_wait_ready(30000))
+            res = RES_OK;
+        break;
+
+    case MMC_GET_TYPE:
+        *(BYTE *)buff = SDIO_CardType;
+        res = RES_OK;
+        break;
+
+    case MMC_GET_CSD:
+        memcpy(buff, SDIO_CSD, 16);
+        res = RES_OK;
+        break;
+
+    default:
+        res = RES_PARERR;
+    }
+    return res;
+}
+#endif
+
+const fatfs_diskio_t fatfs_sdio_diskio = {
+    .initialize = sdio_initialize,
+    .status = sdio_status,
+    .read = sdio_read,
+#if FATFS_USE_WRITE
+    .write = sdio_write,
+#endif
+#if FATFS_USE_IOCTL
+    .ioctl = sdio_ioctl,
+#endif
+};
+
+#endif // USE_FATFS
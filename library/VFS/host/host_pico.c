@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    Host mocks of the pico layer under VFS
+
+    flash:  image file mapped at XIP_BASE, LittleFS reads it as XIP memory
+            program clears bits only and erase sets a sector to 0xFF, as NOR flash does
+    sd:     image file as FatFs block device, formatted FAT16 when created
+*/
+
+#include "host_pico.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* pico mutex */
+
+void mutex_init(mutex_t *mtx) { pthread_mutex_init(mtx, NULL); }
+
+void mutex_enter_blocking(mutex_t *mtx) { pthread_mutex_lock(mtx); }
+
+void mutex_exit(mutex_t *mtx) { pthread_mutex_unlock(mtx); }
+
+unsigned int strhash(const void *p) /* wizio.c */
+{
+    unsigned int h = 0, v, i;
+    char *src = (char *)p;
+    if (src)
+    {
+        for (h = 0, i = 0; i < strlen(src); i++)
+        {
+            h = 5527 * h + 7 * src[i];
+            v = h & 0x0000ffff;
+            h ^= v * v;
+        }
+    }
+    return h;
+}
+
+static int image_open(const char *path, size_t size, bool *created)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+        return -1;
+    *created = (size_t)st.st_size != size;
+    if (*created && ftruncate(fd, size))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+    Flash
+*/
+
+static uint8_t *flash_mem;
+static size_t flash_size;
+
+int host_flash_open(const char *path)
+{
+    bool created;
+    flash_size = LFS_ROM_BLOCK_COUNT * LFS_ROM_BLOCK_SIZE;
+    int fd = image_open(path, flash_size, &created);
+    if (fd < 0)
+        return -1;
+    /* __flash_binary_end is XIP_BASE ( Makefile ), the disk starts at the first flash byte */
+    flash_mem = mmap((void *)XIP_BASE, flash_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == flash_mem || (void *)XIP_BASE != flash_mem)
+    {
+        flash_mem = NULL;
+        return -1;
+    }
+    if (created)
+        memset(flash_mem, 0xFF, flash_size);
+    return 0;
+}
+
+void host_flash_close(void)
+{
+    if (flash_mem)
+        munmap(flash_mem, flash_size);
+    flash_mem = NULL;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    assert(flash_mem && 0 == (flash_offs | count) % FLASH_SECTOR_SIZE);
+    assert(flash_offs + count <= flash_size);
+    memset(flash_mem + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    assert(flash_mem && 0 == (flash_offs | count) % FLASH_PAGE_SIZE);
+    assert(flash_offs + count <= flash_size);
+    for (size_t i = 0; i < count; i++)
+        flash_mem[flash_offs + i] &= data[i];
+}
+
+/*
+    SD card
+*/
+
+#define SD_SS 512
+
+static int sd_fd = -1;
+static DWORD sd_sectors;
+
+static void put16(BYTE *p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+/* FAT16, one reserved sector, 2 FATs, 512 root entries, 1k clusters ( FF_USE_MKFS is 0 ) */
+static int sd_format(void)
+{
+    BYTE bs[SD_SS] = {0xEB, 0x3C, 0x90, 'M', 'S', 'D', 'O', 'S', '5', '.', '0'};
+    DWORD root = 512 * 32 / SD_SS, clus = 2;
+    DWORD fat = ((sd_sectors - 1 - root) / clus + 2) * 2 / SD_SS + 1;
+    put16(bs + 11, SD_SS);
+    bs[13] = clus;
+    put16(bs + 14, 1);
+    bs[16] = 2;
+    put16(bs + 17, 512);
+    put16(bs + 19, sd_sectors);
+    bs[21] = 0xF8;
+    put16(bs + 22, fat);
+    put16(bs + 24, 63);
+    put16(bs + 26, 255);
+    bs[36] = 0x80;
+    bs[38] = 0x29;
+    memcpy(bs + 43, "NO NAME    FAT16   ", 19);
+    put16(bs + 510, 0xAA55);
+    if (pwrite(sd_fd, bs, SD_SS, 0) != SD_SS)
+        return -1;
+    memset(bs, 0, SD_SS);
+    put16(bs, 0xFFF8);
+    put16(bs + 2, 0xFFFF);
+    for (int i = 0; i < 2; i++)
+        if (pwrite(sd_fd, bs, 4, (1 + i * fat) * SD_SS) != 4)
+            return -1;
+    return 0;
+}
+
+int host_sd_open(const char *path, uint32_t sectors)
+{
+    bool created;
+    if (sectors > 0xFFFF)
+        return -1; /* TotSec16 */
+    sd_sectors = sectors;
+    if ((sd_fd = image_open(path, (size_t)sectors * SD_SS, &created)) < 0)
+        return -1;
+    if (created && sd_format())
+    {
+        close(sd_fd);
+        sd_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void host_sd_close(void)
+{
+    if (sd_fd >= 0)
+        close(sd_fd);
+    sd_fd = -1;
+}
+
+static DSTATUS sd_initialize(BYTE pdrv) { return sd_fd < 0 ? STA_NOINIT | STA_NODISK : 0; }
+
+static DSTATUS sd_status(BYTE pdrv) { return sd_initialize(pdrv); }
+
+static DRESULT sd_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    if (sector + count > sd_sectors)
+        return RES_PARERR;
+    ssize_t size = (ssize_t)count * SD_SS;
+    return pread(sd_fd, buff, size, (off_t)sector * SD_SS) == size ? RES_OK : RES_ERROR;
+}
+
+static DRESULT sd_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (sector + count > sd_sectors)
+        return RES_PARERR;
+    ssize_t size = (ssize_t)count * SD_SS;
+    return pwrite(sd_fd, buff, size, (off_t)sector * SD_SS) == size ? RES_OK : RES_ERROR;
+}
+
+static DRESULT sd_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    switch (cmd)
+    {
+    case CTRL_SYNC:
+        return RES_OK; /* the image is flushed by the OS */
+    case GET_SECTOR_COUNT:
+        *(DWORD *)buff = sd_sectors;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD *)buff = SD_SS;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *(DWORD *)buff = 1;
+        return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+const fatfs_diskio_t fatfs_image_diskio = {
+    .initialize = sd_initialize,
+    .status = sd_status,
+    .read = sd_read,
+    .write = sd_write,
+    .ioctl = sd_ioctl,
+};
+
+DWORD get_fattime(void) /* fatfs_sd.c */
+{
+    return ((DWORD)(2021 - 1980) << 25) | ((DWORD)7 << 21) | ((DWORD)10 << 16) | ((DWORD)16 << 11);
+}
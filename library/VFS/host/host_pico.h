@@ -0,0 +1,31 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_PICO_H_
+#define _HOST_PICO_H_
+
+#include "VFS_FATFS.h"
+#include "VFS_LFS.h"
+
+/* Image files as block devices, open before vfs_init(), a new image is erased or formatted */
+int host_flash_open(const char *path); /* LFS_ROM_BLOCK_COUNT x LFS_ROM_BLOCK_SIZE */
+void host_flash_close(void);
+int host_sd_open(const char *path, uint32_t sectors);
+void host_sd_close(void);
+
+#endif // _HOST_PICO_H_
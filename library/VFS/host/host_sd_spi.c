@@ -0,0 +1,483 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    SD card in SPI mode behind host mocks of spi, gpio, dma and time, fatfs_sd.c runs unchanged
+
+    The card is an SDHC ( block addressing ) in RAM. Every byte exchanged with it is one
+    SPI byte on the bus: the clock is the bus, get_absolute_time() is the bus time at the
+    spi_init() baudrate. Read access and programming time are 0xFF / 0x00 ( busy ) bytes
+    of the card model ( sd_card_model_t ), so timeouts of the driver work as on the board.
+
+    dma:    a started tx / rx pair is clocked to the end at once. rx bytes past the rx count
+            stay in the 8 deep rx fifo, spi_is_readable() latches the next one in dr
+*/
+
+#include "host_sd_spi.h"
+#include <hardware/dma.h>
+
+static sd_card_model_t card_model;
+static sd_spi_stats_t stats;
+static unsigned spi_baud = 1000000;
+static uint64_t bus_clock; /* bytes since start */
+
+/*
+    Card
+*/
+
+#define CARD_BS 512
+#define CARD_RUNS 8
+
+typedef struct
+{
+    const uint8_t *data; /* NULL: fill */
+    uint8_t fill;
+    uint32_t size;
+} card_run_t;
+
+typedef enum
+{
+    CARD_IDLE,
+    CARD_READ_MULTI,
+    CARD_WRITE_SINGLE,
+    CARD_WRITE_MULTI,
+} card_mode_t;
+
+static struct
+{
+    uint8_t (*mem)[CARD_BS];
+    uint32_t blocks;
+    bool selected;
+    bool idle;  /* R1 in idle state, until ACMD41 */
+    bool app;   /* next command is ACMD */
+    int op_cond;
+    card_mode_t mode;
+    uint32_t addr;
+    uint8_t cmd[6];
+    int cmd_len;
+    int rx_len; /* -1: wait data token */
+    uint8_t rx[CARD_BS + 2];
+    card_run_t run[CARD_RUNS]; /* DO queue */
+    int run_head, run_count;
+    uint8_t resp[8];
+    uint8_t reg[64];
+} card;
+
+static const uint8_t card_crc[2] = {0xFF, 0xFF};
+
+static uint32_t card_us_bytes(uint32_t us) { return (uint32_t)((uint64_t)us * spi_baud / 8000000); }
+
+static void card_push(const uint8_t *data, uint8_t fill, uint32_t size)
+{
+    assert(card.run_count < CARD_RUNS);
+    if (0 == size)
+        return;
+    card_run_t *r = &card.run[(card.run_head + card.run_count++) % CARD_RUNS];
+    r->data = data;
+    r->fill = fill;
+    r->size = size;
+}
+
+static int card_pop(uint8_t *out)
+{
+    while (card.run_count)
+    {
+        card_run_t *r = &card.run[card.run_head];
+        if (r->size)
+        {
+            *out = r->data ? *r->data++ : r->fill;
+            r->size--;
+            if (0 == r->fill && NULL == r->data)
+                stats.busy_bytes++;
+            return 1;
+        }
+        card.run_head = (card.run_head + 1) % CARD_RUNS;
+        card.run_count--;
+    }
+    return 0;
+}
+
+/* Ncr, R1 and the trailing bytes of R3 / R7 / R2 */
+static void card_response(const uint8_t *extra, int size)
+{
+    card.resp[0] = card.idle;
+    memcpy(card.resp + 1, extra, size);
+    card_push(NULL, 0xFF, 1);
+    card_push(card.resp, 0, 1 + size);
+}
+
+/* Nac, data token, block and CRC */
+static void card_block(const uint8_t *data, uint32_t size, uint32_t nac_us)
+{
+    card_push(NULL, 0xFF, 1 + card_us_bytes(nac_us));
+    card_push(NULL, 0xFE, 1);
+    card_push(data, 0, size);
+    card_push(card_crc, 0, 2);
+}
+
+static void card_command(void)
+{
+    uint8_t index = card.cmd[0] & 0x3F;
+    uint32_t arg = (uint32_t)card.cmd[1] << 24 | card.cmd[2] << 16 | card.cmd[3] << 8 | card.cmd[4];
+    bool app = card.app;
+    card.app = false;
+    stats.commands++;
+    switch (app ? 0x80 | index : index)
+    {
+    case CMD0:
+        card.idle = true;
+        card.op_cond = 0;
+        card_response(NULL, 0);
+        break;
+    case CMD8:
+        card_response((const uint8_t[]){0x00, 0x00, (arg >> 8) & 0x0F, arg & 0xFF}, 4);
+        break;
+    case CMD55:
+        card.app = true;
+        card_response(NULL, 0);
+        break;
+    case ACMD41:
+        if (++card.op_cond > 1) /* ready on the second poll */
+            card.idle = false;
+        card_response(NULL, 0);
+        break;
+    case CMD58:
+        card_response((const uint8_t[]){0xC0, 0xFF, 0x80, 0x00}, 4); /* powered up, CCS */
+        break;
+    case CMD9:
+    {
+        uint32_t c_size = card.blocks / 1024 - 1;
+        memset(card.reg, 0, 16);
+        card.reg[0] = 0x40; /* CSD v2 */
+        card.reg[5] = 0x09;
+        card.reg[7] = (c_size >> 16) & 0x3F;
+        card.reg[8] = c_size >> 8;
+        card.reg[9] = c_size;
+        card.reg[10] = 0x7F; /* SECTOR_SIZE */
+        card.reg[15] = 0x01;
+        card_response(NULL, 0);
+        card_block(card.reg, 16, card_model.nac_us);
+        break;
+    }
+    case ACMD13:
+        memset(card.reg, 0, 64);
+        card.reg[10] = 0x90; /* AU_SIZE 4 MB */
+        card_response((const uint8_t[]){0x00}, 1);
+        card_block(card.reg, 64, card_model.nac_us);
+        break;
+    case CMD12:
+        card.mode = CARD_IDLE;
+        card.run_count = 0;
+        card_push(NULL, 0xFF, 1); /* stuff byte */
+        card_response(NULL, 0); /* no busy after a read */
+        break;
+    case CMD17:
+    case CMD18:
+        if (arg >= card.blocks)
+        {
+            card.resp[0] = 0x40; /* address error */
+            card_push(NULL, 0xFF, 1);
+            card_push(card.resp, 0, 1);
+            break;
+        }
+        card_response(NULL, 0);
+        card_block(card.mem[arg], CARD_BS, card_model.nac_us);
+        stats.blocks_read++;
+        card.addr = arg + 1;
+        card.mode = CMD18 == index ? CARD_READ_MULTI : CARD_IDLE;
+        break;
+    case CMD24:
+    case CMD25:
+        if (arg >= card.blocks)
+        {
+            card.resp[0] = 0x40;
+            card_push(NULL, 0xFF, 1);
+            card_push(card.resp, 0, 1);
+            break;
+        }
+        card_response(NULL, 0);
+        card.addr = arg;
+        card.rx_len = -1;
+        card.mode = CMD25 == index ? CARD_WRITE_MULTI : CARD_WRITE_SINGLE;
+        break;
+    case CMD16:
+    case ACMD23:
+        card_response(NULL, 0);
+        break;
+    default:
+        card.resp[0] = card.idle | 0x04; /* illegal command */
+        card_push(NULL, 0xFF, 1);
+        card_push(card.resp, 0, 1);
+        break;
+    }
+}
+
+/* Data token or data of CMD24 / CMD25 */
+static void card_write(uint8_t in)
+{
+    if (card.rx_len < 0)
+    {
+        if ((CARD_WRITE_SINGLE == card.mode ? 0xFE : 0xFC) == in)
+            card.rx_len = 0;
+        else if (0xFD == in && CARD_WRITE_MULTI == card.mode)
+        {
+            card.mode = CARD_IDLE;
+            card_push(NULL, 0xFF, 1);
+            card_push(NULL, 0x00, card_us_bytes(card_model.stop_us));
+        }
+        return;
+    }
+    card.rx[card.rx_len++] = in;
+    if (card.rx_len < (int)sizeof(card.rx))
+        return;
+    card.rx_len = -1;
+    if (card.addr >= card.blocks)
+    {
+        card_push(NULL, 0x0D, 1); /* write error */
+        card.mode = CARD_IDLE;
+        return;
+    }
+    memcpy(card.mem[card.addr++], card.rx, CARD_BS);
+    stats.blocks_written++;
+    card_push(NULL, 0xE5, 1); /* data accepted */
+    if (CARD_WRITE_SINGLE == card.mode)
+    {
+        card.mode = CARD_IDLE;
+        card_push(NULL, 0x00, 1 + card_us_bytes(card_model.prog_us));
+    }
+    else
+        card_push(NULL, 0x00, 1 + card_us_bytes(card_model.prog_next_us));
+}
+
+/* One byte on the bus, full duplex */
+static uint8_t card_xfer(uint8_t in)
+{
+    uint8_t out = 0xFF;
+    bus_clock++;
+    stats.bus_bytes++;
+    if (!card_pop(&out) && CARD_READ_MULTI == card.mode && card.selected)
+    {
+        if (card.addr < card.blocks)
+        {
+            card_block(card.mem[card.addr++], CARD_BS, card_model.nac_next_us);
+            stats.blocks_read++;
+        }
+        else
+            card_push(NULL, 0xFF, 1);
+        card_pop(&out);
+    }
+    if (!card.selected)
+        return 0xFF;
+
+    if (card.cmd_len || (0x40 == (in & 0xC0) && (CARD_IDLE == card.mode || CARD_READ_MULTI == card.mode)))
+    {
+        card.cmd[card.cmd_len++] = in;
+        if (sizeof(card.cmd) == card.cmd_len)
+        {
+            card.cmd_len = 0;
+            card_command();
+        }
+    }
+    else if (CARD_WRITE_SINGLE == card.mode || CARD_WRITE_MULTI == card.mode)
+        card_write(in);
+    return out;
+}
+
+int sd_card_open(uint32_t blocks, const sd_card_model_t *model)
+{
+    if (blocks < 1024 || blocks % 1024)
+        return -1; /* CSD v2 C_SIZE */
+    sd_card_close();
+    if (NULL == (card.mem = calloc(blocks, CARD_BS)))
+        return -1;
+    card.blocks = blocks;
+    card.idle = true;
+    card_model = *model;
+    return 0;
+}
+
+void sd_card_close(void)
+{
+    free(card.mem);
+    memset(&card, 0, sizeof(card));
+}
+
+void sd_card_model(const sd_card_model_t *model) { card_model = *model; }
+
+void sd_spi_stats(sd_spi_stats_t *st, bool reset)
+{
+    if (st)
+        *st = stats;
+    if (reset)
+        memset(&stats, 0, sizeof(stats));
+}
+
+uint64_t sd_spi_us(uint64_t bytes) { return bytes * 8000000 / spi_baud; }
+
+/*
+    pico/time.h, bus time
+*/
+
+absolute_time_t get_absolute_time(void) { return sd_spi_us(bus_clock); }
+
+/*
+    hardware/gpio.h, chip select only
+*/
+
+void gpio_put(unsigned gpio, bool value)
+{
+    if (FATFS_CS_PIN != gpio)
+        return;
+    card.selected = !value;
+    card.cmd_len = 0;
+}
+
+bool gpio_get(unsigned gpio) { return 1; }
+
+/*
+    hardware/spi.h
+*/
+
+struct spi_inst
+{
+    spi_hw_t hw;
+    uint8_t fifo[8]; /* rx */
+    int fifo_len;
+};
+
+static struct spi_inst spi_0;
+spi_inst_t *const spi0 = &spi_0;
+
+unsigned spi_init(spi_inst_t *spi, unsigned baudrate)
+{
+    spi->fifo_len = 0;
+    return spi_baud = baudrate;
+}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi) { return &spi->hw; }
+
+bool spi_is_readable(spi_inst_t *spi)
+{
+    if (0 == spi->fifo_len)
+        return false;
+    spi->hw.dr = spi->fifo[0];
+    memmove(spi->fifo, spi->fifo + 1, --spi->fifo_len);
+    return true;
+}
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    assert(0 == spi->fifo_len);
+    for (size_t i = 0; i < len; i++)
+        dst[i] = card_xfer(src[i]);
+    stats.cpu_bytes += len;
+    return len;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    assert(0 == spi->fifo_len);
+    for (size_t i = 0; i < len; i++)
+        card_xfer(src[i]);
+    stats.cpu_bytes += len;
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    assert(0 == spi->fifo_len);
+    for (size_t i = 0; i < len; i++)
+        dst[i] = card_xfer(repeated_tx_data);
+    stats.cpu_bytes += len;
+    return len;
+}
+
+/*
+    hardware/dma.h, spi0 tx / rx channel pairs
+*/
+
+#define DMA_CHANNELS 12
+
+static struct
+{
+    volatile void *write;
+    const volatile void *read;
+    unsigned count;
+    uint32_t ctrl;
+} dma_ch[DMA_CHANNELS];
+static int dma_claimed;
+
+int dma_claim_unused_channel(bool required)
+{
+    if (dma_claimed < DMA_CHANNELS)
+        return dma_claimed++;
+    assert(!required);
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned channel)
+{
+    dma_channel_config c = {DMA_CTRL_INCR_READ};
+    return c;
+}
+
+void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger)
+{
+    assert(channel < DMA_CHANNELS && !trigger);
+    dma_ch[channel].write = write_addr;
+    dma_ch[channel].read = read_addr;
+    dma_ch[channel].count = transfer_count;
+    dma_ch[channel].ctrl = config->ctrl;
+}
+
+void dma_start_channel_mask(uint32_t chan_mask)
+{
+    int tx = -1, rx = -1;
+    for (int i = 0; i < DMA_CHANNELS; i++)
+        if (chan_mask & (1u << i))
+        {
+            if (dma_ch[i].write == &spi0->hw.dr)
+                tx = i;
+            else if (dma_ch[i].read == &spi0->hw.dr)
+                rx = i;
+        }
+    assert(tx >= 0 && rx >= 0 && 0 == spi0->fifo_len);
+    const volatile uint8_t *src = dma_ch[tx].read;
+    volatile uint8_t *dst = dma_ch[rx].write;
+    for (unsigned i = 0; i < dma_ch[tx].count; i++)
+    {
+        uint8_t in = card_xfer(*src);
+        if (dma_ch[tx].ctrl & DMA_CTRL_INCR_READ)
+            src++;
+        if (i < dma_ch[rx].count)
+        {
+            *dst = in;
+            if (dma_ch[rx].ctrl & DMA_CTRL_INCR_WRITE)
+                dst++;
+        }
+        else
+        {
+            assert(spi0->fifo_len < (int)sizeof(spi0->fifo)); /* rx overrun */
+            spi0->fifo[spi0->fifo_len++] = in;
+        }
+    }
+    stats.dma_bytes += dma_ch[tx].count;
+}
+
+bool dma_channel_is_busy(unsigned channel) { return false; }
@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_SD_SPI_H_
+#define _HOST_SD_SPI_H_
+
+#include "VFS_FATFS.h"
+
+/* Card timing in us, the card shows 0xFF ( read access ) or 0x00 ( busy ) for as long */
+typedef struct sd_card_model_s
+{
+    uint32_t nac_us;       /* CMD17, first block of CMD18, registers */
+    uint32_t nac_next_us;  /* next blocks of CMD18 */
+    uint32_t prog_us;      /* busy after a CMD24 block */
+    uint32_t prog_next_us; /* busy after a CMD25 block */
+    uint32_t stop_us;      /* busy after the stop token of CMD25 */
+} sd_card_model_t;
+
+typedef struct sd_spi_stats_s
+{
+    uint64_t bus_bytes;  /* clocked with CS low or high */
+    uint64_t cpu_bytes;  /* through spi_*_blocking() */
+    uint64_t dma_bytes;
+    uint64_t busy_bytes; /* read access is not counted */
+    uint32_t commands;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+} sd_spi_stats_t;
+
+/* SDHC of blocks x 512 bytes in RAM, blocks: n x 1024 */
+int sd_card_open(uint32_t blocks, const sd_card_model_t *model);
+void sd_card_close(void);
+void sd_card_model(const sd_card_model_t *model);
+
+void sd_spi_stats(sd_spi_stats_t *st, bool reset);
+uint64_t sd_spi_us(uint64_t bytes); /* bus time at the spi_init() baudrate */
+
+#endif // _HOST_SD_SPI_H_
@@ -0,0 +1,70 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    Host stand-in of hardware/dma.h, the channels move bytes to and from the emulated SPI ( host_sd_spi.c )
+    A transfer runs to the end when started, dma_channel_is_busy() is always false
+*/
+
+#ifndef _HARDWARE_DMA_H
+#define _HARDWARE_DMA_H
+
+#include <wizio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    enum dma_channel_transfer_size
+    {
+        DMA_SIZE_8 = 0,
+        DMA_SIZE_16 = 1,
+        DMA_SIZE_32 = 2
+    };
+
+    typedef struct
+    {
+        uint32_t ctrl;
+    } dma_channel_config;
+
+#define DMA_CTRL_INCR_READ (1u << 4)
+#define DMA_CTRL_INCR_WRITE (1u << 5)
+
+    int dma_claim_unused_channel(bool required);
+    dma_channel_config dma_channel_get_default_config(unsigned channel);
+    void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                               const volatile void *read_addr, unsigned transfer_count, bool trigger);
+    void dma_start_channel_mask(uint32_t chan_mask);
+    bool dma_channel_is_busy(unsigned channel);
+
+    static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { (void)c, (void)size; }
+    static inline void channel_config_set_dreq(dma_channel_config *c, unsigned dreq) { (void)c, (void)dreq; }
+    static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+    {
+        c->ctrl = incr ? c->ctrl | DMA_CTRL_INCR_READ : c->ctrl & ~DMA_CTRL_INCR_READ;
+    }
+    static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+    {
+        c->ctrl = incr ? c->ctrl | DMA_CTRL_INCR_WRITE : c->ctrl & ~DMA_CTRL_INCR_WRITE;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+#endif // _HARDWARE_DMA_H
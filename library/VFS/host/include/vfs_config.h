@@ -0,0 +1,22 @@
+/*
+    VFS host build: FatFs on a disk image, LittleFS on a flash image and in RAM
+*/
+
+#define MAX_OPEN_FILES  4
+
+#define USE_LFS
+#define USE_LFS_RAM
+#define USE_LFS_ROM
+#define USE_FATFS
+
+#define LFS_RAM_LETTER  "/ram"
+#define LFS_ROM_LETTER  "/flash"
+#define FATFS_LETTER    "/sd"
+
+#ifndef FATFS_SPI_DMA
+#define FATFS_SPI_DMA   0
+#endif
+#define FATFS_DISKIO    fatfs_image_diskio  /* host_pico.c */
+
+struct fatfs_diskio_s;
+extern const struct fatfs_diskio_s fatfs_image_diskio;
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    Host ( Linux ) stand-in of wizio/pico/wizio.h for the VFS host build
+    Only what VFS, FatFs and LittleFS use: pico mutex, flash and sync ( host_pico.c )
+*/
+
+#ifndef _WIZIO_H
+#define _WIZIO_H
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+    typedef off_t _off_t; /* newlib */
+
+    /* pico/mutex.h */
+    typedef pthread_mutex_t mutex_t;
+    void mutex_init(mutex_t *mtx);
+    void mutex_enter_blocking(mutex_t *mtx);
+    void mutex_exit(mutex_t *mtx);
+
+    /* hardware/sync.h, nothing to disable on the host */
+    static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+    static inline void restore_interrupts(uint32_t status) { (void)status; }
+#define __not_in_flash_func(F) F
+
+    /* pico/multicore.h */
+    static inline void multicore_lockout_start_blocking(void) {}
+    static inline void multicore_lockout_end_blocking(void) {}
+
+    /* hardware/flash.h, the flash image is mapped at XIP_BASE */
+#define XIP_BASE 0x10000000
+#define XIP_NOCACHE_NOALLOC_BASE XIP_BASE
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+    void flash_range_erase(uint32_t flash_offs, size_t count);
+    void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+    /* pico/time.h, hardware/gpio.h and hardware/spi.h of fatfs_sd.c, the card is emulated ( host_sd_spi.c ) */
+    typedef uint64_t absolute_time_t;
+    absolute_time_t get_absolute_time(void);
+    static inline absolute_time_t make_timeout_time_us(uint64_t us) { return get_absolute_time() + us; }
+    static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return get_absolute_time() + ms * 1000ull; }
+    static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) { return (int64_t)(to - from); }
+    static inline void tight_loop_contents(void) {}
+
+    enum gpio_function
+    {
+        GPIO_FUNC_XIP = 0,
+        GPIO_FUNC_SPI = 1,
+    };
+#define GPIO_OUT 1
+#define GPIO_IN 0
+    static inline void gpio_init(unsigned gpio) { (void)gpio; }
+    static inline void gpio_set_function(unsigned gpio, enum gpio_function fn) { (void)gpio, (void)fn; }
+    static inline void gpio_set_dir(unsigned gpio, bool out) { (void)gpio, (void)out; }
+    static inline void gpio_pull_up(unsigned gpio) { (void)gpio; }
+    void gpio_put(unsigned gpio, bool value);
+    bool gpio_get(unsigned gpio);
+
+    typedef struct
+    {
+        volatile uint32_t dr;
+    } spi_hw_t;
+    typedef struct spi_inst spi_inst_t;
+    extern spi_inst_t *const spi0;
+    typedef enum
+    {
+        SPI_CPOL_0 = 0,
+        SPI_CPOL_1 = 1
+    } spi_cpol_t;
+    typedef enum
+    {
+        SPI_CPHA_0 = 0,
+        SPI_CPHA_1 = 1
+    } spi_cpha_t;
+    typedef enum
+    {
+        SPI_LSB_FIRST = 0,
+        SPI_MSB_FIRST = 1
+    } spi_order_t;
+    unsigned spi_init(spi_inst_t *spi, unsigned baudrate);
+    static inline void spi_set_format(spi_inst_t *spi, unsigned data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order) {}
+    spi_hw_t *spi_get_hw(spi_inst_t *spi);
+    static inline unsigned spi_get_dreq(spi_inst_t *spi, bool is_tx) { return is_tx; }
+    bool spi_is_readable(spi_inst_t *spi);
+    int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+    int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+    int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+#define PRE_INIT_FUNC(F) static __attribute__((used, section(".preinit_array"))) void (*__##F)(void) = F
+#define INLINE inline __attribute__((always_inline))
+
+#define MUTEX_PTYPE (mutex_t *)
+#define MUTEX_INIT(pM)                           \
+    pM = MUTEX_PTYPE calloc(1, sizeof(mutex_t)); \
+    mutex_init(pM)
+#define MUTEX_LOCK(pM) mutex_enter_blocking(MUTEX_PTYPE pM)
+#define MUTEX_UNLOCK(pM) mutex_exit(MUTEX_PTYPE pM)
+
+    unsigned int strhash(const void *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //_WIZIO_H
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    SPI SD card throughput of fatfs_sd.c on the emulated card ( host_sd_spi.c )
+
+    The same sectors are written and read back through fatfs_spi_diskio with 1 sector
+    per call ( CMD17 / CMD24 ) and with bursts ( CMD18 / CMD25 ), on a card without
+    latency ( protocol only ) and on a card with the timing of card_typical.
+    Time is the bus time at FATFS_SPI_BRG, cpu is the bytes the CPU moves itself.
+
+    Fails on a data error or when a burst is not faster than single sectors.
+*/
+
+#include "host_sd_spi.h"
+
+#define BENCH_BLOCKS 8192 /* 4 MB card */
+#define BENCH_SECTORS 256 /* per pass */
+#define BENCH_START 100
+
+typedef struct
+{
+    const char *name;
+    sd_card_model_t timing;
+} bench_card_t;
+
+/* assumed card timing, not measured on a card */
+static const bench_card_t bench_cards[] = {
+    {"ideal", {0, 0, 0, 0, 0}},
+    {"typical", {100, 20, 1000, 200, 500}},
+};
+
+static const UINT bench_bursts[] = {1, 4, 8, 32};
+
+static BYTE buf[32 * 512], ref[BENCH_SECTORS * 512];
+
+typedef struct
+{
+    double kbs;
+    sd_spi_stats_t st;
+} bench_result_t;
+
+static int pass(UINT burst, bool write, bench_result_t *res)
+{
+    const fatfs_diskio_t *io = &fatfs_spi_diskio;
+    sd_spi_stats(NULL, true);
+    for (UINT s = 0; s < BENCH_SECTORS; s += burst)
+    {
+        if (write)
+        {
+            if (RES_OK != io->write(0, ref + s * 512, BENCH_START + s, burst))
+                return -1;
+        }
+        else
+        {
+            if (RES_OK != io->read(0, buf, BENCH_START + s, burst) || memcmp(buf, ref + s * 512, burst * 512))
+                return -1;
+        }
+    }
+    if (write && RES_OK != io->ioctl(0, CTRL_SYNC, NULL))
+        return -1;
+    sd_spi_stats(&res->st, false);
+    res->kbs = BENCH_SECTORS * 512 / 1024.0 / (sd_spi_us(res->st.bus_bytes) / 1e6);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const fatfs_diskio_t *io = &fatfs_spi_diskio;
+    int failed = 0;
+    DWORD count = 0, block = 0;
+
+    if (sd_card_open(BENCH_BLOCKS, &bench_cards[0].timing) || io->initialize(0))
+    {
+        fprintf(stderr, "[SD] card init failed\n");
+        return 2;
+    }
+    if (io->ioctl(0, GET_SECTOR_COUNT, &count) || BENCH_BLOCKS != count || io->ioctl(0, GET_BLOCK_SIZE, &block))
+    {
+        fprintf(stderr, "[SD] ioctl failed, %u sectors\n", (unsigned)count);
+        return 2;
+    }
+
+    printf("SPI %u Hz, DMA %d, %u sectors per pass\n", FATFS_SPI_BRG, FATFS_SPI_DMA, BENCH_SECTORS);
+    printf("%-8s %-5s %5s %5s %9s %9s %9s %9s %9s %8s\n",
+           "card", "op", "burst", "cmds", "bus", "cpu", "dma", "busy", "us", "KB/s");
+    for (int c = 0; c < (int)(sizeof(bench_cards) / sizeof(bench_cards[0])); c++)
+    {
+        sd_card_model(&bench_cards[c].timing);
+        double single[2] = {0, 0};
+        for (int b = 0; b < (int)(sizeof(bench_bursts) / sizeof(bench_bursts[0])); b++)
+        {
+            UINT burst = bench_bursts[b];
+            for (int i = 0; i < (int)sizeof(ref); i++) /* new data every pass */
+                ref[i] = (BYTE)(i * 7 + (i >> 9) + c * 31 + burst);
+            for (int w = 1; w >= 0; w--)
+            {
+                bench_result_t r;
+                int err = pass(burst, w, &r);
+                printf("%-8s %-5s %5u %5u %9llu %9llu %9llu %9llu %9llu %8.1f%s\n",
+                       bench_cards[c].name, w ? "write" : "read", burst, r.st.commands,
+                       (unsigned long long)r.st.bus_bytes, (unsigned long long)r.st.cpu_bytes,
+                       (unsigned long long)r.st.dma_bytes, (unsigned long long)r.st.busy_bytes,
+                       (unsigned long long)sd_spi_us(r.st.bus_bytes), err ? 0 : r.kbs, err ? "  FAIL" : "");
+                if (err)
+                    failed++;
+                else if (1 == burst)
+                    single[w] = r.kbs;
+                else if (r.kbs <= single[w])
+                {
+                    fprintf(stderr, "[SD] %s %s burst %u is not faster than single sectors\n",
+                            bench_cards[c].name, w ? "write" : "read", burst);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    sd_card_close();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,324 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//      2021 Georgi Angelov
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+    Storage benchmark of VFS on the host
+
+    Every workload runs on every mount from empty images, so the device operations are
+    the same on each run. They are compared with a baseline file: a counter that grows
+    more than BENCH_SLACK_PCT percent is an I/O amplification regression.
+
+    vfs_bench [-b baseline] [-u]    -u: write the baseline
+*/
+
+#include "host_pico.h"
+
+#define BENCH_SLACK_PCT 10
+#define BENCH_LINE 160
+
+typedef struct bench_mount_s
+{
+    const char *path;
+    int file_size; /* sequential and random workloads */
+    int files;     /* small files */
+    int records;   /* log records */
+} bench_mount_t;
+
+static const bench_mount_t bench_mounts[] = {
+    {FATFS_LETTER, 256 * 1024, 32, 200},
+    {LFS_ROM_LETTER, 64 * 1024, 16, 100},
+    {LFS_RAM_LETTER, 4 * 1024, 8, 40},
+};
+
+static char bench_path[64];
+static uint32_t bench_seed;
+
+static uint8_t pattern(uint32_t off) { return (uint8_t)(off * 131 + (off >> 8) + 7); }
+
+static uint32_t bench_rand(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static const char *bench_file(const bench_mount_t *m, const char *name)
+{
+    snprintf(bench_path, sizeof(bench_path), "%s/%s", m->path, name);
+    return bench_path;
+}
+
+#define CHECK(X)                                                           \
+    do                                                                     \
+    {                                                                      \
+        if (!(X))                                                          \
+        {                                                                  \
+            fprintf(stderr, "[BENCH] %s:%d %s failed\n", __func__, __LINE__, #X); \
+            return -1;                                                     \
+        }                                                                  \
+    } while (0)
+
+/*
+    Workloads, 0: ok
+*/
+
+static int seq_write(const bench_mount_t *m)
+{
+    uint8_t buf[512];
+    int fd = vfs_open(bench_file(m, "seq.bin"), O_WRONLY | O_CREAT | O_TRUNC, 0);
+    CHECK(fd >= 0);
+    for (int off = 0; off < m->file_size; off += sizeof(buf))
+    {
+        for (int i = 0; i < (int)sizeof(buf); i++)
+            buf[i] = pattern(off + i);
+        CHECK(vfs_write(fd, (char *)buf, sizeof(buf)) == sizeof(buf));
+    }
+    CHECK(0 == vfs_close(fd));
+    return 0;
+}
+
+static int seq_read(const bench_mount_t *m)
+{
+    uint8_t buf[512];
+    int fd = vfs_open(bench_file(m, "seq.bin"), O_RDONLY, 0);
+    CHECK(fd >= 0);
+    for (int off = 0; off < m->file_size; off += sizeof(buf))
+    {
+        CHECK(vfs_read(fd, (char *)buf, sizeof(buf)) == sizeof(buf));
+        for (int i = 0; i < (int)sizeof(buf); i++)
+            CHECK(buf[i] == pattern(off + i));
+    }
+    CHECK(0 == vfs_read(fd, (char *)buf, sizeof(buf)));
+    CHECK(0 == vfs_close(fd));
+    return 0;
+}
+
+static int rand_read(const bench_mount_t *m)
+{
+    uint8_t buf[64];
+    int fd = vfs_open(bench_file(m, "seq.bin"), O_RDONLY, 0);
+    CHECK(fd >= 0);
+    for (int n = 0; n < 256; n++)
+    {
+        int off = bench_rand() % (m->file_size - sizeof(buf));
+        CHECK(vfs_seek(fd, off, SEEK_SET) == off);
+        CHECK(vfs_read(fd, (char *)buf, sizeof(buf)) == sizeof(buf));
+        for (int i = 0; i < (int)sizeof(buf); i++)
+            CHECK(buf[i] == pattern(off + i));
+    }
+    CHECK(0 == vfs_close(fd));
+    return 0;
+}
+
+/* Overwrite with the same pattern, so seq.bin stays valid */
+static int rand_write(const bench_mount_t *m)
+{
+    uint8_t buf[64];
+    int fd = vfs_open(bench_file(m, "seq.bin"), O_RDWR, 0);
+    CHECK(fd >= 0);
+    for (int n = 0; n < 64; n++)
+    {
+        int off = bench_rand() % (m->file_size - sizeof(buf));
+        for (int i = 0; i < (int)sizeof(buf); i++)
+            buf[i] = pattern(off + i);
+        CHECK(vfs_seek(fd, off, SEEK_SET) == off);
+        CHECK(vfs_write(fd, (char *)buf, sizeof(buf)) == sizeof(buf));
+    }
+    CHECK(0 == vfs_close(fd));
+    CHECK(0 == seq_read(m));
+    return 0;
+}
+
+static int small_files(const bench_mount_t *m)
+{
+    char name[16], buf[100];
+    struct stat st;
+    for (int n = 0; n < m->files; n++)
+    {
+        snprintf(name, sizeof(name), "s%02d.txt", n);
+        memset(buf, 'a' + n % 26, sizeof(buf));
+        int fd = vfs_open(bench_file(m, name), O_WRONLY | O_CREAT | O_TRUNC, 0);
+        CHECK(fd >= 0);
+        CHECK(vfs_write(fd, buf, sizeof(buf)) == sizeof(buf));
+        CHECK(0 == vfs_close(fd));
+    }
+    for (int n = 0; n < m->files; n++)
+    {
+        snprintf(name, sizeof(name), "s%02d.txt", n);
+        CHECK(0 == vfs_stat(bench_file(m, name), &st) && st.st_size == sizeof(buf));
+        CHECK(0 == vfs_unlink(bench_path));
+    }
+    return 0;
+}
+
+/* Append a record and make it durable, as a data logger does */
+static int sync_log(const bench_mount_t *m)
+{
+    char rec[32];
+    struct stat st;
+    for (int n = 0; n < m->records; n++)
+    {
+        snprintf(rec, sizeof(rec), "%08d,%08u,%08u\n", n, bench_rand(), bench_rand());
+        int fd = vfs_open(bench_file(m, "log.csv"), O_WRONLY | O_CREAT | O_APPEND, 0);
+        CHECK(fd >= 0);
+        CHECK(vfs_write(fd, rec, 27) == 27);
+        CHECK(0 == vfs_close(fd));
+        CHECK(0 == vfs_ioctl(m->path, VFS_IOCTL_SYNC, NULL));
+    }
+    CHECK(0 == vfs_stat(bench_file(m, "log.csv"), &st) && st.st_size == 27 * m->records);
+    CHECK(0 == vfs_unlink(bench_path));
+    return 0;
+}
+
+typedef struct bench_workload_s
+{
+    const char *name;
+    int (*run)(const bench_mount_t *m);
+} bench_workload_t;
+
+static const bench_workload_t bench_workloads[] = {
+    {"seq_write", seq_write},
+    {"seq_read", seq_read},
+    {"rand_read", rand_read},
+    {"rand_write", rand_write},
+    {"small_files", small_files},
+    {"sync_log", sync_log},
+};
+
+/*
+    Baseline
+*/
+
+#define BENCH_COUNTERS 7
+
+static void bench_counters(const vfs_io_stats_t *io, uint32_t *c)
+{
+    c[0] = io->reads;
+    c[1] = io->read_bytes;
+    c[2] = io->writes;
+    c[3] = io->write_bytes;
+    c[4] = io->erases;
+    c[5] = io->erase_bytes;
+    c[6] = io->syncs;
+}
+
+static const char *bench_counter_name[BENCH_COUNTERS] = {"reads", "read_bytes", "writes", "write_bytes", "erases", "erase_bytes", "syncs"};
+
+/* 0: no baseline line, 1: within, -1: regression */
+static int bench_compare(FILE *base, const char *mount, const char *workload, const uint32_t *c)
+{
+    char line[BENCH_LINE], bm[32], bw[32];
+    uint32_t b[BENCH_COUNTERS];
+    if (NULL == base)
+        return 0;
+    rewind(base);
+    while (fgets(line, sizeof(line), base))
+    {
+        if (9 != sscanf(line, "%31s %31s %u %u %u %u %u %u %u", bm, bw, &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6]))
+            continue;
+        if (strcmp(bm, mount) || strcmp(bw, workload))
+            continue;
+        int res = 1;
+        for (int i = 0; i < BENCH_COUNTERS; i++)
+            if ((uint64_t)c[i] * 100 > (uint64_t)b[i] * (100 + BENCH_SLACK_PCT) + 100)
+            {
+                fprintf(stderr, "[BENCH] %s %s %s %u > baseline %u\n", mount, workload, bench_counter_name[i], c[i], b[i]);
+                res = -1;
+            }
+        return res;
+    }
+    return 0;
+}
+
+static uint64_t bench_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+    const char *baseline = NULL;
+    bool update = false;
+    int opt, failed = 0;
+    while ((opt = getopt(argc, argv, "b:u")) != -1)
+    {
+        if ('b' == opt)
+            baseline = optarg;
+        else if ('u' == opt)
+            update = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [-b baseline] [-u]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (host_flash_open("flash.img") || host_sd_open("sd.img", 16384))
+    {
+        fprintf(stderr, "[BENCH] no images\n");
+        return 2;
+    }
+    if (vfs_init())
+    {
+        fprintf(stderr, "[BENCH] vfs_init failed\n");
+        return 2;
+    }
+
+    FILE *base = NULL, *out = NULL;
+    if (baseline && !update)
+        base = fopen(baseline, "r");
+    if (baseline && update && NULL == (out = fopen(baseline, "w")))
+        return 2;
+    if (out)
+        fprintf(out, "# mount workload reads read_bytes writes write_bytes erases erase_bytes syncs\n");
+
+    printf("%-8s %-12s %8s %10s %8s %10s %7s %10s %6s %9s\n",
+           "mount", "workload", "reads", "rd_bytes", "writes", "wr_bytes", "erases", "er_bytes", "syncs", "us");
+    for (int i = 0; i < (int)(sizeof(bench_mounts) / sizeof(bench_mounts[0])); i++)
+    {
+        const bench_mount_t *m = &bench_mounts[i];
+        bench_seed = 1;
+        for (int w = 0; w < (int)(sizeof(bench_workloads) / sizeof(bench_workloads[0])); w++)
+        {
+            vfs_io_stats_t io;
+            uint32_t c[BENCH_COUNTERS];
+            vfs_ioctl(m->path, VFS_IOCTL_IO_RESET, NULL);
+            uint64_t t = bench_us();
+            int err = bench_workloads[w].run(m);
+            t = bench_us() - t;
+            if (vfs_ioctl(m->path, VFS_IOCTL_IO_STATS, &io))
+                err = -1;
+            bench_counters(&io, c);
+            printf("%-8s %-12s %8u %10u %8u %10u %7u %10u %6u %9u%s\n", m->path, bench_workloads[w].name,
+                   c[0], c[1], c[2], c[3], c[4], c[5], c[6], (unsigned)t, err ? "  FAIL" : "");
+            if (out)
+                fprintf(out, "%s %s %u %u %u %u %u %u %u\n", m->path, bench_workloads[w].name, c[0], c[1], c[2], c[3], c[4], c[5], c[6]);
+            if (err || bench_compare(base, m->path, bench_workloads[w].name, c) < 0)
+                failed++;
+        }
+    }
+
+    if (base)
+        fclose(base);
+    if (out)
+        fclose(out);
+    host_sd_close();
+    host_flash_close();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+// -------------------------------------------------- //
+// This file is autogenerated by pioasm; do not edit! //
+// -------------------------------------------------- //
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// -------- //
+// sdio_cmd //
+// -------- //
+
+#define sdio_cmd_wrap_target 0
+#define sdio_cmd_wrap 13
+
+static const uint16_t sdio_cmd_program_instructions[] = {
+            //     .wrap_target
+    0xb045, //  0: mov    y, status       side 1     
+    0x0080, //  1: jmp    y--, 0          side 0     
+    0x7030, //  2: out    x, 16           side 1     
+    0x6050, //  3: out    y, 16           side 0     
+    0xf081, //  4: set    pindirs, 1      side 1     
+    0x6001, //  5: out    pins, 1         side 0     
+    0x1045, //  6: jmp    x--, 5          side 1     
+    0xe080, //  7: set    pindirs, 0      side 0     
+    0x1060, //  8: jmp    !y, 0           side 1     
+    0xa042, //  9: nop                    side 0     
+    0x10c9, // 10: jmp    pin, 9          side 1     
+    0xa042, // 11: nop                    side 0     
+    0x5001, // 12: in     pins, 1         side 1     
+    0x008c, // 13: jmp    y--, 12         side 0     
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program sdio_cmd_program = {
+    .instructions = sdio_cmd_program_instructions,
+    .length = 14,
+    .origin = -1,
+};
+
+static inline pio_sm_config sdio_cmd_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + sdio_cmd_wrap_target, offset + sdio_cmd_wrap);
+    sm_config_set_sideset(&c, 1, false, false);
+    return c;
+}
+#endif
+
+// --------- //
+// sdio_data //
+// --------- //
+
+#define sdio_data_wrap_target 0
+#define sdio_data_wrap 16
+
+#define sdio_data_offset_rx 7u
+
+static const uint16_t sdio_data_program_instructions[] = {
+    0x6020, //  0: out    x, 32                      
+    0xe08f, //  1: set    pindirs, 15                
+    0x2000, //  2: wait   0 gpio, 0                  
+    0x2080, //  3: wait   1 gpio, 0                  
+    0x6004, //  4: out    pins, 4                    
+    0x0042, //  5: jmp    x--, 2                     
+    0xe080, //  6: set    pindirs, 0                 
+    0x80e0, //  7: pull   ifempty block              
+    0xa027, //  8: mov    x, osr                     
+    0x2000, //  9: wait   0 gpio, 0                  
+    0x2080, // 10: wait   1 gpio, 0                  
+    0x00c9, // 11: jmp    pin, 9                     
+    0x2000, // 12: wait   0 gpio, 0                  
+    0x2080, // 13: wait   1 gpio, 0                  
+    0x4004, // 14: in     pins, 4                    
+    0x004c, // 15: jmp    x--, 12                    
+    0x0008, // 16: jmp    8                          
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program sdio_data_program = {
+    .instructions = sdio_data_program_instructions,
+    .length = 17,
+    .origin = -1,
+};
+
+static inline pio_sm_config sdio_data_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + sdio_data_wrap_target, offset + sdio_data_wrap);
+    return c;
+}
+#endif
@@ -175,6 +175,9 @@ void vPortGetHeapStats( HeapStats_t * pxHeapStats );
  */
 void * pvPortMalloc( size_t xSize ) PRIVILEGED_FUNCTION;
 void vPortFree( void * pv ) PRIVILEGED_FUNCTION;
+void * pvPortResize( void * pv, size_t xWantedSize ) PRIVILEGED_FUNCTION;          /* heap_4 */
+void * pvPortMallocAligned( size_t xAlignment, size_t xWantedSize ) PRIVILEGED_FUNCTION; /* heap_4 */
+size_t xPortGetBlockSize( void * pv ) PRIVILEGED_FUNCTION;                          /* heap_4 */
 void vPortInitialiseBlocks( void ) PRIVILEGED_FUNCTION;
 size_t xPortGetFreeHeapSize( void ) PRIVILEGED_FUNCTION;
 size_t xPortGetMinimumEverFreeHeapSize( void ) PRIVILEGED_FUNCTION;
@@ -77,12 +77,53 @@
 /*-----------------------------------------------------------*/
 
 
+/* Multicore. This is not an SMP port: the kernel keeps one pxCurrentTCB and
+ * every task runs on core 0. Tasks on core 1, core affinity masks and a
+ * pthread to core mapping are not supported, that needs the FreeRTOS SMP
+ * kernel and its RP2040 port.
+ * With configUSE_CORE1 1 core 1 runs the jobs given with xPortRunOnCore1() to
+ * completion, one after the other. Both cores take the same hardware spin lock
+ * in the critical sections, so a job may use the FromISR API,
+ * portYIELD_FROM_ISR() there reaches core 0 over the SIO FIFO.
+ * A job must not use the task level API or the heap: these suspend the
+ * scheduler and yield with PendSV, which would switch core 1 into the context
+ * of the core 0 task. portASSERT_SCHEDULER_CORE() stops them with a panic,
+ * also without configASSERT. */
+    #ifndef configUSE_CORE1
+        #define configUSE_CORE1    0
+    #endif
+
+    #ifndef configCORE1_QUEUE_LENGTH
+        #define configCORE1_QUEUE_LENGTH    8 /* power of 2 */
+    #endif
+
+    #define portNUM_PROCESSORS    2
+    #define portGET_CORE_ID()     ( *( ( volatile uint32_t * ) 0xd0000000 ) ) /* SIO CPUID */
+
+    #if ( configUSE_CORE1 == 1 )
+        extern void vPortSchedulerCoreError( void );
+        #define portASSERT_SCHEDULER_CORE()            \
+    do {                                               \
+        if( portGET_CORE_ID() != 0 )                   \
+        {                                              \
+            vPortSchedulerCoreError();                 \
+        }                                              \
+    } while( 0 )
+    #else
+        #define portASSERT_SCHEDULER_CORE()    /* core 1 runs no kernel code */
+    #endif
+
+    extern BaseType_t xPortRunOnCore1( TaskFunction_t pxCode,
+                                       void * pvParameters );
+/*-----------------------------------------------------------*/
+
 /* Scheduler utilities. */
     extern void vPortYield( void );
+    extern void vPortYieldFromISR( void );
     #define portNVIC_INT_CTRL_REG     ( *( ( volatile uint32_t * ) 0xe000ed04 ) )
     #define portNVIC_PENDSVSET_BIT    ( 1UL << 28UL )
     #define portYIELD()                                 vPortYield()
-    #define portEND_SWITCHING_ISR( xSwitchRequired )    if( xSwitchRequired ) portNVIC_INT_CTRL_REG = portNVIC_PENDSVSET_BIT
+    #define portEND_SWITCHING_ISR( xSwitchRequired )    if( xSwitchRequired ) vPortYieldFromISR()
     #define portYIELD_FROM_ISR( x )                     portEND_SWITCHING_ISR( x )
 /*-----------------------------------------------------------*/
 
@@ -90,8 +131,8 @@
 /* Critical section management. */
     extern void vPortEnterCritical( void );
     extern void vPortExitCritical( void );
-    extern uint32_t ulSetInterruptMaskFromISR( void ) __attribute__( ( naked ) );
-    extern void vClearInterruptMaskFromISR( uint32_t ulMask )  __attribute__( ( naked ) );
+    extern uint32_t ulSetInterruptMaskFromISR( void );
+    extern void vClearInterruptMaskFromISR( uint32_t ulMask );
 
     #define portSET_INTERRUPT_MASK_FROM_ISR()         ulSetInterruptMaskFromISR()
     #define portCLEAR_INTERRUPT_MASK_FROM_ISR( x )    vClearInterruptMaskFromISR( x )
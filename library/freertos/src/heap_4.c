@@ -47,6 +47,11 @@
 
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
+/* The heap suspends the scheduler, so it is not for the cores without one. */
+#ifndef portASSERT_SCHEDULER_CORE
+    #define portASSERT_SCHEDULER_CORE()
+#endif
+
 #if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
     #error This file must not be used if configSUPPORT_DYNAMIC_ALLOCATION is 0
 #endif
@@ -120,6 +125,8 @@ void * pvPortMalloc( size_t xWantedSize )
     BlockLink_t * pxBlock, * pxPreviousBlock, * pxNewBlockLink;
     void * pvReturn = NULL;
 
+    portASSERT_SCHEDULER_CORE();
+
     vTaskSuspendAll();
     {
         /* If this is the first call to malloc then the heap will require
@@ -280,6 +287,8 @@ void vPortFree( void * pv )
     uint8_t * puc = ( uint8_t * ) pv;
     BlockLink_t * pxLink;
 
+    portASSERT_SCHEDULER_CORE();
+
     if( pv != NULL )
     {
         /* The memory being freed will have an BlockLink_t structure immediately
@@ -324,6 +333,151 @@ void vPortFree( void * pv )
 }
 /*-----------------------------------------------------------*/
 
+/*
+ * Resizes an allocated block without moving it.  A smaller block gives its
+ * tail back to the free list, a larger block takes the free block that
+ * directly follows it.  Returns pv on success or NULL if the block has to
+ * move, in which case it is left untouched.
+ */
+void * pvPortResize( void * pv, size_t xWantedSize )
+{
+    BlockLink_t * pxLink, * pxIterator, * pxNext, * pxNewBlockLink;
+    size_t xBlockSize;
+    void * pvReturn = NULL;
+
+    portASSERT_SCHEDULER_CORE();
+
+    if( ( pv == NULL ) || ( xWantedSize == 0 ) || ( ( xWantedSize & xBlockAllocatedBit ) != 0 ) )
+    {
+        return NULL;
+    }
+
+    /* Same rounding as pvPortMalloc(). */
+    xWantedSize += xHeapStructSize;
+    if( ( xWantedSize & portBYTE_ALIGNMENT_MASK ) != 0x00 )
+    {
+        xWantedSize += ( portBYTE_ALIGNMENT - ( xWantedSize & portBYTE_ALIGNMENT_MASK ) );
+    }
+
+    pxLink = ( void * ) ( ( ( uint8_t * ) pv ) - xHeapStructSize );
+    configASSERT( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 );
+
+    vTaskSuspendAll();
+    {
+        xBlockSize = pxLink->xBlockSize & ~xBlockAllocatedBit;
+
+        if( xWantedSize > xBlockSize )
+        {
+            /* Look for a free block starting right at the end of this one. */
+            pxNext = ( void * ) ( ( ( uint8_t * ) pxLink ) + xBlockSize );
+            for( pxIterator = &xStart; pxIterator->pxNextFreeBlock < pxNext; pxIterator = pxIterator->pxNextFreeBlock )
+            {
+                /* Nothing to do here, just iterate to the right position. */
+            }
+
+            if( ( pxIterator->pxNextFreeBlock == pxNext ) && ( pxNext != pxEnd ) && ( ( xBlockSize + pxNext->xBlockSize ) >= xWantedSize ) )
+            {
+                /* Take the whole neighbour, the surplus is split off below. */
+                pxIterator->pxNextFreeBlock = pxNext->pxNextFreeBlock;
+                xFreeBytesRemaining -= pxNext->xBlockSize;
+                xBlockSize += pxNext->xBlockSize;
+                pvReturn = pv;
+            }
+        }
+        else
+        {
+            pvReturn = pv;
+        }
+
+        if( pvReturn != NULL )
+        {
+            if( ( xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+            {
+                pxNewBlockLink = ( void * ) ( ( ( uint8_t * ) pxLink ) + xWantedSize );
+                pxNewBlockLink->xBlockSize = xBlockSize - xWantedSize;
+                xBlockSize = xWantedSize;
+                xFreeBytesRemaining += pxNewBlockLink->xBlockSize;
+                prvInsertBlockIntoFreeList( pxNewBlockLink );
+            }
+
+            pxLink->xBlockSize = xBlockSize | xBlockAllocatedBit;
+
+            if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+            {
+                xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+            }
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Allocates a block whose address is a multiple of xAlignment (a power of
+ * two).  The block is taken with enough slack, the unused head is given back
+ * as a free block of its own and the unused tail by pvPortResize().
+ */
+void * pvPortMallocAligned( size_t xAlignment, size_t xWantedSize )
+{
+    BlockLink_t * pxLink, * pxNewBlockLink;
+    size_t xOffset;
+    uint8_t * puc;
+
+    if( xAlignment <= portBYTE_ALIGNMENT )
+    {
+        return pvPortMalloc( xWantedSize );
+    }
+
+    if( ( xAlignment & ( xAlignment - 1 ) ) != 0 )
+    {
+        return NULL;
+    }
+
+    puc = pvPortMalloc( xWantedSize + xAlignment + heapMINIMUM_BLOCK_SIZE );
+    if( puc == NULL )
+    {
+        return NULL;
+    }
+
+    xOffset = ( xAlignment - ( ( size_t ) puc & ( xAlignment - 1 ) ) ) & ( xAlignment - 1 );
+    if( xOffset != 0 )
+    {
+        /* The head has to be big enough to live as a free block. */
+        while( xOffset < heapMINIMUM_BLOCK_SIZE )
+        {
+            xOffset += xAlignment;
+        }
+
+        vTaskSuspendAll();
+        {
+            pxLink = ( void * ) ( puc - xHeapStructSize );
+            pxNewBlockLink = ( void * ) ( puc + xOffset - xHeapStructSize );
+            pxNewBlockLink->xBlockSize = ( ( pxLink->xBlockSize & ~xBlockAllocatedBit ) - xOffset ) | xBlockAllocatedBit;
+            pxNewBlockLink->pxNextFreeBlock = NULL;
+            pxLink->xBlockSize = xOffset;
+            xFreeBytesRemaining += xOffset;
+            prvInsertBlockIntoFreeList( pxLink );
+        }
+        ( void ) xTaskResumeAll();
+
+        puc += xOffset;
+    }
+
+    pvPortResize( puc, xWantedSize );
+    return puc;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetBlockSize( void * pv )
+{
+    BlockLink_t * pxLink = ( void * ) ( ( ( uint8_t * ) pv ) - xHeapStructSize );
+
+    return ( pxLink->xBlockSize & ~xBlockAllocatedBit ) - xHeapStructSize;
+}
+/*-----------------------------------------------------------*/
+
 size_t xPortGetFreeHeapSize( void )
 {
     return xFreeBytesRemaining;
@@ -32,6 +32,11 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+/* Pico SDK includes. */
+#include "hardware/sync.h"
+#include "hardware/irq.h"
+#include "pico/multicore.h"
+
 /* Constants required to manipulate the NVIC. */
 #define portNVIC_SYSTICK_CTRL_REG             ( *( ( volatile uint32_t * ) 0xe000e010 ) )
 #define portNVIC_SYSTICK_LOAD_REG             ( *( ( volatile uint32_t * ) 0xe000e014 ) )
@@ -81,6 +86,7 @@ void vPortSetupTimerInterrupt( void );
  */
 void xPortPendSVHandler( void ) __attribute__( ( naked ) );
 void xPortSysTickHandler( void );
+void vPortSwitchContext( void );
 void vPortSVCHandler( void );
 
 /*
@@ -99,6 +105,39 @@ static void prvTaskExitError( void );
  * variable. */
 static UBaseType_t uxCriticalNesting = 0xaaaaaaaa;
 
+#if ( configUSE_CORE1 == 1 )
+
+/*
+ * The kernel lock. Critical sections and the FromISR masks of both cores take
+ * the same hardware spin lock, nested per core. Without core 1 the disabled
+ * interrupts of core 0 are enough.
+ */
+    #ifndef configKERNEL_SPINLOCK
+        #define configKERNEL_SPINLOCK    PICO_SPINLOCK_ID_OS1
+    #endif
+
+    static UBaseType_t uxLockNesting[ portNUM_PROCESSORS ];
+
+/*
+ * Jobs for core 1, the SIO FIFO from core 0 carries only a doorbell word.
+ * The FIFO from core 1 carries yield requests to the core 0 scheduler.
+ */
+    typedef struct xCORE1_JOB
+    {
+        TaskFunction_t pxCode;
+        void * pvParameters;
+    } xCore1Job_t;
+
+    static xCore1Job_t xCore1Jobs[ configCORE1_QUEUE_LENGTH ];
+    static volatile uint32_t ulCore1Head, ulCore1Tail;
+
+    #define portCORE1_DOORBELL    0xC0DE0001UL
+    #define portCORE1_YIELD       0xC0DE0002UL
+
+    static void prvCore1Main( void );
+    static void prvCore0FifoHandler( void );
+#endif /* configUSE_CORE1 */
+
 /*-----------------------------------------------------------*/
 
 /*
@@ -223,6 +262,18 @@ BaseType_t xPortStartScheduler( void )
      * here already. */
     vPortSetupTimerInterrupt();
 
+    #if ( configUSE_CORE1 == 1 )
+        {
+            /* The launch handshake uses the FIFO, the IRQ is installed after it. */
+            multicore_launch_core1( prvCore1Main );
+            multicore_fifo_drain();
+            multicore_fifo_clear_irq();
+            irq_set_exclusive_handler( SIO_IRQ_PROC0, prvCore0FifoHandler );
+            irq_set_priority( SIO_IRQ_PROC0, portMIN_INTERRUPT_PRIORITY );
+            irq_set_enabled( SIO_IRQ_PROC0, true );
+        }
+    #endif /* configUSE_CORE1 */
+
     /* Initialise the critical nesting count ready for the first task. */
     uxCriticalNesting = 0;
 
@@ -253,6 +304,8 @@ void vPortEndScheduler( void )
 
 void vPortYield( void )
 {
+    portASSERT_SCHEDULER_CORE();
+
     /* Set a PendSV to request a context switch. */
     portNVIC_INT_CTRL_REG = portNVIC_PENDSVSET_BIT;
 
@@ -263,9 +316,53 @@ void vPortYield( void )
 }
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_CORE1 == 1 )
+
+    static inline void prvKernelLock( void )
+    {
+        uint32_t ulCore = portGET_CORE_ID();
+
+        /* Interrupts are already disabled on this core. */
+        if( uxLockNesting[ ulCore ]++ == 0 )
+        {
+            spin_lock_unsafe_blocking( spin_lock_instance( configKERNEL_SPINLOCK ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static inline void prvKernelUnlock( void )
+    {
+        uint32_t ulCore = portGET_CORE_ID();
+
+        configASSERT( uxLockNesting[ ulCore ] );
+
+        if( --uxLockNesting[ ulCore ] == 0 )
+        {
+            spin_unlock_unsafe( spin_lock_instance( configKERNEL_SPINLOCK ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    /* Task level API or heap from a core 1 job, see portmacro.h */
+    void vPortSchedulerCoreError( void )
+    {
+        panic( "FreeRTOS: task API or heap used on core %u", ( unsigned ) portGET_CORE_ID() );
+    }
+
+#else /* configUSE_CORE1 */
+
+    #define prvKernelLock()
+    #define prvKernelUnlock()
+
+#endif /* configUSE_CORE1 */
+/*-----------------------------------------------------------*/
+
 void vPortEnterCritical( void )
 {
+    /* Core 1 jobs use the FromISR masks only. */
+    portASSERT_SCHEDULER_CORE();
     portDISABLE_INTERRUPTS();
+    prvKernelLock();
     uxCriticalNesting++;
     __asm volatile ( "dsb" ::: "memory" );
     __asm volatile ( "isb" );
@@ -276,6 +373,7 @@ void vPortExitCritical( void )
 {
     configASSERT( uxCriticalNesting );
     uxCriticalNesting--;
+    prvKernelUnlock();
 
     if( uxCriticalNesting == 0 )
     {
@@ -286,25 +384,137 @@ void vPortExitCritical( void )
 
 uint32_t ulSetInterruptMaskFromISR( void )
 {
-    __asm volatile (
-        " mrs r0, PRIMASK	\n"
-        " cpsid i			\n"
-        " bx lr				  "
-        ::: "memory"
-        );
+    uint32_t ulMask = save_and_disable_interrupts();
+
+    prvKernelLock();
+    return ulMask;
 }
 /*-----------------------------------------------------------*/
 
-void vClearInterruptMaskFromISR( __attribute__( ( unused ) ) uint32_t ulMask )
+void vClearInterruptMaskFromISR( uint32_t ulMask )
 {
-    __asm volatile (
-        " msr PRIMASK, r0	\n"
-        " bx lr				  "
-        ::: "memory"
-        );
+    prvKernelUnlock();
+    restore_interrupts( ulMask );
+}
+/*-----------------------------------------------------------*/
+
+/* Called from PendSV, the ready lists may be changed from core 1. */
+void vPortSwitchContext( void )
+{
+    uint32_t ulMask = ulSetInterruptMaskFromISR();
+
+    vTaskSwitchContext();
+    vClearInterruptMaskFromISR( ulMask );
+}
+/*-----------------------------------------------------------*/
+
+void vPortYieldFromISR( void )
+{
+    if( portGET_CORE_ID() == 0 )
+    {
+        portNVIC_INT_CTRL_REG = portNVIC_PENDSVSET_BIT;
+    }
+
+    #if ( configUSE_CORE1 == 1 )
+        else if( multicore_fifo_wready() )
+        {
+            /* A full FIFO holds yield requests already. */
+            sio_hw->fifo_wr = portCORE1_YIELD;
+            __sev();
+        }
+    #endif /* configUSE_CORE1 */
+
+    /* Without the core 1 support the switch happens at the next tick. */
 }
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_CORE1 == 1 )
+
+    BaseType_t xPortRunOnCore1( TaskFunction_t pxCode,
+                                void * pvParameters )
+    {
+        BaseType_t xReturn = pdFAIL;
+        uint32_t ulMask = ulSetInterruptMaskFromISR();
+
+        if( ulCore1Head - ulCore1Tail < configCORE1_QUEUE_LENGTH )
+        {
+            xCore1Jobs[ ulCore1Head & ( configCORE1_QUEUE_LENGTH - 1 ) ].pxCode = pxCode;
+            xCore1Jobs[ ulCore1Head & ( configCORE1_QUEUE_LENGTH - 1 ) ].pvParameters = pvParameters;
+            ulCore1Head++;
+            xReturn = pdPASS;
+        }
+
+        vClearInterruptMaskFromISR( ulMask );
+
+        /* Core 1 sleeps in the FIFO read when the queue is empty, a job given
+         * from core 1 itself is seen by its next look at the queue. */
+        if( ( xReturn == pdPASS ) && ( portGET_CORE_ID() == 0 ) && multicore_fifo_wready() )
+        {
+            sio_hw->fifo_wr = portCORE1_DOORBELL;
+            __sev();
+        }
+
+        return xReturn;
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvCore1Main( void )
+    {
+        xCore1Job_t xJob;
+        BaseType_t xHaveJob;
+        uint32_t ulMask;
+
+        for( ; ; )
+        {
+            ulMask = ulSetInterruptMaskFromISR();
+            xHaveJob = ( ulCore1Head != ulCore1Tail );
+
+            if( xHaveJob != pdFALSE )
+            {
+                xJob = xCore1Jobs[ ulCore1Tail & ( configCORE1_QUEUE_LENGTH - 1 ) ];
+                ulCore1Tail++;
+            }
+
+            vClearInterruptMaskFromISR( ulMask );
+
+            if( xHaveJob != pdFALSE )
+            {
+                xJob.pxCode( xJob.pvParameters );
+            }
+            else
+            {
+                ( void ) multicore_fifo_pop_blocking(); /* doorbell */
+            }
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvCore0FifoHandler( void )
+    {
+        /* Every word from core 1 is a yield request. */
+        while( multicore_fifo_rvalid() )
+        {
+            ( void ) sio_hw->fifo_rd;
+        }
+
+        multicore_fifo_clear_irq();
+        portNVIC_INT_CTRL_REG = portNVIC_PENDSVSET_BIT;
+    }
+
+#else /* configUSE_CORE1 */
+
+    BaseType_t xPortRunOnCore1( TaskFunction_t pxCode,
+                                void * pvParameters )
+    {
+        ( void ) pxCode;
+        ( void ) pvParameters;
+
+        return pdFAIL;
+    }
+
+#endif /* configUSE_CORE1 */
+/*-----------------------------------------------------------*/
+
 void xPortPendSVHandler( void )
 {
     /* This is a naked function. */
@@ -327,9 +537,7 @@ void xPortPendSVHandler( void )
         " 	stmia r0!, {r4-r7}					\n"
         "										\n"
         "	push {r3, r14}						\n"
-        "	cpsid i								\n"
-        "	bl vTaskSwitchContext				\n"
-        "	cpsie i								\n"
+        "	bl vPortSwitchContext				\n"
         "	pop {r2, r3}						\n"/* lr goes in r3. r2 now holds tcb pointer. */
         "										\n"
         "	ldr r1, [r2]						\n"
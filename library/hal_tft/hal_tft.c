@@ -19,45 +19,342 @@
 /****************************************************************************************
  * 
    This library is helper for SPI(DMA) and TFT displays as ST77xx, ILI93xx
+   or parallel 8080 bus ( PIO + DMA ) for ILI9341, ILI9488, ST7796
    
 ****************************************************************************************/
 
+#include <errno.h>
+#include <hardware/irq.h>
 #include "hal_tft.h"
+#if TFT_BUS == TFT_BUS_8080
+#include "hal_tft_8080.pio.h"
+#endif
+
+#define TFT_DMA_IRQ_INDEX (TFT_DMA_IRQ - DMA_IRQ_0)
 
 static int dma_channel_tx;
 static dma_channel_config dma_cfg_tx;
 
+/*
+    Bus: a run of COUNT items of BITS with one DC level, the items go from the CPU ( bus_push )
+    or from the DMA to bus_fifo at bus_dreq. SPI sets DC and the frame size when idle,
+    the 8080 PIO takes a header word and switches DC in the stream
+*/
+
+uint8_t tft_dc;
+static volatile void *bus_fifo;
+static uint bus_dreq;
+
+#if TFT_BUS == TFT_BUS_8080
+
+static uint bus_sm;
+
+static inline void bus_idle(void)
+{
+    uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + bus_sm);
+    TFT_PIO->fdebug = stall;
+    while (!(TFT_PIO->fdebug & stall)) // at the header pull
+        tight_loop_contents();
+}
+
+static inline void bus_begin(int dc, int bits, uint32_t count)
+{
+    pio_sm_put_blocking(TFT_PIO, bus_sm, (uint32_t)dc << 31 | (uint32_t)(bits == 16) << 30 | (count - 1));
+}
+
+static inline void bus_push(uint16_t v, int bits)
+{
+    pio_sm_put_blocking(TFT_PIO, bus_sm, bits == 16 ? v * 0x00010001u : (v & 0xFF) * 0x01010101u);
+}
+
+#else
+
+static inline void bus_idle(void)
+{
+    while (spi_get_hw(TFT_SPI)->sr & SPI_SSPSR_BSY_BITS)
+        tight_loop_contents();
+}
+
+static inline void bus_begin(int dc, int bits, uint32_t count)
+{
+    (void)count;
+    bus_idle();
+    if (TFT_DC > -1)
+        gpio_put(TFT_DC, dc);
+    spi_set_format(TFT_SPI_FORMAT(bits));
+}
+
+static inline void bus_push(uint16_t v, int bits)
+{
+    (void)bits;
+    while (!spi_is_writable(TFT_SPI))
+        tight_loop_contents();
+    spi_get_hw(TFT_SPI)->dr = v;
+}
+
+#endif // TFT_BUS
+
+/*
+    Async blit: the control channel writes one block { count, address } to the al3 registers
+    of the data channel per row, the data channel chains back. A null block ends the chain
+    and raises the IRQ ( irq quiet ), the IRQ sets the window of the next part
+*/
+
+typedef struct
+{
+    const uint16_t *src;
+    tft_rect_t r;
+} blit_part_t;
+
+static int dma_channel_ctrl;
+static uint32_t blit_blocks[(TFT_HEIGHT + 1) * 2];
+static blit_part_t blit_part[TFT_DIRTY_RECTS];
+static int blit_parts, blit_next, blit_stride;
+static tft_done_cb blit_cb;
+static void *blit_arg;
+static volatile bool blit_busy;
+
+static tft_batch_t *batch_run;
+
+static const uint16_t *fb_pixels;
+static int fb_stride;
+static tft_rect_t fb_dirty[TFT_DIRTY_RECTS];
+static int fb_dirty_count;
+
+static void tft_command(uint8_t cmd, const uint8_t *arg, int n)
+{
+    bus_begin(0, 8, 1);
+    bus_push(cmd, 8);
+    if (n > 0)
+    {
+        bus_begin(1, 8, n);
+        while (n--)
+            bus_push(*arg++, 8);
+    }
+}
+
+/* CS is low, the pixels follow with bus_begin(1, 16, w * h) */
+static void tft_window(int x, int y, int w, int h)
+{
+    uint8_t arg[4];
+
+    x += TFT_X_OFFSET;
+    y += TFT_Y_OFFSET;
+    arg[0] = x >> 8;
+    arg[1] = x;
+    arg[2] = (x + w - 1) >> 8;
+    arg[3] = x + w - 1;
+    tft_command(TFT_CMD_CASET, arg, 4);
+
+    arg[0] = y >> 8;
+    arg[1] = y;
+    arg[2] = (y + h - 1) >> 8;
+    arg[3] = y + h - 1;
+    tft_command(TFT_CMD_RASET, arg, 4);
+
+    tft_command(TFT_CMD_RAMWR, NULL, 0);
+}
+
+static void blit_start(void)
+{
+    blit_part_t *p = &blit_part[blit_next++];
+    uint32_t *cb = blit_blocks;
+
+    TFT_CS_ENABLE();
+    tft_window(p->r.x, p->r.y, p->r.w, p->r.h);
+    bus_begin(1, 16, p->r.w * p->r.h);
+
+    if (p->r.w == blit_stride) // one block, the rows are contiguous
+    {
+        *cb++ = p->r.w * p->r.h;
+        *cb++ = (uint32_t)p->src;
+    }
+    else
+    {
+        for (int row = 0; row < p->r.h; row++)
+        {
+            *cb++ = p->r.w;
+            *cb++ = (uint32_t)(p->src + row * blit_stride);
+        }
+    }
+    *cb++ = 0;
+    *cb++ = 0;
+
+    dma_channel_config c = dma_channel_get_default_config(dma_channel_ctrl);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 3); // 2 words: al3_transfer_count, al3_read_addr_trig
+    dma_channel_configure(dma_channel_ctrl, &c, &dma_hw->ch[dma_channel_tx].al3_transfer_count, blit_blocks, 2, true);
+}
+
+/*
+    Batch: the control channel writes 4 words { ctrl, read, write, count } per block to the al1
+    registers of the data channel, the data channel chains back. Inline items ( header, command,
+    arguments ) are words in the batch, pixels are read by the DMA from the caller.
+    A null block ( count 0 ) raises the IRQ, its read word is the SPI mode of the next part or END
+*/
+
+#define BATCH_END 0xFFFFFFFF
+#define BATCH_NONE 0xFF
+
+static void batch_next(const tft_block_t *k)
+{
+    dma_channel_config c = dma_channel_get_default_config(dma_channel_ctrl);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 4); // 4 words: al1_ctrl, al1_read_addr, al1_write_addr, al1_transfer_count_trig
+    dma_channel_configure(dma_channel_ctrl, &c, &dma_hw->ch[dma_channel_tx].al1_ctrl, k, 4, true);
+}
+
+/* true: next part started */
+static bool batch_irq(void)
+{
+    const tft_block_t *k = (const tft_block_t *)dma_hw->ch[dma_channel_ctrl].read_addr - 1; // the null block
+    if (k->read == BATCH_END)
+    {
+        batch_run = NULL;
+        return false;
+    }
+#if TFT_BUS != TFT_BUS_8080
+    bus_begin(k->read & 1, k->read & 2 ? 16 : 8, 0); // waits the last frames of the part
+#endif
+    batch_next(k + 1);
+    return true;
+}
+
+static void tft_dma_irq(void)
+{
+    if (!dma_irqn_get_channel_status(TFT_DMA_IRQ_INDEX, dma_channel_tx))
+        return;
+    dma_irqn_acknowledge_channel(TFT_DMA_IRQ_INDEX, dma_channel_tx);
+    if (!blit_busy)
+        return;
+    if (batch_run)
+    {
+        if (batch_irq())
+            return;
+    }
+    else if (blit_next < blit_parts)
+    {
+        blit_start();
+        return;
+    }
+    bus_idle();
+    TFT_CS_DISABLE();
+    blit_busy = false;
+    if (blit_cb)
+        blit_cb(blit_arg);
+}
+
+/* blit_part[] is set */
+static void blit_go(int parts, int stride, tft_done_cb cb, void *arg)
+{
+    dma_channel_config c = dma_channel_get_default_config(dma_channel_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, bus_dreq);
+    channel_config_set_chain_to(&c, dma_channel_ctrl);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(dma_channel_tx, &c, bus_fifo, NULL, 0, false);
+
+    blit_parts = parts;
+    blit_next = 0;
+    blit_stride = stride;
+    blit_cb = cb;
+    blit_arg = arg;
+    blit_busy = true;
+    blit_start();
+}
+
+static bool tft_clip(tft_rect_t *r)
+{
+    if (r->x < 0)
+    {
+        r->w += r->x;
+        r->x = 0;
+    }
+    if (r->y < 0)
+    {
+        r->h += r->y;
+        r->y = 0;
+    }
+    if (r->x + r->w > TFT_WIDTH)
+        r->w = TFT_WIDTH - r->x;
+    if (r->y + r->h > TFT_HEIGHT)
+        r->h = TFT_HEIGHT - r->y;
+    return r->w > 0 && r->h > 0;
+}
+
+static inline bool rect_touch(const tft_rect_t *a, const tft_rect_t *b)
+{
+    return a->x <= b->x + b->w && b->x <= a->x + a->w && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static inline int rect_union(tft_rect_t *a, const tft_rect_t *b) /* area added to A */
+{
+    int x0 = MIN(a->x, b->x), y0 = MIN(a->y, b->y);
+    int x1 = MAX(a->x + a->w, b->x + b->w), y1 = MAX(a->y + a->h, b->y + b->h);
+    int grow = (x1 - x0) * (y1 - y0) - a->w * a->h;
+    a->x = x0;
+    a->y = y0;
+    a->w = x1 - x0;
+    a->h = y1 - y0;
+    return grow;
+}
+
+bool tft_busy(void)
+{
+    return blit_busy;
+}
+
+void tft_wait(void)
+{
+    while (blit_busy)
+        tight_loop_contents();
+}
+
 void tft_spi_put(uint16_t data /* cmd/data/color */,
                  int bits /* 8 for cmd/data or 16 for color */)
 {
-    spi_set_format(TFT_SPI_FORMAT(bits));
-    spi_write16_blocking(TFT_SPI, &data, 1);
+    tft_wait();
+    bus_begin(tft_dc, bits, 1);
+    bus_push(data, bits);
+    bus_idle();
 }
 
 void tft_spi_put_data(uint16_t data, /* cmd/data/color */
                       uint32_t size,
                       int bits /* 8 for cmd/data or 16 for color */)
 {
-    spi_set_format(TFT_SPI_FORMAT(bits));
+    static uint16_t fill; // the DMA source, not on the stack
+    tft_wait();
+    if (0 == size)
+        return;
+    bus_begin(tft_dc, bits, size);
     channel_config_set_transfer_data_size(&dma_cfg_tx, bits == 16 ? DMA_SIZE_16 : DMA_SIZE_8);
     channel_config_set_read_increment(&dma_cfg_tx, false);
-    dma_channel_configure(dma_channel_tx, &dma_cfg_tx, &spi_get_hw(TFT_SPI)->dr, &data, size, true);
+    fill = data;
+    dma_channel_configure(dma_channel_tx, &dma_cfg_tx, bus_fifo, &fill, size, true);
     dma_channel_wait_for_finish_blocking(dma_channel_tx);
-    while (spi_get_hw(TFT_SPI)->sr & SPI_SSPSR_BSY_BITS) // wait to finish
-        tight_loop_contents();
+    bus_idle();
 }
 
 void tft_spi_put_buffer(uint16_t *buffer,
                         uint32_t size,
                         int bits /* 8 or 16 for draw images */)
 {
-    spi_set_format(TFT_SPI_FORMAT(bits));
+    tft_wait();
+    if (0 == size)
+        return;
+    bus_begin(tft_dc, bits, size);
     channel_config_set_transfer_data_size(&dma_cfg_tx, bits == 16 ? DMA_SIZE_16 : DMA_SIZE_8);
     channel_config_set_read_increment(&dma_cfg_tx, size > 1);
-    dma_channel_configure(dma_channel_tx, &dma_cfg_tx, &spi_get_hw(TFT_SPI)->dr, buffer, size, true);
+    dma_channel_configure(dma_channel_tx, &dma_cfg_tx, bus_fifo, buffer, size, true);
     dma_channel_wait_for_finish_blocking(dma_channel_tx);
-    while (spi_get_hw(TFT_SPI)->sr & SPI_SSPSR_BSY_BITS) // wait to finish
-        tight_loop_contents();
+    bus_idle();
 }
 
 void tft_write_cmd(uint8_t c)
@@ -84,6 +381,306 @@ void tft_write_data16(uint16_t d16)
     TFT_CS_DISABLE();
 }
 
+void tft_set_window(int x, int y, int w, int h)
+{
+    tft_wait();
+    TFT_CS_ENABLE();
+    tft_window(x, y, w, h);
+    bus_idle();
+    TFT_CS_DISABLE();
+}
+
+int tft_blit_async(int x, int y, int w, int h, const uint16_t *pixels, int stride, tft_done_cb cb, void *arg)
+{
+    if (NULL == pixels || w <= 0 || h <= 0 || x < 0 || y < 0 || x + w > TFT_WIDTH || y + h > TFT_HEIGHT)
+        return -EINVAL;
+    if (stride < w)
+        stride = w;
+    tft_wait();
+    blit_part[0].src = pixels;
+    blit_part[0].r.x = x;
+    blit_part[0].r.y = y;
+    blit_part[0].r.w = w;
+    blit_part[0].r.h = h;
+    blit_go(1, stride, cb, arg);
+    return 0;
+}
+
+void tft_fb_attach(const uint16_t *fb, int stride)
+{
+    tft_wait();
+    fb_pixels = fb;
+    fb_stride = stride < TFT_WIDTH ? TFT_WIDTH : stride;
+    fb_dirty_count = 0;
+    if (fb)
+        tft_fb_dirty(0, 0, TFT_WIDTH, TFT_HEIGHT);
+}
+
+void tft_fb_dirty(int x, int y, int w, int h)
+{
+    tft_rect_t r = {x, y, w, h};
+    int i, j, best = 0, grow = 0x7FFFFFFF;
+    if (!tft_clip(&r))
+        return;
+    for (i = 0; i < fb_dirty_count; i++)
+        if (rect_touch(&fb_dirty[i], &r))
+            break;
+    if (i < fb_dirty_count)
+    {
+        rect_union(&fb_dirty[i], &r);
+    }
+    else if (fb_dirty_count < TFT_DIRTY_RECTS)
+    {
+        fb_dirty[fb_dirty_count++] = r;
+        return;
+    }
+    else
+    {
+        for (i = 0; i < fb_dirty_count; i++) // the one that grows least
+        {
+            tft_rect_t t = fb_dirty[i];
+            int g = rect_union(&t, &r);
+            if (g < grow)
+            {
+                grow = g;
+                best = i;
+            }
+        }
+        rect_union(&fb_dirty[i = best], &r);
+    }
+    for (j = 0; j < fb_dirty_count; j++) // the grown one may reach others now
+    {
+        if (j == i || !rect_touch(&fb_dirty[i], &fb_dirty[j]))
+            continue;
+        rect_union(&fb_dirty[i], &fb_dirty[j]);
+        fb_dirty[j] = fb_dirty[--fb_dirty_count];
+        if (i == fb_dirty_count)
+            i = j;
+        j = -1;
+    }
+}
+
+int tft_fb_flush(tft_done_cb cb, void *arg)
+{
+    if (NULL == fb_pixels)
+        return -EINVAL;
+    tft_wait();
+    int n = fb_dirty_count;
+    for (int i = 0; i < n; i++)
+    {
+        blit_part[i].r = fb_dirty[i];
+        blit_part[i].src = fb_pixels + fb_dirty[i].y * fb_stride + fb_dirty[i].x;
+    }
+    fb_dirty_count = 0;
+    if (0 == n)
+    {
+        if (cb)
+            cb(arg);
+        return 0;
+    }
+    blit_go(n, fb_stride, cb, arg);
+    return n;
+}
+
+int tft_render_lines(int x, int y, int w, int h, tft_render_cb render, void *arg)
+{
+    static uint16_t line_buffer[2][TFT_LINE_PIXELS];
+    if (NULL == render || w <= 0 || h <= 0 || w > TFT_LINE_PIXELS)
+        return -EINVAL;
+    int lines = TFT_LINE_PIXELS / w;
+    tft_wait();
+    TFT_CS_ENABLE();
+    tft_window(x, y, w, h);
+    bus_begin(1, 16, w * h);
+    channel_config_set_transfer_data_size(&dma_cfg_tx, DMA_SIZE_16);
+    channel_config_set_read_increment(&dma_cfg_tx, true);
+    for (int row = 0, k = 0; row < h; row += lines, k ^= 1)
+    {
+        int n = MIN(lines, h - row);
+        render(line_buffer[k], y + row, n, arg); // while the other buffer is sent
+        dma_channel_wait_for_finish_blocking(dma_channel_tx);
+        dma_channel_configure(dma_channel_tx, &dma_cfg_tx, bus_fifo, line_buffer[k], n * w, true);
+    }
+    dma_channel_wait_for_finish_blocking(dma_channel_tx);
+    bus_idle();
+    TFT_CS_DISABLE();
+    return 0;
+}
+
+static uint32_t batch_ctrl(enum dma_channel_transfer_size size, bool incr)
+{
+    dma_channel_config c = dma_channel_get_default_config(dma_channel_tx);
+    channel_config_set_transfer_data_size(&c, size);
+    channel_config_set_read_increment(&c, incr);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, bus_dreq);
+    channel_config_set_chain_to(&c, dma_channel_ctrl);
+    channel_config_set_irq_quiet(&c, true);
+    return channel_config_get_ctrl_value(&c);
+}
+
+static tft_block_t *batch_block(tft_batch_t *b, uint32_t ctrl, uint32_t read, uint32_t count)
+{
+    if (b->blocks >= TFT_BATCH_BLOCKS)
+    {
+        b->overflow = true;
+        return NULL;
+    }
+    tft_block_t *k = &b->block[b->blocks++];
+    k->ctrl = ctrl;
+    k->read = read;
+    k->write = (uint32_t)bus_fifo;
+    k->count = count;
+    return k;
+}
+
+static uint32_t *batch_word(tft_batch_t *b, uint32_t v)
+{
+    if (b->words >= TFT_BATCH_WORDS)
+    {
+        b->overflow = true;
+        return NULL;
+    }
+    b->word[b->words] = v;
+    return &b->word[b->words++];
+}
+
+/* inline item, joins the last block when that ends here */
+static void batch_item(tft_batch_t *b, uint32_t v)
+{
+    uint32_t ctrl = batch_ctrl(DMA_SIZE_32, true);
+    tft_block_t *k = b->blocks ? &b->block[b->blocks - 1] : NULL;
+    uint32_t *w = batch_word(b, v);
+    if (NULL == w)
+        return;
+    if (k && k->count && k->ctrl == ctrl && k->read + 4 * k->count == (uint32_t)w)
+        k->count++;
+    else
+        batch_block(b, ctrl, (uint32_t)w, 1);
+}
+
+static inline uint32_t batch_byte(uint8_t v)
+{
+#if TFT_BUS == TFT_BUS_8080
+    return v * 0x01010101u; // as a replicated 8 bit write
+#else
+    return v;
+#endif
+}
+
+/* a run of COUNT items of BITS */
+static void batch_begin(tft_batch_t *b, int dc, int bits, uint32_t count)
+{
+#if TFT_BUS == TFT_BUS_8080
+    batch_item(b, (uint32_t)dc << 31 | (uint32_t)(bits == 16) << 30 | (count - 1));
+#else
+    uint8_t mode = dc | (bits == 16) << 1;
+    (void)count;
+    if (BATCH_NONE == b->mode)
+        b->first = mode;
+    else if (mode != b->mode)
+        batch_block(b, batch_ctrl(DMA_SIZE_32, true), mode, 0); // the IRQ switches
+    b->mode = mode;
+#endif
+}
+
+void tft_batch_reset(tft_batch_t *b)
+{
+    b->blocks = 0;
+    b->words = 0;
+    b->mode = BATCH_NONE;
+    b->first = 0;
+    b->overflow = false;
+}
+
+void tft_batch_cmd(tft_batch_t *b, uint8_t cmd, const uint8_t *arg, int n)
+{
+    batch_begin(b, 0, 8, 1);
+    batch_item(b, batch_byte(cmd));
+    if (n > 0)
+    {
+        batch_begin(b, 1, 8, n);
+        while (n--)
+            batch_item(b, batch_byte(*arg++));
+    }
+}
+
+void tft_batch_window(tft_batch_t *b, int x, int y, int w, int h)
+{
+    uint8_t arg[4];
+
+    x += TFT_X_OFFSET;
+    y += TFT_Y_OFFSET;
+    arg[0] = x >> 8;
+    arg[1] = x;
+    arg[2] = (x + w - 1) >> 8;
+    arg[3] = x + w - 1;
+    tft_batch_cmd(b, TFT_CMD_CASET, arg, 4);
+
+    arg[0] = y >> 8;
+    arg[1] = y;
+    arg[2] = (y + h - 1) >> 8;
+    arg[3] = y + h - 1;
+    tft_batch_cmd(b, TFT_CMD_RASET, arg, 4);
+
+    tft_batch_cmd(b, TFT_CMD_RAMWR, NULL, 0);
+}
+
+void tft_batch_fill(tft_batch_t *b, int x, int y, int w, int h, uint16_t color)
+{
+    uint32_t *c;
+    if (w <= 0 || h <= 0)
+        return;
+    tft_batch_window(b, x, y, w, h);
+    batch_begin(b, 1, 16, w * h);
+    if ((c = batch_word(b, color))) // read without increment, not sent as item
+        batch_block(b, batch_ctrl(DMA_SIZE_16, false), (uint32_t)c, w * h);
+}
+
+void tft_batch_blit(tft_batch_t *b, int x, int y, int w, int h, const uint16_t *pixels, int stride)
+{
+    if (NULL == pixels || w <= 0 || h <= 0)
+        return;
+    if (stride < w)
+        stride = w;
+    tft_batch_window(b, x, y, w, h);
+    batch_begin(b, 1, 16, w * h);
+    if (stride == w)
+        batch_block(b, batch_ctrl(DMA_SIZE_16, true), (uint32_t)pixels, w * h);
+    else
+        for (int row = 0; row < h; row++)
+            batch_block(b, batch_ctrl(DMA_SIZE_16, true), (uint32_t)(pixels + row * stride), w);
+}
+
+int tft_batch_run(tft_batch_t *b, tft_done_cb cb, void *arg)
+{
+    tft_block_t *k = &b->block[b->blocks]; // the + 1
+    if (b->overflow)
+        return -ENOMEM;
+    if (0 == b->blocks)
+    {
+        if (cb)
+            cb(arg);
+        return 0;
+    }
+    k->ctrl = batch_ctrl(DMA_SIZE_32, true);
+    k->read = BATCH_END;
+    k->write = (uint32_t)bus_fifo;
+    k->count = 0;
+
+    tft_wait();
+    batch_run = b;
+    blit_cb = cb;
+    blit_arg = arg;
+    blit_busy = true;
+    TFT_CS_ENABLE();
+#if TFT_BUS != TFT_BUS_8080
+    bus_begin(b->first & 1, b->first & 2 ? 16 : 8, 0);
+#endif
+    batch_next(b->block);
+    return 0;
+}
+
 /* tft init commands */
 void tft_list_init(const uint8_t *address)
 {
@@ -109,26 +706,47 @@ void tft_list_init(const uint8_t *address)
     }
 }
 
-/* init pins, spi, dma */
+/* init pins, spi or pio, dma */
 void tft_init(void)
 {
-    dma_channel_tx = dma_claim_unused_channel(true);
-    dma_cfg_tx = dma_channel_get_default_config(dma_channel_tx);
-    channel_config_set_dreq(&dma_cfg_tx, TFT_SPI == spi0 ? DREQ_SPI0_TX : DREQ_SPI1_TX);
-    channel_config_set_write_increment(&dma_cfg_tx, false);
+#if TFT_BUS == TFT_BUS_8080
+    const pio_program_t *program = TFT_BUS_WIDTH == 16 ? &tft_8080_16_program : &tft_8080_program;
+    uint offset = pio_add_program(TFT_PIO, program);
+    bus_sm = pio_claim_unused_sm(TFT_PIO, true);
+    pio_sm_config c = TFT_BUS_WIDTH == 16 ? tft_8080_16_program_get_default_config(offset)
+                                          : tft_8080_program_get_default_config(offset);
+    sm_config_set_out_pins(&c, TFT_D0, TFT_BUS_WIDTH);
+    sm_config_set_set_pins(&c, TFT_DC, 1);
+    sm_config_set_sideset_pins(&c, TFT_WR);
+    sm_config_set_out_shift(&c, false, false, 32); // from the top, pull by the program
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+    sm_config_set_clkdiv(&c, TFT_PIO_CLKDIV);
+    for (int i = 0; i < TFT_BUS_WIDTH; i++)
+        pio_gpio_init(TFT_PIO, TFT_D0 + i);
+    pio_gpio_init(TFT_PIO, TFT_DC);
+    pio_gpio_init(TFT_PIO, TFT_WR);
+    pio_sm_set_pins_with_mask(TFT_PIO, bus_sm, 1u << TFT_WR | 1u << TFT_DC, 1u << TFT_WR | 1u << TFT_DC);
+    pio_sm_set_consecutive_pindirs(TFT_PIO, bus_sm, TFT_D0, TFT_BUS_WIDTH, true);
+    pio_sm_set_consecutive_pindirs(TFT_PIO, bus_sm, TFT_DC, 1, true);
+    pio_sm_set_consecutive_pindirs(TFT_PIO, bus_sm, TFT_WR, 1, true);
+    pio_sm_init(TFT_PIO, bus_sm, offset, &c);
+    pio_sm_set_enabled(TFT_PIO, bus_sm, true);
+    bus_fifo = &TFT_PIO->txf[bus_sm];
+    bus_dreq = pio_get_dreq(TFT_PIO, bus_sm, true);
 
+    if (TFT_RD > -1)
+    {
+        gpio_init(TFT_RD);
+        gpio_set_dir(TFT_RD, GPIO_OUT);
+        gpio_put(TFT_RD, 1);
+    }
+#else
     if (TFT_DC > -1)
     {
         gpio_init(TFT_DC);
         gpio_set_dir(TFT_DC, GPIO_OUT);
     }
 
-    if (TFT_CS > -1)
-    {
-        gpio_init(TFT_CS);
-        gpio_set_dir(TFT_CS, GPIO_OUT);
-    }
-
     if (TFT_MISO > -1)
         gpio_set_function(TFT_MISO, GPIO_FUNC_SPI);
 
@@ -140,6 +758,26 @@ void tft_init(void)
 
     spi_init(TFT_SPI, TFT_SPI_BRG);
     spi_set_format(TFT_SPI_FORMAT(8));
+    bus_fifo = &spi_get_hw(TFT_SPI)->dr;
+    bus_dreq = TFT_SPI == spi0 ? DREQ_SPI0_TX : DREQ_SPI1_TX;
+#endif
+
+    dma_channel_tx = dma_claim_unused_channel(true);
+    dma_cfg_tx = dma_channel_get_default_config(dma_channel_tx);
+    channel_config_set_dreq(&dma_cfg_tx, bus_dreq);
+    channel_config_set_write_increment(&dma_cfg_tx, false);
+    channel_config_set_irq_quiet(&dma_cfg_tx, true); // the IRQ is for the blit chain end only
+
+    dma_channel_ctrl = dma_claim_unused_channel(true);
+    irq_add_shared_handler(TFT_DMA_IRQ, tft_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    dma_irqn_set_channel_enabled(TFT_DMA_IRQ_INDEX, dma_channel_tx, true);
+    irq_set_enabled(TFT_DMA_IRQ, true);
+
+    if (TFT_CS > -1)
+    {
+        gpio_init(TFT_CS);
+        gpio_set_dir(TFT_CS, GPIO_OUT);
+    }
 
     TFT_CS_ENABLE();
     if (TFT_RST > -1)
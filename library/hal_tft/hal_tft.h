@@ -53,6 +53,19 @@ extern "C"
 #endif // _HAL_TFT_CFG_H_
 
 
+    Parallel 8080 bus ( PIO + DMA ) instead of SPI, example for ILI9488 320x480
+
+#define TFT_BUS         TFT_BUS_8080
+#define TFT_BUS_WIDTH   16      // 8 or 16
+#define TFT_D0          0       // D0..D15 are GPIO 0..15
+#define TFT_WR          16
+#define TFT_DC          17
+#define TFT_RD          18      // -1 not used, held high
+#define TFT_CS          19
+#define TFT_RST         20
+#define TFT_PIO         pio1
+#define TFT_PIO_CLKDIV  2.0f    // WR low and high are one PIO clock each, about 2.5 clocks a write
+
 ****************************************************************************************/
 
 
@@ -68,6 +81,39 @@ extern "C"
 #include <hardware/dma.h>
 #include <hal_tft_config.h>
 
+#define TFT_BUS_SPI 0
+#define TFT_BUS_8080 1
+
+#ifndef TFT_BUS
+#define TFT_BUS TFT_BUS_SPI
+#endif
+
+#if TFT_BUS == TFT_BUS_8080
+#include <hardware/pio.h>
+
+#ifndef TFT_BUS_WIDTH
+#define TFT_BUS_WIDTH 8
+#endif
+
+#ifndef TFT_RD
+#define TFT_RD -1
+#endif
+
+#ifndef TFT_PIO
+#define TFT_PIO pio0
+#endif
+
+#ifndef TFT_PIO_CLKDIV
+#define TFT_PIO_CLKDIV 4.0f
+#endif
+
+#if TFT_BUS_WIDTH != 8 && TFT_BUS_WIDTH != 16
+#error "TFT_BUS_WIDTH must be 8 or 16"
+#endif
+#endif // TFT_BUS_8080
+
+    extern uint8_t tft_dc; /* the 8080 bus sends DC with the data */
+
 #define TFT_CS_DISABLE()         \
     {                            \
         if (TFT_CS > -1)         \
@@ -80,23 +126,102 @@ extern "C"
             gpio_put(TFT_CS, 0); \
     }
 
+#if TFT_BUS == TFT_BUS_8080
+
+#define TFT_DC_DATA() \
+    {                 \
+        tft_dc = 1;   \
+    }
+
+#define TFT_DC_CMD() \
+    {                \
+        tft_dc = 0;  \
+    }
+
+#else
+
 #define TFT_DC_DATA()            \
     {                            \
+        tft_dc = 1;              \
         if (TFT_DC > -1)         \
             gpio_put(TFT_DC, 1); \
     }
 
 #define TFT_DC_CMD()             \
     {                            \
+        tft_dc = 0;              \
         if (TFT_DC > -1)         \
             gpio_put(TFT_DC, 0); \
     }
 
+#endif
+
 #define TFT_DELAY_MS(T) sleep_ms(T)
 
+#ifndef TFT_X_OFFSET
+#define TFT_X_OFFSET 0 /* panel RAM column of x = 0 */
+#endif
+
+#ifndef TFT_Y_OFFSET
+#define TFT_Y_OFFSET 0
+#endif
+
+#ifndef TFT_DIRTY_RECTS
+#define TFT_DIRTY_RECTS 8 /* more are merged */
+#endif
+
+#ifndef TFT_LINE_PIXELS
+#define TFT_LINE_PIXELS (TFT_WIDTH * 8) /* one of the two tft_render_lines() buffers */
+#endif
+
+#ifndef TFT_DMA_IRQ
+#define TFT_DMA_IRQ DMA_IRQ_1 /* shared */
+#endif
+
+#ifndef TFT_BATCH_BLOCKS
+#define TFT_BATCH_BLOCKS 64 /* DMA control blocks of a batch, a blit takes one per row */
+#endif
+
+#ifndef TFT_BATCH_WORDS
+#define TFT_BATCH_WORDS 96 /* commands, arguments, fill colors */
+#endif
+
+#define TFT_CMD_CASET 0x2A
+#define TFT_CMD_RASET 0x2B
+#define TFT_CMD_RAMWR 0x2C
+
+    typedef struct
+    {
+        int16_t x, y, w, h;
+    } tft_rect_t;
+
+    /* DMA control block, written to the al1 registers of the data channel */
+    typedef struct
+    {
+        uint32_t ctrl, read, write, count;
+    } tft_block_t;
+
+    /*
+        Batch: commands, window setup, fills and blits encoded as DMA control blocks,
+        run by the control channel without the CPU. The 8080 bus takes DC in the stream,
+        SPI has DC on a GPIO: there the list is cut where DC or the frame size changes
+        and the DMA IRQ switches them between the parts
+    */
+    typedef struct
+    {
+        tft_block_t block[TFT_BATCH_BLOCKS + 1]; /* + end */
+        uint32_t word[TFT_BATCH_WORDS];
+        uint16_t blocks, words;
+        uint8_t mode, first; /* DC | 16 bit << 1 */
+        bool overflow;
+    } tft_batch_t;
+
+    typedef void (*tft_done_cb)(void *arg);                                   /* DMA IRQ context */
+    typedef void (*tft_render_cb)(uint16_t *pixels, int y, int lines, void *arg); /* lines of w pixels from row y */
+
     void tft_spi_put(uint16_t data, int bits);
-    void tft_spi_put_data(uint16_t data, uint16_t size, int bits);
-    void tft_spi_put_buffer(uint16_t *buffer, uint16_t size, int bits);
+    void tft_spi_put_data(uint16_t data, uint32_t size, int bits);
+    void tft_spi_put_buffer(uint16_t *buffer, uint32_t size, int bits);
 
     void tft_init(void);
     void tft_list_init(const uint8_t *address);
@@ -105,6 +230,45 @@ extern "C"
     void tft_write_data(uint8_t d8);
     void tft_write_data16(uint16_t d16);
 
+    /* CASET, RASET, RAMWR, next are pixels */
+    void tft_set_window(int x, int y, int w, int h);
+
+    /*
+        Async blit, returns at once, CB when the last pixel is out
+        Rows of w pixels are stride apart in PIXELS ( 0: w ), the DMA takes one row per control block
+        A blit started while one is running waits for it, tft_busy() tells
+    */
+    int tft_blit_async(int x, int y, int w, int h, const uint16_t *pixels, int stride, tft_done_cb cb, void *arg);
+    bool tft_busy(void);
+    void tft_wait(void);
+
+    /*
+        Frame buffer with dirty rectangles: draw, mark the changed area, flush sends only them
+        Overlapping or touching rectangles are merged, a full list grows the closest one
+        The buffer must not change until CB ( frame done ), attach marks all dirty
+    */
+    void tft_fb_attach(const uint16_t *fb, int stride);
+    void tft_fb_dirty(int x, int y, int w, int h);
+    int tft_fb_flush(tft_done_cb cb, void *arg); /* rectangles sent, 0: nothing dirty, CB called */
+
+    /* Ping-pong line buffers: RENDER fills one while the DMA sends the other */
+    int tft_render_lines(int x, int y, int w, int h, tft_render_cb render, void *arg);
+
+    /*
+        Build once after tft_init(), run many times, the batch and the blitted pixels must stay until CB
+
+            tft_batch_reset(&b);
+            tft_batch_fill(&b, 0, 0, 240, 20, BLUE);
+            tft_batch_blit(&b, x, y, 16, 16, sprite, 0);
+            tft_batch_run(&b, NULL, NULL);
+    */
+    void tft_batch_reset(tft_batch_t *b);
+    void tft_batch_cmd(tft_batch_t *b, uint8_t cmd, const uint8_t *arg, int n);
+    void tft_batch_window(tft_batch_t *b, int x, int y, int w, int h);
+    void tft_batch_fill(tft_batch_t *b, int x, int y, int w, int h, uint16_t color);
+    void tft_batch_blit(tft_batch_t *b, int x, int y, int w, int h, const uint16_t *pixels, int stride);
+    int tft_batch_run(tft_batch_t *b, tft_done_cb cb, void *arg); /* -ENOMEM: did not fit */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+// -------------------------------------------------- //
+// This file is autogenerated by pioasm; do not edit! //
+// -------------------------------------------------- //
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// -------- //
+// tft_8080 //
+// -------- //
+
+#define tft_8080_wrap_target 0
+#define tft_8080_wrap 17
+
+static const uint16_t tft_8080_program_instructions[] = {
+            //     .wrap_target
+    0x98a0, //  0: pull   block           side 1     
+    0x6021, //  1: out    x, 1                       
+    0x0025, //  2: jmp    !x, 5                      
+    0xe001, //  3: set    pins, 1                    
+    0x0006, //  4: jmp    6                          
+    0xe000, //  5: set    pins, 0                    
+    0x6021, //  6: out    x, 1                       
+    0x605e, //  7: out    y, 30                      
+    0x002f, //  8: jmp    !x, 15                     
+    0x80a0, //  9: pull   block                      
+    0x7008, // 10: out    pins, 8         side 0     
+    0xb842, // 11: nop                    side 1     
+    0x7008, // 12: out    pins, 8         side 0     
+    0x1889, // 13: jmp    y--, 9          side 1     
+    0x0000, // 14: jmp    0                          
+    0x80a0, // 15: pull   block                      
+    0x7008, // 16: out    pins, 8         side 0     
+    0x188f, // 17: jmp    y--, 15         side 1     
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program tft_8080_program = {
+    .instructions = tft_8080_program_instructions,
+    .length = 18,
+    .origin = -1,
+};
+
+static inline pio_sm_config tft_8080_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + tft_8080_wrap_target, offset + tft_8080_wrap);
+    sm_config_set_sideset(&c, 2, true, false);
+    return c;
+}
+#endif
+
+// ----------- //
+// tft_8080_16 //
+// ----------- //
+
+#define tft_8080_16_wrap_target 0
+#define tft_8080_16_wrap 10
+
+static const uint16_t tft_8080_16_program_instructions[] = {
+            //     .wrap_target
+    0x98a0, //  0: pull   block           side 1     
+    0x6021, //  1: out    x, 1                       
+    0x0025, //  2: jmp    !x, 5                      
+    0xe001, //  3: set    pins, 1                    
+    0x0006, //  4: jmp    6                          
+    0xe000, //  5: set    pins, 0                    
+    0x6021, //  6: out    x, 1                       
+    0x605e, //  7: out    y, 30                      
+    0x80a0, //  8: pull   block                      
+    0x7010, //  9: out    pins, 16        side 0     
+    0x1888, // 10: jmp    y--, 8          side 1     
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program tft_8080_16_program = {
+    .instructions = tft_8080_16_program_instructions,
+    .length = 11,
+    .origin = -1,
+};
+
+static inline pio_sm_config tft_8080_16_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + tft_8080_16_wrap_target, offset + tft_8080_16_wrap);
+    sm_config_set_sideset(&c, 2, true, false);
+    return c;
+}
+#endif
+
@@ -32,14 +32,25 @@ namespace arduino {
 // location from which to read.
 #define SERIAL_BUFFER_SIZE 64
 
+/*
+  Single producer / single consumer ring, N is a power of 2.
+  Head and tail are free running, head is written only by the producer ( ISR ),
+  tail only by the consumer ( task ), so no critical section is needed.
+  The index stores use release and the loads acquire, the data is visible
+  before the index that publishes it.
+
+  Producer : store_char(), write(), reserve_contiguous() + publish()
+  Consumer : read_char(), read(), peek_contiguous() + commit()
+*/
 template <int N>
 class RingBufferN
 {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "RingBufferN size must be a power of 2");
+
   public:
     uint8_t _aucBuffer[N] ;
-    volatile int _iHead ;
-    volatile int _iTail ;
-    volatile int _numElems;
+    volatile uint32_t _iHead ;
+    volatile uint32_t _iTail ;
 
   public:
     RingBufferN( void ) ;
@@ -51,9 +62,16 @@ class RingBufferN
     int peek();
     bool isFull();
 
+    size_t write( const uint8_t *buf, size_t n ) ;
+    size_t read( uint8_t *buf, size_t n ) ;
+    size_t peek_contiguous( const uint8_t **data ) ;
+    void commit( size_t n ) ;
+    size_t reserve_contiguous( uint8_t **data ) ;
+    void publish( size_t n ) ;
+
   private:
-    int nextIndex(int index);
-    inline bool isEmpty() const { return (_numElems == 0); }
+    inline uint32_t head() { return __atomic_load_n(&_iHead, __ATOMIC_ACQUIRE); }
+    inline uint32_t tail() { return __atomic_load_n(&_iTail, __ATOMIC_ACQUIRE); }
 };
 
 typedef RingBufferN<SERIAL_BUFFER_SIZE> RingBuffer;
@@ -69,35 +87,32 @@ RingBufferN<N>::RingBufferN( void )
 template <int N>
 void RingBufferN<N>::store_char( uint8_t c )
 {
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  if (!isFull())
+  // a full buffer drops the character
+  uint32_t h = _iHead;
+  if (h - tail() < N)
   {
-    _aucBuffer[_iHead] = c ;
-    _iHead = nextIndex(_iHead);
-    _numElems++;
+    _aucBuffer[h & (N - 1)] = c ;
+    __atomic_store_n(&_iHead, h + 1, __ATOMIC_RELEASE);
   }
 }
 
+// both sides must be idle
 template <int N>
 void RingBufferN<N>::clear()
 {
   _iHead = 0;
   _iTail = 0;
-  _numElems = 0;
 }
 
 template <int N>
 int RingBufferN<N>::read_char()
 {
-  if (isEmpty())
+  uint32_t t = _iTail;
+  if (head() == t)
     return -1;
 
-  uint8_t value = _aucBuffer[_iTail];
-  _iTail = nextIndex(_iTail);
-  _numElems--;
+  uint8_t value = _aucBuffer[t & (N - 1)];
+  __atomic_store_n(&_iTail, t + 1, __ATOMIC_RELEASE);
 
   return value;
 }
@@ -105,34 +120,99 @@ int RingBufferN<N>::read_char()
 template <int N>
 int RingBufferN<N>::available()
 {
-  return _numElems;
+  return head() - tail();
 }
 
 template <int N>
 int RingBufferN<N>::availableForStore()
 {
-  return (N - _numElems);
+  return N - (head() - tail());
 }
 
 template <int N>
 int RingBufferN<N>::peek()
 {
-  if (isEmpty())
+  uint32_t t = _iTail;
+  if (head() == t)
     return -1;
 
-  return _aucBuffer[_iTail];
+  return _aucBuffer[t & (N - 1)];
 }
 
 template <int N>
-int RingBufferN<N>::nextIndex(int index)
+bool RingBufferN<N>::isFull()
 {
-  return (uint32_t)(index + 1) % N;
+  return (head() - tail() == N);
 }
 
+// producer, up to n bytes, returns the stored count
 template <int N>
-bool RingBufferN<N>::isFull()
+size_t RingBufferN<N>::write( const uint8_t *buf, size_t n )
+{
+  uint8_t *p;
+  size_t done = 0, len;
+  while (done < n && (len = reserve_contiguous(&p)))
+  {
+    if (len > n - done)
+      len = n - done;
+    memcpy(p, buf + done, len);
+    publish(len);
+    done += len;
+  }
+  return done;
+}
+
+// consumer, up to n bytes, returns the read count
+template <int N>
+size_t RingBufferN<N>::read( uint8_t *buf, size_t n )
+{
+  const uint8_t *p;
+  size_t done = 0, len;
+  while (done < n && (len = peek_contiguous(&p)))
+  {
+    if (len > n - done)
+      len = n - done;
+    memcpy(buf + done, p, len);
+    commit(len);
+    done += len;
+  }
+  return done;
+}
+
+// consumer, readable bytes in one piece ( up to the buffer end ), no copy
+template <int N>
+size_t RingBufferN<N>::peek_contiguous( const uint8_t **data )
+{
+  uint32_t t = _iTail;
+  uint32_t len = head() - t;
+  uint32_t end = N - (t & (N - 1));
+  *data = &_aucBuffer[t & (N - 1)];
+  return len < end ? len : end;
+}
+
+// consumer, release n bytes from peek_contiguous()
+template <int N>
+void RingBufferN<N>::commit( size_t n )
+{
+  __atomic_store_n(&_iTail, _iTail + n, __ATOMIC_RELEASE);
+}
+
+// producer, free space in one piece ( up to the buffer end ) to fill in place
+template <int N>
+size_t RingBufferN<N>::reserve_contiguous( uint8_t **data )
+{
+  uint32_t h = _iHead;
+  uint32_t len = N - (h - tail());
+  uint32_t end = N - (h & (N - 1));
+  *data = &_aucBuffer[h & (N - 1)];
+  return len < end ? len : end;
+}
+
+// producer, make n bytes filled after reserve_contiguous() readable
+template <int N>
+void RingBufferN<N>::publish( size_t n )
 {
-  return (_numElems == N);
+  __atomic_store_n(&_iHead, _iHead + n, __ATOMIC_RELEASE);
 }
 
 }
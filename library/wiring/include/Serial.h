@@ -171,24 +171,13 @@ public:
     int read()
     {
         Mutex m(&_mutex);
-        if (!rx_ring.available())
-            return -1;
-        uint32_t _prim = save_and_disable_interrupts();
-        uint8_t byte = rx_ring.read_char();
-        restore_interrupts(_prim);
-        return byte;
+        return rx_ring.read_char();
     }
 
     int read(uint8_t *buf, size_t size)
     {
         Mutex m(&_mutex);
-        int cnt = 0;
-        while (available() > 0 && size)
-        {
-            *buf++ = read();
-            size--;
-            cnt++;
-        }
+        int cnt = rx_ring.read(buf, size);
         return cnt ? cnt : -1;
     }
 
@@ -214,20 +203,14 @@ public:
     {
         if (_owner == get_core_num())
         {
-            uint32_t _prim = save_and_disable_interrupts();
-            while (uart_is_readable(u))
+            uint8_t *p;
+            size_t len, n;
+            while (uart_is_readable(u) && (len = rx_ring.reserve_contiguous(&p)))
             {
-                if (rx_ring.availableForStore())
-                {
-                    char c = uart_getc(u);
-                    rx_ring.store_char(c);
-                }
-                else
-                {
-                    break;
-                }
+                for (n = 0; n < len && uart_is_readable(u); n++)
+                    p[n] = uart_get_hw(u)->dr;
+                rx_ring.publish(n);
             }
-            restore_interrupts(_prim);
         }
     }
 
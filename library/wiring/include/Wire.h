@@ -21,11 +21,55 @@
 #ifdef __cplusplus
 
 #include "Stream.h"
-#include "RingBuffer.h"
 #include "hardware/i2c.h"
 
 #define WIRE_PRINT // Serial.printf
 
+#ifndef WIRE_BUFFER_MIN
+#define WIRE_BUFFER_MIN 32 /* first size of the write / read buffers, they grow as needed */
+#endif
+
+#define WIRE_PENDING (-1)
+
+/*
+    One I2C transaction: write tx, then read rx with repeated start, then STOP if stop.
+    No tx and no rx is an address probe. Queued with TwoWire::submit(), executed by the
+    I2C interrupt ( TX FIFO ) and DMA ( RX ), the buffers must live until done()
+
+    status is WIRE_PENDING, then the endTransmission() code:
+        0 success, 2 address NACK, 3 data NACK, 4 other error, 5 timeout / aborted
+    callback runs in the I2C interrupt, it may submit() but not wait()
+*/
+struct WireTransfer
+{
+    uint8_t address;
+    bool stop;
+    const uint8_t *tx;
+    size_t tx_len;
+    uint8_t *rx;
+    size_t rx_len;
+    void (*callback)(WireTransfer *t);
+    void *user;
+    volatile int status;
+    WireTransfer *next;
+
+    WireTransfer(uint8_t addr = 0, const uint8_t *wr = NULL, size_t wr_len = 0, uint8_t *rd = NULL, size_t rd_len = 0, bool stop_bit = true)
+    {
+        address = addr;
+        tx = wr;
+        tx_len = wr_len;
+        rx = rd;
+        rx_len = rd_len;
+        stop = stop_bit;
+        callback = NULL;
+        user = NULL;
+        status = 0;
+        next = NULL;
+    }
+
+    bool done() const { return WIRE_PENDING != status; }
+};
+
 class TwoWire : public Stream
 {
 private:
@@ -34,7 +78,26 @@ private:
     bool transmissionBegun;
     uint8_t _slave_address;
     i2c_inst_t *ctx;
-    RingBuffer rx, tx;
+
+    uint8_t *_tx_buf, *_rx_buf;
+    size_t _tx_len, _tx_size;
+    size_t _rx_len, _rx_pos, _rx_size;
+
+    // transaction engine
+    WireTransfer *_head, *_tail;
+    WireTransfer *volatile _active;
+    size_t _cmd;   // next command word of _active
+    uint8_t _phase;
+    int _rx_dma;
+    uint8_t *_rd; // without DMA
+    size_t _rd_len;
+    uint8_t _probe;
+
+    void start();
+    void stop();
+    void next();
+    void finish(int status);
+    bool grow(uint8_t **buf, size_t *size, size_t need);
 
 public:
     TwoWire(i2c_inst_t *contex, uint32_t speed_Hz = 100000)
@@ -45,6 +108,12 @@ public:
         _sda = PICO_DEFAULT_I2C_SDA_PIN;
         _scl = PICO_DEFAULT_I2C_SCL_PIN;
         transmissionBegun = false;
+        _tx_buf = _rx_buf = NULL;
+        _tx_len = _tx_size = 0;
+        _rx_len = _rx_pos = _rx_size = 0;
+        _head = _tail = NULL;
+        _active = NULL;
+        _rx_dma = -1;
     }
 
     ~TwoWire() { end(); }
@@ -81,12 +150,14 @@ public:
         _slave_address = address;
         pins(SDA, SCL);
         i2c_init(ctx, _speed);
+        start();
     }
 
     void begin(void) { begin(_sda, _scl, _slave_address); }
 
     void end()
     {
+        stop();
         gpio_set_function(_sda, GPIO_FUNC_XIP);
         gpio_set_function(_scl, GPIO_FUNC_XIP);
         i2c_deinit(ctx);
@@ -102,11 +173,25 @@ public:
     size_t write(uint8_t data);
     size_t write(const uint8_t *data, size_t size);
 
-    virtual int available(void) { return rx.available(); }
-    virtual int read(void) { return rx.read_char(); }
-    virtual int peek(void) { return rx.peek(); }
+    virtual int available(void) { return _rx_len - _rx_pos; }
+    virtual int read(void) { return _rx_pos < _rx_len ? _rx_buf[_rx_pos++] : -1; }
+    virtual int peek(void) { return _rx_pos < _rx_len ? _rx_buf[_rx_pos] : -1; }
     virtual void flush(void) {}
 
+    // queued transactions
+    bool submit(WireTransfer *t);
+    int wait(WireTransfer *t);
+    int transfer(WireTransfer *t) { return submit(t) ? wait(t) : 4; }
+    int writeRead(uint8_t address, const uint8_t *wr, size_t wr_len, uint8_t *rd, size_t rd_len)
+    {
+        WireTransfer t(address, wr, wr_len, rd, rd_len, true);
+        return transfer(&t);
+    }
+    void abort(WireTransfer *t);
+    bool busy() { return _active || _head; }
+
+    void isr(); // PRIVATE HANDLER
+
     using Print::write;
 
     void onService(void){};
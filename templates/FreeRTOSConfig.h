@@ -28,6 +28,7 @@
 #define configNUM_THREAD_LOCAL_STORAGE_POINTERS 5
 #define configSTACK_DEPTH_TYPE                  uint16_t
 #define configMESSAGE_BUFFER_LENGTH_TYPE        size_t
+#define configUSE_CORE1                         0         /* 1: core 1 runs xPortRunOnCore1() jobs, FromISR API only, no heap. The SIO FIFO is taken. Not SMP: tasks run on core 0 only */
 
 /* Memory allocation related definitions. */
 #define configSUPPORT_STATIC_ALLOCATION         1
@@ -9,9 +9,16 @@
 
 #define CFG_TUSB_RHPORT0_MODE   (OPT_MODE_DEVICE)
 
+// CDC interfaces ( 1..3 ), the TX FIFO is the write ring of every interface
+#ifndef CFG_TUD_CDC
 #define CFG_TUD_CDC             (1)
+#endif
+#ifndef CFG_TUD_CDC_RX_BUFSIZE
 #define CFG_TUD_CDC_RX_BUFSIZE  (256)
-#define CFG_TUD_CDC_TX_BUFSIZE  (256)
+#endif
+#ifndef CFG_TUD_CDC_TX_BUFSIZE
+#define CFG_TUD_CDC_TX_BUFSIZE  (1024)
+#endif
 
 // We use a vendor specific interface but with our own driver
 #define CFG_TUD_VENDOR            (0)
@@ -22,3 +22,8 @@ FATFS:  http://elm-chan.org/fsw/ff/00index_e.html
 #define USE_LFS_ROM     /* Use Rom disk ( internal flash )  F:/file_path */
 #define USE_FATFS       /* Enable FatFS                     0:/file_path */
 
+/* Mount points: drive letter "X:" or POSIX path, nested mounts resolve to the longest prefix */
+//#define LFS_RAM_LETTER  "/ram"
+//#define LFS_ROM_LETTER  "/flash"
+//#define FATFS_LETTER    "/sd"
+
@@ -39,6 +39,12 @@ int vfs_close(int fd);
 size_t vfs_write(int fd, const char *buf, size_t size);
 size_t vfs_read(int fd, char *buf, size_t size);
 _off_t vfs_seek(int fd, _off_t where, int whence);
+int vfs_fstat(int fd, struct stat *st);
+int vfs_stat(const char *path, struct stat *st);
+int vfs_unlink(const char *path);
+int vfs_rmdir(const char *path);
+int vfs_rename(const char *src, const char *dst);
+int vfs_mkdir(const char *path, mode_t mode);
 
 char *__dso_handle; // void* __dso_handle __attribute__ ((__weak__));
 
@@ -68,7 +74,29 @@ int _fstat_r(struct _reent *r, int fd, struct stat *st)
 {
     int err = -EINVAL;
 #ifdef USE_VFS
-// TODO
+    err = vfs_fstat(fd, st);
+#endif
+    errno = (err < 0) ? -err : 0;
+    return err;
+}
+
+int _stat_r(struct _reent *r, const char *path, struct stat *st)
+{
+    int err = -EINVAL;
+#ifdef USE_VFS
+    if (path)
+        err = vfs_stat(path, st);
+#endif
+    errno = (err < 0) ? -err : 0;
+    return err;
+}
+
+int _unlink_r(struct _reent *r, const char *path)
+{
+    int err = -EINVAL;
+#ifdef USE_VFS
+    if (path)
+        err = vfs_unlink(path);
 #endif
     errno = (err < 0) ? -err : 0;
     return err;
@@ -156,9 +184,9 @@ int rename(const char *src_path, const char *dst_path)
 {
     int err = -EINVAL;
 #ifdef USE_VFS
-    //return vfs_rename(src_path, dst_path);
+    err = vfs_rename(src_path, dst_path);
 #endif
-    //errno = EINVAL;
+    errno = (err < 0) ? -err : 0;
     return err;
 }
 
@@ -176,9 +204,9 @@ int rmdir(const char *path)
 {
     int err = -EINVAL;
 #ifdef USE_VFS
-    //return vfs_rmdir(path);
+    err = vfs_rmdir(path);
 #endif
-    //errno = EINVAL;
+    errno = (err < 0) ? -err : 0;
     return err;
 }
 
@@ -186,9 +214,9 @@ int mkdir(const char *path, mode_t mode)
 {
     int err = -EINVAL;
 #ifdef USE_VFS
-    //return vfs_mkdir(path, mode);
+    err = vfs_mkdir(path, mode);
 #endif
-    //errno = EINVAL;
+    errno = (err < 0) ? -err : 0;
     return err;
 }
 
@@ -18,29 +18,260 @@
 
 #if (defined(ARDUINO) || defined(USE_FREERTOS)) &&  !defined(BAREMETAL)
 #include <string.h>
+#include "wizio.h"
 
 extern void *pvPortMalloc(size_t xWantedSize);
 extern void vPortFree(void *pv);
+extern void *pvPortResize(void *pv, size_t xWantedSize);
+extern void *pvPortMallocAligned(size_t xAlignment, size_t xWantedSize);
+extern size_t xPortGetBlockSize(void *pv);
+#ifndef USE_FREERTOS
+extern void *pvPortMallocHint(size_t xWantedSize, int xHint);
+extern int xPortGetHeapRegionStats(int xRegion, heap_region_stats_t *pxStats);
+#endif
+
+/*
+    Size class front end for small blocks
+
+    The arena is cut in pages, a page is given to one size class at first use and stays there.
+    Every core keeps own free list per class: malloc / free of a small block is a pop / push
+    with the local interrupts off, the cores do not wait each other.
+    Only a new page is taken under the spin lock. Large blocks and a full arena go to heap_4
+
+    Opt-in: the arena is static ( .bss ) and a page never returns to heap_4, even when all
+    its blocks are free. Size it for the small blocks the application keeps in use
+    build_flags = -D MALLOC_SLAB_ARENA=16384
+*/
+
+#ifndef MALLOC_SLAB_ARENA
+#define MALLOC_SLAB_ARENA 0 /* bytes, 0: disable */
+#endif
+
+#ifndef MALLOC_SLAB_PAGE
+#define MALLOC_SLAB_PAGE 512 /* power of 2 */
+#endif
+
+#ifndef MALLOC_SLAB_SPINLOCK
+#define MALLOC_SLAB_SPINLOCK PICO_SPINLOCK_ID_OS2
+#endif
+
+#if MALLOC_SLAB_ARENA
+
+#define SLAB_PAGES (MALLOC_SLAB_ARENA / MALLOC_SLAB_PAGE)
+
+static const uint16_t slab_size[] = {8, 16, 24, 32, 48, 64, 96, 128, 192, 256};
+#define SLAB_CLASSES (sizeof(slab_size) / sizeof(slab_size[0]))
+#define SLAB_MAX 256
+
+typedef struct slab_free_s
+{
+    struct slab_free_s *next;
+} slab_free_t;
+
+typedef struct slab_core_s
+{
+    slab_free_t *list[SLAB_CLASSES];
+    uint32_t allocs[SLAB_CLASSES];
+    uint32_t frees[SLAB_CLASSES];
+    uint32_t misses[SLAB_CLASSES];
+} slab_core_t;
+
+static uint8_t slab_arena[MALLOC_SLAB_ARENA] __attribute__((aligned(MALLOC_SLAB_PAGE)));
+static uint8_t slab_page[SLAB_PAGES]; /* class + 1, 0: free page */
+static uint32_t slab_next_page;
+static slab_core_t slab_core[2];
+
+static inline int slab_class(size_t size)
+{
+    int c = 0;
+    while (slab_size[c] < size)
+        c++;
+    return c;
+}
+
+static inline bool slab_owns(const void *p)
+{
+    return (const uint8_t *)p >= slab_arena && (const uint8_t *)p < slab_arena + sizeof(slab_arena);
+}
+
+/* Carve a free page to the local list of class C */
+static bool slab_refill(slab_core_t *core, int c)
+{
+    uint32_t page;
+    spin_lock_t *lock = spin_lock_instance(MALLOC_SLAB_SPINLOCK);
+    uint32_t save = spin_lock_blocking(lock);
+    if ((page = slab_next_page) < SLAB_PAGES)
+    {
+        slab_page[page] = c + 1;
+        slab_next_page++;
+    }
+    spin_unlock(lock, save);
+    if (page >= SLAB_PAGES)
+        return false;
+    uint8_t *p = slab_arena + page * MALLOC_SLAB_PAGE;
+    for (uint32_t n = MALLOC_SLAB_PAGE / slab_size[c]; n; n--, p += slab_size[c])
+    {
+        ((slab_free_t *)p)->next = core->list[c];
+        core->list[c] = (slab_free_t *)p;
+    }
+    return true;
+}
+
+static void *slab_alloc(size_t size)
+{
+    int c = slab_class(size);
+    slab_core_t *core = &slab_core[get_core_num()];
+    slab_free_t *p = NULL;
+    uint32_t save = save_and_disable_interrupts();
+    if (core->list[c] || slab_refill(core, c))
+    {
+        p = core->list[c];
+        core->list[c] = p->next;
+        core->allocs[c]++;
+    }
+    else
+    {
+        core->misses[c]++;
+    }
+    restore_interrupts(save);
+    return p;
+}
+
+static void slab_free(void *p)
+{
+    int c = slab_page[((uint8_t *)p - slab_arena) / MALLOC_SLAB_PAGE] - 1;
+    slab_core_t *core = &slab_core[get_core_num()];
+    uint32_t save = save_and_disable_interrupts();
+    ((slab_free_t *)p)->next = core->list[c];
+    core->list[c] = (slab_free_t *)p;
+    core->frees[c]++;
+    restore_interrupts(save);
+}
+
+static inline size_t slab_usable(const void *p)
+{
+    return slab_size[slab_page[((const uint8_t *)p - slab_arena) / MALLOC_SLAB_PAGE] - 1];
+}
+
+int malloc_class_stats(int index, malloc_class_stats_t *st)
+{
+    if (index < 0 || index >= (int)SLAB_CLASSES || NULL == st)
+        return -1;
+    memset(st, 0, sizeof(malloc_class_stats_t));
+    st->size = slab_size[index];
+    for (int i = 0; i < SLAB_PAGES; i++)
+        if (slab_page[i] == index + 1)
+            st->pages++;
+    for (int i = 0; i < 2; i++)
+    {
+        st->allocs += slab_core[i].allocs[index];
+        st->frees += slab_core[i].frees[index];
+        st->misses += slab_core[i].misses[index];
+    }
+    return 0;
+}
+
+#else
+
+int malloc_class_stats(int index, malloc_class_stats_t *st) { return -1; }
+
+#endif // MALLOC_SLAB_ARENA
+
+int heap_region_stats(int index, heap_region_stats_t *st)
+{
+#ifndef USE_FREERTOS
+    return xPortGetHeapRegionStats(index, st);
+#else
+    return -1; /* FreeRTOS heap_4: one static array */
+#endif
+}
+
+void malloc_stats(void)
+{
+    malloc_class_stats_t st;
+    heap_region_stats_t rs;
+    printf("size pages   allocs    frees  in use  misses\n");
+    for (int i = 0; 0 == malloc_class_stats(i, &st); i++)
+        printf("%4u %5u %8u %8u %7d %7u\n", (unsigned)st.size, (unsigned)st.pages, (unsigned)st.allocs,
+               (unsigned)st.frees, (int)(st.allocs - st.frees), (unsigned)st.misses);
+#if MALLOC_SLAB_ARENA
+    printf("slab pages %u / %u\n", (unsigned)slab_next_page, (unsigned)SLAB_PAGES);
+#endif
+    printf("region     start      size      used   largest  blocks\n");
+    for (int i = 0; 0 == heap_region_stats(i, &rs); i++)
+        printf("%-8s %08X %9u %9u %9u %7u\n", rs.name, (unsigned)rs.start, (unsigned)rs.size,
+               (unsigned)(rs.size - rs.free), (unsigned)rs.largest, (unsigned)rs.free_blocks);
+}
 
 void *malloc(size_t size)
 {
+#if MALLOC_SLAB_ARENA
+    if (size && size <= SLAB_MAX)
+    {
+        void *p = slab_alloc(size);
+        if (p)
+            return p;
+    }
+#endif
     return pvPortMalloc(size);
 }
 void *_malloc_r(struct _reent *ignore, size_t size) { return malloc(size); }
 
 void free(void *p)
 {
+#if MALLOC_SLAB_ARENA
+    if (slab_owns(p))
+    {
+        slab_free(p);
+        return;
+    }
+#endif
     if (p)
         vPortFree(p);
 }
 void _free_r(struct _reent *ignore, void *ptr) { free(ptr); }
 
+size_t malloc_usable_size(void *mem)
+{
+    if (NULL == mem)
+        return 0;
+#if MALLOC_SLAB_ARENA
+    if (slab_owns(mem))
+        return slab_usable(mem);
+#endif
+    return xPortGetBlockSize(mem);
+}
+size_t _malloc_usable_size_r(struct _reent *ignored, void *ptr) { return malloc_usable_size(ptr); }
+
+/* In place when the block or the free space after it is large enough, else moved with the old size only */
 void *realloc(void *mem, size_t newsize)
 {
+    if (NULL == mem)
+        return malloc(newsize);
+    if (0 == newsize)
+    {
+        free(mem);
+        return NULL;
+    }
+    size_t size = malloc_usable_size(mem);
+#if MALLOC_SLAB_ARENA
+    if (slab_owns(mem))
+    {
+        if (newsize <= size)
+            return mem;
+    }
+    else if (pvPortResize(mem, newsize))
+        return mem;
+#else
+    if (pvPortResize(mem, newsize))
+        return mem;
+#endif
     void *new = malloc(newsize);
-    if ((new) && (mem))
-        memcpy(new, mem, newsize);
-    free(mem);
+    if (new)
+    {
+        memcpy(new, mem, size < newsize ? size : newsize);
+        free(mem);
+    }
     return new;
 }
 void *_realloc_r(struct _reent *ignored, void *ptr, size_t size) { return realloc(ptr, size); }
@@ -55,4 +286,33 @@ void *calloc(size_t element, size_t size)
 }
 void *_calloc_r(struct _reent *ignored, size_t element, size_t size) { return calloc(element, size); }
 
-#endif 
+void *malloc_hint(size_t size, int hint)
+{
+#ifndef USE_FREERTOS
+    if (MALLOC_HINT_ANY != hint)
+        return pvPortMallocHint(size, hint);
+#endif
+    return malloc(size);
+}
+
+/* Address is a multiple of align ( power of 2 ), DMA ring buffers */
+void *memalign(size_t align, size_t size)
+{
+    if (align <= 8)
+        return malloc(size);
+    return pvPortMallocAligned(align, size);
+}
+void *_memalign_r(struct _reent *ignored, size_t align, size_t size) { return memalign(align, size); }
+
+void *aligned_alloc(size_t align, size_t size) { return memalign(align, size); }
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (align < sizeof(void *) || (align & (align - 1)))
+        return EINVAL;
+    if (NULL == (*memptr = memalign(align, size)))
+        return ENOMEM;
+    return 0;
+}
+
+#endif
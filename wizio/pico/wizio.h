@@ -87,6 +87,41 @@ extern "C"
 
 #endif // USE_FREERTOS
 
+    /* malloc size classes ( memory.c ) */
+    typedef struct malloc_class_stats_s
+    {
+        uint32_t size;   /* block size of the class            */
+        uint32_t pages;  /* arena pages owned by the class     */
+        uint32_t allocs; /* blocks served by the class         */
+        uint32_t frees;  /* blocks returned to the class       */
+        uint32_t misses; /* arena was full, served by the heap */
+    } malloc_class_stats_t;
+
+    int malloc_class_stats(int index, malloc_class_stats_t *st); /* -1: no more classes */
+    void malloc_stats(void);
+
+    /* malloc_hint() placement, a hint only: the block goes anywhere if the bank is full */
+    enum
+    {
+        MALLOC_HINT_ANY = 0,
+        MALLOC_HINT_STRIPED,    /* SRAM0..3, full bandwidth for the CPU  */
+        MALLOC_HINT_CORE_LOCAL, /* scratch bank of the calling core      */
+        MALLOC_HINT_DMA,        /* scratch bank of the other core        */
+    };
+
+    typedef struct heap_region_stats_s
+    {
+        const char *name;
+        uint32_t start;       /* address                                */
+        uint32_t size;        /* bytes managed, 0: region not used      */
+        uint32_t free;        /*                                        */
+        uint32_t largest;     /* largest free block                     */
+        uint32_t free_blocks; /* free block count, fragmentation        */
+    } heap_region_stats_t;
+
+    void *malloc_hint(size_t size, int hint);
+    int heap_region_stats(int index, heap_region_stats_t *st); /* -1: no more regions */
+
     unsigned int strhash(const void *p);
 
     int SysTick_Config(uint32_t ticks);